@@ -5,9 +5,20 @@
  * Created on March 1, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "ADC.h"
 
+volatile unsigned char stallDetected = 0;  // Set when the battery sags as it does with a stalled motor
+volatile unsigned int stallEvents = 0;     // Number of stalls detected since power on
+
+static unsigned char backgroundOn = 0;     // Whether the TMR7 tick is sampling the battery
+static volatile unsigned int fastVolts = 0;         // Battery voltage filtered over ~20 ms (10-bit counts, Q4)
+static volatile unsigned int slowVolts = 0;         // Battery voltage filtered over ~0.6 s (10-bit counts, Q4)
+static unsigned int sagLimit = 0;          // Sag that counts as a stall at the current load (Q4)
+static unsigned char loadPower = 0;        // Motor power the detector is tuned for, 0 disables it
+static unsigned char blankTicks = 0;       // Ticks left to ignore after the load changed
+static unsigned char sagTicks = 0;         // Consecutive ticks over the sag limit
+
 /************************************
  * Description:
  * Function used to initialise ADC module and set it up
@@ -34,8 +45,99 @@ void ADC_init(void) {
  ************************************/
 unsigned int ADC_getval(void) {
     unsigned int tmpval;
-    ADCON0bits.GO = 1;  // Start ADC conversion
-    while (ADCON0bits.GO);  // Wait until conversion done (bit is cleared automatically when done)
-    tmpval = ADRESH;  // Get 8 most significant bits of the ADC result - if we wanted the 
+    HAL_ADC_START();  // Start ADC conversion
+    while (HAL_ADC_BUSY());  // Wait until conversion done (bit is cleared automatically when done)
+    tmpval = HAL_ADC_RESULTH;  // Get 8 most significant bits of the ADC result - if we wanted the 
     return tmpval;  // Return this value when the function is called
 }
+
+/************************************
+ * Description:
+ * Starts sampling the battery voltage in the background from the TMR7 tick,
+ * for stall detection. ADC_getval() must not be used while this is running
+ ************************************/
+void ADC_startBackground(void) {
+    HAL_ADC_START();
+    while (HAL_ADC_BUSY());
+    fastVolts = (unsigned int)(((HAL_ADC_RESULTH << 2) | (HAL_ADC_RESULTL >> 6)) << 4);
+    slowVolts = fastVolts;
+    backgroundOn = 1;
+    HAL_ADC_START();  // The next result is collected by the TMR7 tick
+}
+
+/************************************
+ * Description:
+ * Called from the TMR7 interrupt every TICK_MS. Collects the finished conversion, starts
+ * the next one, and looks for the battery sagging further below its recent level than
+ * the current motor power explains. A stall has to last STALL_TICKS to be reported
+ ************************************/
+void ADC_backgroundTick(void) {
+    if (!backgroundOn || HAL_ADC_BUSY()) {
+        return;
+    }
+    int sample = (int)(((HAL_ADC_RESULTH << 2) | (HAL_ADC_RESULTL >> 6)) << 4);  // 10-bit left justified result, Q4
+    HAL_ADC_START();
+    
+    fastVolts = (unsigned int)((int)fastVolts + (sample - (int)fastVolts) / 4);
+    if (blankTicks > 0 || loadPower == 0) {
+        // Let the inrush of a new command settle, and follow the battery while stopped
+        if (blankTicks > 0) {
+            blankTicks--;
+        }
+        slowVolts = fastVolts;
+        sagTicks = 0;
+        return;
+    }
+    slowVolts = (unsigned int)((int)slowVolts + ((int)fastVolts - (int)slowVolts) / 128);
+    
+    if (slowVolts > fastVolts && slowVolts - fastVolts > sagLimit) {
+        if (sagTicks < STALL_TICKS) {
+            sagTicks++;
+            if (sagTicks == STALL_TICKS) {
+                stallDetected = 1;
+                stallEvents++;
+            }
+        }
+    } else {
+        sagTicks = 0;
+    }
+}
+
+/************************************
+ * Description:
+ * Tells the stall detector which motor power has been commanded. Stalls draw more current
+ * at higher power, so the sag limit follows the power. Starting, stopping or a step of more
+ * than STALL_STEP restarts the detector, blanking it while the current settles and clearing
+ * any previous stall. The smaller changes the approach controller makes on most passes only
+ * move the limit, so the detector keeps watching as the buggy closes in on a card
+ * Inputs:
+ * The commanded motor power, 0 when stopped
+ ************************************/
+void stall_setLoad(unsigned char power) {
+    if (power == loadPower) {
+        return;  // Same command repeated by the main loop
+    }
+    unsigned char step = power > loadPower ? power - loadPower : loadPower - power;
+    if (step > STALL_STEP || (power == 0) != (loadPower == 0)) {
+        blankTicks = STALL_BLANK_TICKS;
+        stallDetected = 0;
+    }
+    loadPower = power;
+    sagLimit = (unsigned int)((STALL_SAG_BASE + ((unsigned int)power * STALL_SAG_SLOPE) / 16) << 4);
+}
+
+/************************************
+ * Description:
+ * Returns the battery voltage as filtered by the background sampling
+ * Outputs:
+ * The voltage filtered over ~20 ms and over ~0.6 s, in mV
+ ************************************/
+void ADC_getBattery(unsigned int* fastMv, unsigned int* slowMv) {
+    unsigned int fast, slow;
+    do {  // The TMR7 interrupt may update them between the two bytes of a read
+        fast = fastVolts;
+        slow = slowVolts;
+    } while (fast != fastVolts || slow != slowVolts);
+    *fastMv = (unsigned int)(((unsigned long)fast * BATTERY_DIVIDER * ADC_VREF_MV) / (1023UL << 4));
+    *slowMv = (unsigned int)(((unsigned long)slow * BATTERY_DIVIDER * ADC_VREF_MV) / (1023UL << 4));
+}
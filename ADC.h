@@ -9,9 +9,22 @@
 #define _ADC_H
 #define _XTAL_FREQ 64000000
 
-#include <xc.h>
+#include "hal.h"
+
+#define STALL_SAG_BASE      8     // Sag (10-bit counts, ~10 mV of battery each) that is a stall at very low power
+#define STALL_SAG_SLOPE     4     // Extra sag allowed per 16% of motor power
+#define STALL_TICKS         10    // Ticks (TICK_MS) the sag must last to be a stall
+#define STALL_BLANK_TICKS   30    // Ticks ignored after the motors start, stop or change power by a step
+#define STALL_STEP          10    // Power change (%) that is a new command rather than the approach easing off
+
+#define BATTERY_DIVIDER     3     // The battery is read through a 1/3 divider
+#define ADC_VREF_MV         3300
 
 void ADC_init(void);  // Function used to initialise ADC module
 unsigned int ADC_getval(void);  // Measures the voltage of the ADC pin as an 8 bit value
+void ADC_startBackground(void);  // Samples the battery from the TMR7 tick for stall detection
+void ADC_backgroundTick(void);
+void stall_setLoad(unsigned char power);
+void ADC_getBattery(unsigned int* fastMv, unsigned int* slowMv);
 
 #endif
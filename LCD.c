@@ -5,10 +5,9 @@
  * Created on March 1, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "LCD.h"
 #include <stdio.h>
-#include <stdlib.h>
 
 
 /************************************
@@ -76,8 +75,7 @@ void LCD_Init(void)
     TRISAbits.TRISA0 = 0;  // Set E1 as output
     DB7 = 0;  // Set DB7 to LOW
 
-    // Initialisation sequence code
-    __delay_ms(50);  // Wait a little to ensure Vdd rises beyond 4.5V
+    // Initialisation sequence code. The caller has waited LCD_POWER_UP_MS since power on
     LCD_sendnibble(0b0011);  // Put LCD into 4-bit data bus mode
     __delay_us(50);  // Make sure to wait long enough before next instruction
     LCD_sendbyte(0b00101000, 0); // Function Set
@@ -107,7 +105,7 @@ void LCD_setCursor (char row, char col)
 /************************************
  * Function to send string to LCD screen
 ************************************/
-void LCD_sendstring(char *string, char row, char col)
+void LCD_sendstring(const char *string, char row, char col)
 {
     LCD_setCursor(row, col);
 	// Code here to send a string to LCD using pointers and LCD_sendbyte function
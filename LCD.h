@@ -17,13 +17,17 @@
 #define E   LATCbits.LATC4
 #define RS  LATCbits.LATC5
 
-#include <xc.h>
+#include "hal.h"
+
+// The display needs this long after power on for Vdd to rise beyond 4.5V before LCD_Init().
+// Its R/W line is tied low, so the busy flag cannot be read instead
+#define LCD_POWER_UP_MS 50
 
 void LCD_E_TOG(void);
 void LCD_sendnibble(unsigned char number);
 void LCD_sendbyte(unsigned char Byte, char type);
 void LCD_Init(void);
 void LCD_setCursor (char row, char col);	
-void LCD_sendstring(char *string, char row, char col);
+void LCD_sendstring(const char *string, char row, char col);
 
 #endif
@@ -0,0 +1,130 @@
+/* 
+ * File:   approach.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "approach.h"
+#include "timers.h"
+
+/************************************
+ * Description:
+ * Integer square root of a 32 bit value
+ ************************************/
+static unsigned int isqrt(unsigned long x) {
+    unsigned long result = 0;
+    unsigned long bit = 1UL << 30;
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (x >= result + bit) {
+            x -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (unsigned int)result;
+}
+
+/************************************
+ * Description:
+ * Forgets the previous estimate, for use after a manoeuvre
+ * Inputs:
+ * The approach estimator to reset
+ ************************************/
+void approachReset(struct Approach* a) {
+    a->distance = APPROACH_D_FAR;
+    a->speed = 0;
+    a->tick = 0;
+    a->valid = 0;
+}
+
+/************************************
+ * Description:
+ * Estimates the distance to the surface in front of the sensor. Reflected light falls
+ * off with the square of distance, so distance is proportional to 1/sqrt(V - minV)
+ * Inputs:
+ * The clear channel (V) reading and the calibrated min value
+ * Outputs:
+ * The distance in Q8 units of the stop distance, capped at APPROACH_D_FAR
+ ************************************/
+unsigned int approachDistance(unsigned char V, unsigned char minV) {
+    if (V <= minV) {
+        return APPROACH_D_FAR;
+    }
+    // 256 * sqrt(APPROACH_V_STOP / (V - minV))
+    unsigned int d = isqrt(((unsigned long)APPROACH_V_STOP << 16) / (V - minV));
+    return d > APPROACH_D_FAR ? APPROACH_D_FAR : d;
+}
+
+/************************************
+ * Description:
+ * The inverse of approachDistance(): the rise in V above minV expected at a distance
+ * Inputs:
+ * The distance in Q8 units of the stop distance
+ * Outputs:
+ * The rise in V, which may be beyond the 8-bit range
+ ************************************/
+unsigned int approachLevel(unsigned int distance) {
+    if (distance < 16) {
+        distance = 16;
+    }
+    unsigned long level = ((unsigned long)APPROACH_V_STOP << 16) / ((unsigned long)distance * distance);
+    return level > 65535 ? 65535 : (unsigned int)level;
+}
+
+/************************************
+ * Description:
+ * The distance at which to trigger the emergency brake. This is the contact distance
+ * plus however far the buggy closes during the brake latency at its current speed
+ * Inputs:
+ * The approach estimator state
+ * Outputs:
+ * The distance in Q8 units of the stop distance
+ ************************************/
+unsigned int approachBrakeDistance(struct Approach* a) {
+    return BRAKE_D_CONTACT + (unsigned int)((unsigned long)a->speed * BRAKE_LATENCY / 1000);
+}
+
+/************************************
+ * Description:
+ * Chooses the forward power for the approach. The distance and closing speed are
+ * estimated from successive readings, the distance is projected APPROACH_LOOKAHEAD ms
+ * ahead, and the power is set in proportion to the fastest speed the buggy could still
+ * brake from before the stop distance: sqrt(2 * APPROACH_DECEL * remaining distance)
+ * Inputs:
+ * The estimator state, the clear channel (V) reading, the calibrated min value, the
+ * tickCount of the reading and the crawling and cruising powers
+ * Outputs:
+ * The power to drive forward at, between lowPower and highPower
+ ************************************/
+unsigned char approachPower(struct Approach* a, unsigned char V, unsigned char minV, unsigned int tick, unsigned char lowPower, unsigned char highPower) {
+    unsigned int d = approachDistance(V, minV);
+    
+    if (a->valid && tick != a->tick) {
+        unsigned int ms = (tick - a->tick) * TICK_MS;
+        unsigned int closing = d < a->distance ? (unsigned int)((unsigned long)(a->distance - d) * 1000 / ms) : 0;
+        a->speed = (unsigned int)(((unsigned long)a->speed * 3 + closing) / 4);  // Smooth the noisy differences
+    }
+    a->distance = d;
+    a->tick = tick;
+    a->valid = 1;
+    
+    // Where the buggy will be when the next decision is made
+    unsigned int travel = (unsigned int)((unsigned long)a->speed * APPROACH_LOOKAHEAD / 1000);
+    unsigned int projected = d > travel ? d - travel : 0;
+    if (projected <= 256) {
+        return lowPower;
+    }
+    
+    unsigned int target = isqrt(2UL * APPROACH_DECEL * (projected - 256));
+    if (target >= APPROACH_SPEED_MAX) {
+        return highPower;
+    }
+    return (unsigned char)(lowPower + (unsigned int)(highPower - lowPower) * target / APPROACH_SPEED_MAX);
+}
@@ -0,0 +1,36 @@
+/* 
+ * File:   approach.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef _approach_H
+#define _approach_H
+
+#include "hal.h"
+
+// Distances are relative, in Q8 units of the stop distance (256 = where V is APPROACH_V_STOP above minV)
+#define APPROACH_V_STOP     60    // V above minV at which the buggy should be down to crawling speed
+#define APPROACH_D_FAR      2048  // Distances are capped at 8 stop distances (the far end of the sensor's range)
+#define APPROACH_SPEED_MAX  2560  // Closing speed at HIGH_POWER, stop distances (Q8) per second
+#define APPROACH_DECEL      8192  // Braking the buggy can be relied on for, stop distances (Q8) per second^2
+#define APPROACH_LOOKAHEAD  150   // ms until the next decision, the distance covered before then is budgeted for
+#define BRAKE_D_CONTACT     512   // Distance at which the brake is armed to fire, two stop distances so it fires before contact
+#define BRAKE_LATENCY       70    // ms from passing the brake threshold to the motors braking (one integration)
+
+// Definition of the approach estimator state
+struct Approach {
+    unsigned int distance;  // Latest distance estimate (Q8 stop distances)
+    unsigned int speed;     // Filtered closing speed (Q8 stop distances per second)
+    unsigned int tick;      // tickCount of the latest estimate
+    unsigned char valid;    // Whether distance and tick hold a previous estimate
+};
+
+void approachReset(struct Approach* a);
+unsigned int approachDistance(unsigned char V, unsigned char minV);
+unsigned int approachLevel(unsigned int distance);
+unsigned int approachBrakeDistance(struct Approach* a);
+unsigned char approachPower(struct Approach* a, unsigned char V, unsigned char minV, unsigned int tick, unsigned char lowPower, unsigned char highPower);
+
+#endif
@@ -5,11 +5,19 @@
  * Created on February 23, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include "color.h"
 #include "i2c.h"
 #include "LCD.h"
+#include "timers.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "eeprom.h"
+
+extern volatile unsigned int tickCount;
 
 // This array of char pointers helps convert between a numeric representation
 // of the colour, and a visual representation for the LCD to display
@@ -20,9 +28,63 @@ static char* COLOUR[11] = { "-               ", "--              ", "---
 
 // This tally keeps track of the most likley colour based on the previous n samples
 static unsigned char runningTallyCol[11] = {0,0,0,0,0,0,0,0,0,0,0};
+
+// The calibrated colour centres, and how far each has drifted from them in 1/16ths of a unit
+static struct HSV calibratedCentres[8];
+static int driftH[8];
+static int driftS[8];
+static int driftV[8];
+static unsigned char driftTracking = 0;        // Whether senseColour() follows the drift
 volatile unsigned char RED_BRIGHTNESS = 160;    // The PWM of the Red LED
 volatile unsigned char GREEN_BRIGHTNESS = 100;  // The PWM of the Green LED
 volatile unsigned char BLUE_BRIGHTNESS = 255;   // The PWM of the Blue LED
+volatile unsigned char LED_ENABLE = LED_RED | LED_GREEN | LED_BLUE;  // Which LED channels the PWM drives
+volatile unsigned char wallNear = 1;  // Set by the colour click INT line once the clear channel passes the approach threshold
+volatile unsigned char brakeArmed = 0;  // When set, the INT line means a collision is imminent rather than a surface is near
+
+static unsigned char sampleMode = SAMPLE_NORMAL;  // How color_sample() reads the sensor
+
+// Analogue gain (AGAIN) state. Readings are normalised to AGAIN_REF and ATIME_LONG so the
+// colour centres stay valid whichever gain and integration time the sensor is using
+static const unsigned int AGAIN_NORM[4] = { 1024, 256, 64, 17 };  // 4x / gain in Q8 for 1x, 4x, 16x, 60x
+static unsigned char againIndex = AGAIN_REF;
+static unsigned char atimeCycles = 256 - ATIME_LONG;
+static unsigned char autoGain = 0;
+static unsigned char enableBits = 0x03;  // ENABLE register value while integrating (PON, AEN and maybe AIEN)
+static unsigned char approachPrimed = 0;  // color_prime_approach() has started the baseline integration
+static unsigned int ponTick;             // tickCount when the click was powered on
+static unsigned int lastAmbientC = 0;    // Raw clear count of the latest LED-off reading
+static unsigned int brakeLevel = 0;      // Clear level (in V units) that triggers the emergency brake
+static unsigned char brakeGain = 0;      // Gain that brakeLevel is scaled with
+static unsigned char pipelined = 0;      // The next differential reading's lit half is integrating
+static unsigned char timedOut = 0;       // An integration did not complete in time since color_sample() started
+
+// The latest reading, for color_latest() and getLastColour(). The sensor reads fill in its raw
+// counts, and senseColour() adds the rest. Both run in the main loop, so nothing sees it half written
+static struct ColourSample latest;
+
+// Records the reading being taken in the trace, with TRACE_FLAG_* bits
+#define traceLastSample(flags)  trace_sample(&latest.raw, againIndex, atimeCycles, \
+            (unsigned char)((sampleMode == SAMPLE_DIFFERENTIAL ? TRACE_FLAG_DIFFERENTIAL : 0) | (flags)))
+
+static unsigned long color_raw_from_value(unsigned int V, unsigned char gain);
+static void color_write_aiht(unsigned long threshold);
+
+// Spectral signatures of the easily confused colours, indexed by SPECTRAL_SLOT
+static const signed char SPECTRAL_SLOT[8] = { 0, -1, 1, -1, -1, -1, 2, 3 };  // Colour centre index -> slot
+static const unsigned char SPECTRAL_CLASS[4] = { 0, 2, 6, 7 };             // Slot -> colour centre index
+static struct Spectral spectralCentres[4];
+static unsigned char spectralValid = 0;        // Bit per slot, set once that slot is calibrated
+static unsigned char spectralConfirm = 0;      // Whether senseColour() uses the spectral check
+static unsigned int spectralChecks = 0;        // Statistics for showSpectralStats()
+static unsigned int spectralOverrides = 0;
+static unsigned int spectralTicks = 0;
+
+// Hue bin table for segmentFast(), built from the calibrated centres by initColourTable().
+// Zeroed, every reading falls back to the full search
+static unsigned char binCandidates[HUE_BINS];  // Bit per colour centre that could be accepted in the bin
+static unsigned int binBound[HUE_BINS];        // No centre left out of the bin can be nearer than this
+static unsigned char fastDistances;            // Distances the latest segmentFast() call worked out
 
 /************************************
  * Description:
@@ -30,22 +92,26 @@ volatile unsigned char BLUE_BRIGHTNESS = 255;   // The PWM of the Blue LED
  * Inputs:
  * Hue, Saturation and Value as unsigned chars
  * Outputs:
- * A pointer to the memory location which now stores a new HSV structure
+ * The new HSV structure, by value (the firmware uses no heap)
  ************************************/
-struct HSV* HSV(unsigned char H, unsigned char S, unsigned char V) { 
-    struct HSV* c = malloc(sizeof(struct HSV));  // Allocate memory equal to the memory size required of the structure
-    c->H = H;  // Set the hue of this structure
-    c->S = S;  // Set the saturation of this structure
-    c->V = V;  // Set the value of this structure
+struct HSV HSV(unsigned char H, unsigned char S, unsigned char V) { 
+    struct HSV c;
+    c.H = H;  // Set the hue of this structure
+    c.S = S;  // Set the saturation of this structure
+    c.V = V;  // Set the value of this structure
     return c;
-};
+}
 
 /************************************
  * Description:
  * Initialisation function for the colour click
- * The I2C is initialised and the desired gain and integration time settings are set
+ * The I2C is initialised, the click is powered on and the gain and integration time
+ * settings are set. No integration starts until color_click_start(), so the click's
+ * warm-up runs while the rest of the buggy starts up. Needs the TMR7 tick to be running
+ * Outputs:
+ * 0 on success, 1 if the I2C bus is held busy (try again)
  ************************************/
-void color_click_init(void) {
+unsigned char color_click_init(void) {
     // Set the red LED pin as output
     LATGbits.LATG0 = 0;
     TRISGbits.TRISG0 = 0;
@@ -58,23 +124,36 @@ void color_click_init(void) {
     LATAbits.LATA3 = 0;
     TRISAbits.TRISA3 = 0;
     
+    // Set the colour click INT line as an input with a pull-up (it is open drain, active low)
+    TRISBbits.TRISB1 = 1;
+    ANSELBbits.ANSELB1 = 0;
+    WPUBbits.WPUB1 = 1;
+    INT1PPS = 0x09;  // INT1 on RB1
+    
     // Setup colour sensor via I2C interface
     I2C_2_Master_Init();  // Initialise I2C as master
-    __delay_ms(10);
-    
-    // This loop will inform the user that there is a problem with the colour sensor on the I2C bus
-    while(I2C_2_Master_Idle()){
-        LCD_sendstring("I2C Busy...     ", 0, 0);
+    if(I2C_2_Master_Idle()){
+        return 1;  // Something is holding the bus
     }
     
-    // Set device PON
+    // Set device PON. The settings can be written straight away, but the oscillator needs
+    // 2.4 ms before AEN starts an integration
 	color_writetoaddr(0x00, 0x01);
-    __delay_ms(5);  // We need to wait 5ms for everything to start up
-    color_writetoaddr(0x00, 0x03); // Turn on device ADC. Write 1 to the PON bit in the device enable register
-    __delay_ms(5);
-    color_writetoaddr(0x0F, 0x11); // Gain setting: 00 1 gain, 01 4 gain, 10 16 gain, 11 60 gain
-    __delay_ms(5);
-    color_writetoaddr(0x01, 0x90); // Integration time ATIME: 0xFF 2.4 ms, 0xF6 24 ms, 0xD5 101 ms, 0xC0 154 ms, 0x00 700 ms 
+    ponTick = tickCount;
+    color_set_again(AGAIN_REF); // Gain setting: 00 1 gain, 01 4 gain, 10 16 gain, 11 60 gain
+    color_set_atime(ATIME_LONG); // Integration time ATIME: 0xFF 2.4 ms, 0xF6 24 ms, 0xD5 101 ms, 0xC0 154 ms, 0x00 700 ms 
+    return 0;
+}
+
+/************************************
+ * Description:
+ * Starts the first integration once the colour click has warmed up after color_click_init()
+ ************************************/
+void color_click_start(void) {
+    while((unsigned int)(tickCount - ponTick) < PON_WARMUP_TICKS){
+        __delay_ms(1);
+    }
+    color_writetoaddr(0x00, enableBits);  // Turn on device ADC (AEN)
 }
 
 /************************************
@@ -93,81 +172,630 @@ void color_writetoaddr(char address, char value) {
 
 /************************************
  * Description:
- * This function will read the colour sensor values for RGB and Clear
+ * Reads a single register of the colour click
  * Inputs:
- * A gain value which scales the output to an appropriate range given the lighting conditions
+ * The address of the register to read
+ * Outputs:
+ * The value of the register
+ ************************************/
+unsigned int color_readfromaddr(char address) {
+    unsigned int value;
+    I2C_2_Master_Start();                // Start condition
+    I2C_2_Master_Write(0x52 | 0x00);     // 7 bit device address + Write mode
+    I2C_2_Master_Write(0x80 | address);  // Command + register address
+    I2C_2_Master_RepStart();             // Start a repeated transmission
+    I2C_2_Master_Write(0x52 | 0x01);     // 7 bit address + Read (1) mode
+    value = I2C_2_Master_Read(0);        // Read the value (don't acknowledge as this is the only read)
+    I2C_2_Master_Stop();                 // Stop condition
+    return value;
+}
+
+/************************************
+ * Description:
+ * Reads the raw 16-bit clear, red, green and blue counts in one auto-increment transaction
+ * Outputs:
+ * An RGBRaw structure holding the RGBC counts
+ ************************************/
+struct RGBRaw color_read_raw(void) {
+    struct RGBRaw raw;
+    PROFILE_BEGIN(PROF_I2C);
+    I2C_2_Master_Start();               // Start condition
+    I2C_2_Master_Write(0x52 | 0x00);    // 7 bit address + Write mode
+    I2C_2_Master_Write(0xA0 | 0x14);    // Auto-increment protocol transaction + start at CLEAR low register
+    I2C_2_Master_RepStart();            // Start a repeated transmission
+    I2C_2_Master_Write(0x52 | 0x01);    // 7 bit address + Read (1) mode
+    raw.C = I2C_2_Master_Read(1);       // The registers follow each other as CLEAR, RED, GREEN, BLUE (LSB first)
+    raw.C |= ((unsigned int)I2C_2_Master_Read(1)<<8);
+    raw.R = I2C_2_Master_Read(1);
+    raw.R |= ((unsigned int)I2C_2_Master_Read(1)<<8);
+    raw.G = I2C_2_Master_Read(1);
+    raw.G |= ((unsigned int)I2C_2_Master_Read(1)<<8);
+    raw.B = I2C_2_Master_Read(1);
+    raw.B |= ((unsigned int)I2C_2_Master_Read(0)<<8);  // Don't acknowledge the BLUE MSB as this is the last read
+    I2C_2_Master_Stop();                // Stop condition
+    PROFILE_END(PROF_I2C);
+    return raw;
+}
+
+/************************************
+ * Description:
+ * Scales raw RGBC counts by the gain and saturates them to 8-bits
+ * Inputs:
+ * The raw counts and a gain value which scales the output to an appropriate range given the lighting conditions
  * Outputs:
  * An RGB structure holding the RGBC information as 8-bit values
  ************************************/
-struct RGB color_read_all(unsigned char gain) {
+struct RGB color_scale(struct RGBRaw raw, unsigned char gain) {
     struct RGB out;
     
-    // Read the clear sensor information
-    unsigned int clear;
-	I2C_2_Master_Start();               // Start condition
-	I2C_2_Master_Write(0x52 | 0x00);    // 7 bit address + Write mode
-	I2C_2_Master_Write(0xA0 | 0x14);    // Auto-increment protocol transaction + start at CLEAR low register
-	I2C_2_Master_RepStart();			// Start a repeated transmission
-	I2C_2_Master_Write(0x52 | 0x01);    // 7 bit address + Read (1) mode
-	clear = I2C_2_Master_Read(1);		// Read the CLEAR LSB
-	clear |= ((unsigned int)I2C_2_Master_Read(0)<<8);  // Read the CLEAR MSB (don't acknowledge as this is the last read)
-	I2C_2_Master_Stop();                // Stop condition
-    
-    // Read the red sensor information
-	unsigned int red;
-	I2C_2_Master_Start();               // Start condition
-	I2C_2_Master_Write(0x52 | 0x00);    // 7 bit address + Write mode
-	I2C_2_Master_Write(0xA0 | 0x16);    // Auto-increment protocol transaction + start at RED low register
-	I2C_2_Master_RepStart();			// Start a repeated transmission
-	I2C_2_Master_Write(0x52 | 0x01);    // 7 bit address + Read (1) mode
-	red = I2C_2_Master_Read(1);			// Read the RED LSB
-	red |= ((unsigned int)I2C_2_Master_Read(0)<<8);  // Read the RED MSB (don't acknowledge as this is the last read)
-	I2C_2_Master_Stop();                // Stop condition
-	
-    // Read the green sensor information
-    unsigned int green;
-	I2C_2_Master_Start();               // Start condition
-	I2C_2_Master_Write(0x52 | 0x00);    // 7 bit address + Write mode
-	I2C_2_Master_Write(0xA0 | 0x18);    // Auto-increment protocol transaction + start at GREEN low register
-	I2C_2_Master_RepStart();			// Start a repeated transmission
-	I2C_2_Master_Write(0x52 | 0x01);    // 7 bit address + Read (1) mode
-	green = I2C_2_Master_Read(1);		// Read the GREEN LSB
-	green |= ((unsigned int)I2C_2_Master_Read(0)<<8);  // Read the GREEN MSB (don't acknowledge as this is the last read)
-	I2C_2_Master_Stop();                // Stop condition
-    
-    // Read the blue sensor information
-    unsigned int blue;
-	I2C_2_Master_Start();               // Start condition
-	I2C_2_Master_Write(0x52 | 0x00);    // 7 bit address + Write mode
-	I2C_2_Master_Write(0xA0 | 0x1A);    // Auto-increment protocol transaction + start at BLUE low register
-	I2C_2_Master_RepStart();			// Start a repeated transmission
-	I2C_2_Master_Write(0x52 | 0x01);    // 7 bit address + Read (1) mode
-	blue = I2C_2_Master_Read(1);		// Read the BLUE LSB
-	blue |= ((unsigned int)I2C_2_Master_Read(0)<<8);  // Read the BLUE MSB (don't acknowledge as this is the last read)
-	I2C_2_Master_Stop();                // Stop condition
-    
     // Scale the values by the gain amount and cast to 8-bits
-    out.R = (unsigned char)(red >> (gain + 1));  // Devision by 2 as RED channel is more sensitive
-    out.G = (unsigned char)(green >> gain);
-    out.B = (unsigned char)(blue >> gain);
-    out.C = (unsigned char)(clear >> (gain + 2));  // Division by 4 as CLEAR channel is more sensitive
+    out.R = (unsigned char)(raw.R >> (gain + 1));  // Devision by 2 as RED channel is more sensitive
+    out.G = (unsigned char)(raw.G >> gain);
+    out.B = (unsigned char)(raw.B >> gain);
+    out.C = (unsigned char)(raw.C >> (gain + 2));  // Division by 4 as CLEAR channel is more sensitive
     
     // Make sure values don't overflow but instead max out at 255
-    if((red >> (8 + (gain + 1))) > 0){
+    if((raw.R >> (8 + (gain + 1))) > 0){
         out.R = 0xFF;
     }
-    if((green >> (8 + gain)) > 0){
+    if((raw.G >> (8 + gain)) > 0){
         out.G = 0xFF;
     }
-    if((blue >> (8 + gain)) > 0){
+    if((raw.B >> (8 + gain)) > 0){
         out.B = 0xFF;
     }
-    if((clear >> (8 + (gain + 2))) > 0){
+    if((raw.C >> (8 + (gain + 2))) > 0){
         out.C = 0xFF;
     }
     return out;
 }
 
+/************************************
+ * Description:
+ * Sets the analogue gain of the sensor (CONTROL register)
+ * Inputs:
+ * The AGAIN index: 0 1x, 1 4x, 2 16x, 3 60x
+ ************************************/
+void color_set_again(unsigned char index) {
+    againIndex = index;
+    pipelined = 0;
+    color_writetoaddr(0x0F, 0x10 | index);
+    if(brakeArmed){
+        color_update_brake(brakeLevel, brakeGain);  // The raw threshold depends on the gain
+    }
+}
+
+/************************************
+ * Description:
+ * Sets the integration time of the sensor (ATIME register)
+ * Inputs:
+ * The ATIME register value, giving 256 - ATIME integration cycles of 2.4 ms
+ ************************************/
+void color_set_atime(unsigned char atime) {
+    atimeCycles = (unsigned char)(256 - atime);
+    pipelined = 0;
+    color_writetoaddr(0x01, atime);
+}
+
+/************************************
+ * Description:
+ * Turns the runtime automatic gain control on or off. Turning it off returns the sensor to AGAIN_REF
+ * Inputs:
+ * 1 to enable, 0 to disable
+ ************************************/
+void setAutoGain(unsigned char enable) {
+    autoGain = enable;
+    if(!enable && againIndex != AGAIN_REF){
+        color_set_again(AGAIN_REF);
+    }
+}
+
+/************************************
+ * Description:
+ * Steps the analogue gain down when the clear channel nears saturation and up when it
+ * is small. The thresholds leave a factor of two of hysteresis either side of a 4x step
+ * Inputs:
+ * The raw clear count of the latest reading
+ * Outputs:
+ * 1 if the gain was changed (the reading should be retaken), 0 otherwise
+ ************************************/
+unsigned char color_agc_update(unsigned int clear) {
+    if(!autoGain){
+        return 0;
+    }
+    unsigned long fullScale = (unsigned long)atimeCycles * 1024;  // Each cycle adds at most 1024 counts
+    unsigned int high = fullScale > 65535 ? (65535 / 4) * 3 : (unsigned int)((fullScale / 4) * 3);
+    unsigned int low = high / 8;
+    
+    if(clear > high && againIndex > 0){
+        color_set_again(againIndex - 1);
+        return 1;
+    }
+    if(clear < low && againIndex < 3){
+        color_set_again(againIndex + 1);
+        return 1;
+    }
+    return 0;
+}
+
+/************************************
+ * Description:
+ * Scales raw counts to what they would have been at AGAIN_REF and ATIME_LONG
+ * Inputs:
+ * Raw counts taken at the current gain and integration time
+ * Outputs:
+ * The normalised counts, saturated to 16 bits
+ ************************************/
+struct RGBRaw color_normalise(struct RGBRaw raw) {
+    return color_normalise_with(raw, againIndex, atimeCycles);
+}
+
+/************************************
+ * Description:
+ * Scales raw counts to what they would have been at AGAIN_REF and ATIME_LONG
+ * Inputs:
+ * Raw counts, and the AGAIN index and number of ATIME cycles they were taken with
+ * Outputs:
+ * The normalised counts, saturated to 16 bits
+ ************************************/
+struct RGBRaw color_normalise_with(struct RGBRaw raw, unsigned char again, unsigned char cycles) {
+    unsigned long scale = (unsigned long)AGAIN_NORM[again] * (256 - ATIME_LONG) / cycles;  // Q8
+    unsigned long R = ((unsigned long)raw.R * scale) >> 8;
+    unsigned long G = ((unsigned long)raw.G * scale) >> 8;
+    unsigned long B = ((unsigned long)raw.B * scale) >> 8;
+    unsigned long C = ((unsigned long)raw.C * scale) >> 8;
+    raw.R = R > 65535 ? 65535 : (unsigned int)R;
+    raw.G = G > 65535 ? 65535 : (unsigned int)G;
+    raw.B = B > 65535 ? 65535 : (unsigned int)B;
+    raw.C = C > 65535 ? 65535 : (unsigned int)C;
+    return raw;
+}
+
+/************************************
+ * Description:
+ * This function will read the colour sensor values for RGB and Clear. If the automatic
+ * gain control changes the gain, the reading is retaken once an integration has completed at the new gain
+ * Inputs:
+ * A gain value which scales the output to an appropriate range given the lighting conditions
+ * Outputs:
+ * An RGB structure holding the RGBC information as 8-bit values
+ ************************************/
+struct RGB color_read_all(unsigned char gain) {
+    struct RGBRaw raw = color_read_raw();
+    if(color_agc_update(raw.C)){
+        color_wait_fresh();
+        raw = color_read_raw();
+    }
+    latest.raw = raw;  // Counts before normalisation, for the trace
+    return color_scale(color_normalise(raw), gain);
+}
+
+/************************************
+ * Description:
+ * Switches the illumination LED channels on or off. Channels switched off are driven
+ * low straight away rather than at the next PWM edge
+ * Inputs:
+ * A mask of LED_RED, LED_GREEN and LED_BLUE
+ ************************************/
+void setLEDMask(unsigned char mask) {
+    LED_ENABLE = mask;
+    pipelined = 0;
+    if(!(mask & LED_RED)){
+        LATGbits.LATG0 = 0;
+    }
+    if(!(mask & LED_GREEN)){
+        LATEbits.LATE7 = 0;
+    }
+    if(!(mask & LED_BLUE)){
+        LATAbits.LATA3 = 0;
+    }
+}
+
+/************************************
+ * Description:
+ * Abandons the current RGBC integration and starts a new one. The data registers keep
+ * the result of the last completed integration until the new one finishes
+ ************************************/
+void color_restart(void) {
+    pipelined = 0;
+    color_writetoaddr(0x00, 0x01);  // Clear AEN (keep PON) to abandon the current integration and AVALID
+    color_writetoaddr(0x00, enableBits);  // Set AEN (and AIEN if armed) to start a new integration
+}
+
+/************************************
+ * Description:
+ * Waits for the running RGBC integration to complete
+ * Outputs:
+ * 0 on success, 1 if the sensor did not complete an integration in time
+ ************************************/
+unsigned char color_wait_valid(void) {
+    for(unsigned int timeout = 0; timeout < 800; timeout++){
+        if(color_readfromaddr(0x13) & 0x01){  // AVALID in the STATUS register
+            return 0;
+        }
+        __delay_ms(1);
+    }
+    timedOut = 1;  // Reported by color_timed_out() to callers that only get the counts
+    return 1;
+}
+
+/************************************
+ * Description:
+ * Restarts the RGBC integration and waits for it to complete, so that the next read
+ * only contains light from after this call
+ * Outputs:
+ * 0 on success, 1 if the sensor did not complete an integration in time
+ ************************************/
+unsigned char color_wait_fresh(void) {
+    color_restart();
+    return color_wait_valid();
+}
+
+/************************************
+ * Description:
+ * Reads the sensor once with the illumination LED on and once with it off, and
+ * subtracts the two so that ambient light cancels out. Each half uses the short
+ * ATIME_DIFF integration, so the pair takes less time than one ATIME_LONG integration.
+ * The next reading's lit half is started before returning, so that it integrates while
+ * this one is classified. It is thrown away if the LED, gain or integration time is
+ * changed in between
+ * Inputs:
+ * The gain value used to scale to 8-bits
+ * Outputs:
+ * The differential RGBC information as 8-bit values, normalised to a long integration
+ ************************************/
+struct RGB color_read_differential(unsigned char gain) {
+    struct RGBRaw on, off;
+    unsigned char mask = LED_ENABLE;
+    
+    if(pipelined){
+        pipelined = 0;
+        color_wait_valid();
+    } else {
+        color_wait_fresh();
+    }
+    on = color_read_raw();
+    if(color_agc_update(on.C)){  // Retake the lit reading at the new gain
+        color_wait_fresh();
+        on = color_read_raw();
+    }
+    setLEDMask(0);
+    color_wait_fresh();
+    off = color_read_raw();
+    setLEDMask(mask);
+    color_restart();  // The next reading's lit half integrates while this one is classified
+    pipelined = 1;
+    lastAmbientC = off.C;
+    
+    on.R = on.R > off.R ? (on.R - off.R) : 0;
+    on.G = on.G > off.G ? (on.G - off.G) : 0;
+    on.B = on.B > off.B ? (on.B - off.B) : 0;
+    on.C = on.C > off.C ? (on.C - off.C) : 0;
+    latest.raw = on;
+    return color_scale(color_normalise(on), gain);
+}
+
+/************************************
+ * Description:
+ * Selects how color_sample() reads the sensor, and sets the matching integration time
+ * Inputs:
+ * SAMPLE_NORMAL or SAMPLE_DIFFERENTIAL
+ ************************************/
+void setColourSampleMode(unsigned char mode) {
+    sampleMode = mode;
+    color_set_atime(mode == SAMPLE_DIFFERENTIAL ? ATIME_DIFF : ATIME_LONG);
+}
+
+/************************************
+ * Description:
+ * Builds a spectral signature by reading RGBC under red, then green, then blue
+ * illumination. The readout of each integration is overlapped with the next one:
+ * as soon as an integration completes the LED is switched and the next integration
+ * started, and only then are the finished counts read over I2C
+ * Inputs:
+ * The gain value used to scale to 8-bits and the signature to fill
+ * Outputs:
+ * 0 on success, 1 if the sensor did not complete an integration in time
+ ************************************/
+unsigned char color_read_spectral(unsigned char gain, struct Spectral* sig) {
+    static const unsigned char illumination[3] = { LED_RED, LED_GREEN, LED_BLUE };
+    unsigned char mask = LED_ENABLE;
+    unsigned char failed;
+    struct RGB col;
+    
+    setLEDMask(illumination[0]);
+    failed = color_wait_fresh();
+    for(unsigned char k = 0; k < 3; k++){
+        if(k < 2){
+            setLEDMask(illumination[k + 1]);
+            color_restart();  // Next integration runs while this one is read out
+        } else {
+            setLEDMask(mask);
+        }
+        col = color_scale(color_normalise(color_read_raw()), gain);
+        sig->v[4*k + 0] = col.R;
+        sig->v[4*k + 1] = col.G;
+        sig->v[4*k + 2] = col.B;
+        sig->v[4*k + 3] = col.C;
+        if(k < 2){
+            failed |= color_wait_valid();
+        }
+    }
+    return failed;
+}
+
+/************************************
+ * Description:
+ * Returns a brightness independent distance between two spectral signatures.
+ * Each signature is scaled by the sum of the other, so a card read from further
+ * away (which is dimmer in every channel) still matches its calibrated signature
+ * Inputs:
+ * Two spectral signatures
+ * Outputs:
+ * The L1 distance between the cross-scaled signatures
+ ************************************/
+unsigned long spectralDistance(const struct Spectral* a, const struct Spectral* b) {
+    unsigned int sumA = 0, sumB = 0;
+    for(unsigned char i = 0; i < 12; i++){
+        sumA += a->v[i];
+        sumB += b->v[i];
+    }
+    unsigned long dist = 0;
+    for(unsigned char i = 0; i < 12; i++){
+        unsigned long x = (unsigned long)a->v[i] * sumB;
+        unsigned long y = (unsigned long)b->v[i] * sumA;
+        dist += x > y ? x - y : y - x;
+    }
+    return dist;
+}
+
+/************************************
+ * Description:
+ * Turns the spectral confirmation of easily confused colours on or off
+ * Inputs:
+ * 1 to confirm pink/white and blue/light blue with a spectral signature, 0 to disable
+ ************************************/
+void setSpectralConfirm(unsigned char enable) {
+    spectralConfirm = enable;
+}
+
+/************************************
+ * Description:
+ * Re-checks a pink/white or blue/light blue classification using the spectral
+ * signature and the calibrated signatures of both colours in the pair. Colours outside
+ * those pairs, or pairs that have not been calibrated, are returned unchanged
+ * Inputs:
+ * The colour/proximity from segment() and the gain
+ * Outputs:
+ * The confirmed colour/proximity
+ ************************************/
+unsigned char confirmSpectral(unsigned char colour_index, unsigned char gain) {
+    if(!spectralConfirm || colour_index < 3){
+        return colour_index;
+    }
+    signed char slot = SPECTRAL_SLOT[colour_index - 3];
+    if(slot < 0){
+        return colour_index;
+    }
+    signed char other = slot ^ 1;  // Pairs are slots 0/1 (white/pink) and 2/3 (light blue/blue)
+    if(!((spectralValid >> slot) & 1) || !((spectralValid >> other) & 1)){
+        return colour_index;
+    }
+    
+    struct Spectral sig;
+    unsigned int start = tickCount;
+    if(color_read_spectral(gain, &sig)){
+        return colour_index;  // No signature to check against
+    }
+    spectralTicks += tickCount - start;
+    spectralChecks++;
+    
+    if(spectralDistance(&sig, &spectralCentres[other]) < spectralDistance(&sig, &spectralCentres[slot])){
+        spectralOverrides++;
+        return SPECTRAL_CLASS[other] + 3;
+    }
+    return colour_index;
+}
+
+/************************************
+ * Description:
+ * Shows how often the spectral check overturned the HSV classification, and the
+ * average time each check took
+ ************************************/
+void showSpectralStats(void) {
+    char buf[17];  // One LCD line and the terminator
+    unsigned int ms = spectralChecks ? (unsigned int)((unsigned long)spectralTicks * TICK_MS / spectralChecks) : 0;
+    sprintf(buf, "Spec %03u/%03u    ", spectralOverrides > 999 ? 999 : spectralOverrides, spectralChecks > 999 ? 999 : spectralChecks);
+    LCD_sendstring(buf, 0, 0);
+    sprintf(buf, "Latency %04ums  ", ms > 9999 ? 9999 : ms);
+    LCD_sendstring(buf, 1, 0);
+}
+
+/************************************
+ * Description:
+ * Starts the integration color_arm_approach() takes its baseline from, so that it runs
+ * while the caller finishes off. Call once the buggy has stopped where the approach
+ * starts
+ ************************************/
+void color_prime_approach(void) {
+    setLEDMask(LED_RED | LED_GREEN | LED_BLUE);
+    color_restart();
+    approachPrimed = 1;
+}
+
+/************************************
+ * Description:
+ * Programs the clear channel interrupt so that the colour click INT line (and so the
+ * INT1 interrupt) fires once the buggy approaches a surface. The threshold is set
+ * WAKE_MARGIN_V above the current clear reading, converted back to raw counts at the
+ * current gain, and must be exceeded for two consecutive integrations. If the buggy is
+ * already close to a surface it is not armed, and classification carries on. The
+ * baseline is a fresh integration, or the one color_prime_approach() started
+ * Inputs:
+ * The gain value used to scale readings to 8-bits and the calibrated min value
+ ************************************/
+void color_arm_approach(unsigned char gain, unsigned char minV) {
+    PIE0bits.INT1IE = 0;
+    unsigned char failed;
+    if (approachPrimed) {
+        approachPrimed = 0;
+        failed = color_wait_valid();
+    } else {
+        setLEDMask(LED_RED | LED_GREEN | LED_BLUE);
+        failed = color_wait_fresh();
+    }
+    struct RGBRaw raw = color_read_raw();
+    unsigned int baseline = raw.C;
+    if(failed || color_scale(color_normalise(raw), gain).C > minV + WAKE_MARGIN_V){
+        wallNear = 1;  // Already near a surface, or no baseline to arm from
+        return;
+    }
+    
+    unsigned long threshold = baseline + color_raw_from_value(WAKE_MARGIN_V, gain);
+    color_writetoaddr(0x04, 0x00);  // AILT = 0, so only the high threshold can trigger
+    color_writetoaddr(0x05, 0x00);
+    color_write_aiht(threshold);
+    color_writetoaddr(0x0C, 0x02);  // Persistence: two consecutive integrations out of range
+    color_clear_int();
+    enableBits = 0x13;
+    color_writetoaddr(0x00, enableBits);  // PON, AEN and AIEN
+    
+    brakeArmed = 0;
+    wallNear = 0;
+    PIR0bits.INT1IF = 0;
+    PIE0bits.INT1IE = 1;
+}
+
+/************************************
+ * Description:
+ * Stops the approach interrupt, so that full colour classification runs on every loop
+ ************************************/
+void color_disarm_approach(void) {
+    PIE0bits.INT1IE = 0;
+    brakeArmed = 0;
+    enableBits = 0x03;
+    color_writetoaddr(0x00, enableBits);  // PON and AEN only
+    color_clear_int();
+    wallNear = 1;
+}
+
+/************************************
+ * Description:
+ * Converts a level on the 8-bit V scale into raw clear counts at the current gain and
+ * integration time, by inverting color_normalise() and color_scale()
+ * Inputs:
+ * The level (which may be above 255) and the gain value used to scale to 8-bits
+ * Outputs:
+ * The raw count
+ ************************************/
+static unsigned long color_raw_from_value(unsigned int V, unsigned char gain) {
+    unsigned long scale = (unsigned long)AGAIN_NORM[againIndex] * (256 - ATIME_LONG) / atimeCycles;
+    return (((unsigned long)V << (gain + 2)) << 8) / scale;
+}
+
+/************************************
+ * Description:
+ * Writes the clear channel high threshold (AIHT), saturating at 16 bits
+ ************************************/
+static void color_write_aiht(unsigned long threshold) {
+    if(threshold > 65535){
+        threshold = 65535;
+    }
+    color_writetoaddr(0x06, (char)(threshold & 0xFF));
+    color_writetoaddr(0x07, (char)(threshold >> 8));
+}
+
+/************************************
+ * Description:
+ * Moves the emergency brake threshold. In differential mode the sensor compares the
+ * LED-on reading, so the latest ambient level is added to the threshold
+ * Inputs:
+ * The clear level (in V units) at which to brake, and the gain value used to scale to 8-bits
+ ************************************/
+void color_update_brake(unsigned int level, unsigned char gain) {
+    brakeLevel = level;
+    brakeGain = gain;
+    color_write_aiht(color_raw_from_value(level, gain) + (sampleMode == SAMPLE_DIFFERENTIAL ? lastAmbientC : 0));
+}
+
+/************************************
+ * Description:
+ * Re-uses the clear channel interrupt as a collision warning while the buggy closes in
+ * on a card. As soon as a single integration passes the threshold, the INT1 interrupt
+ * brakes both motors without waiting for the main loop
+ * Inputs:
+ * The clear level (in V units) at which to brake, and the gain value used to scale to 8-bits
+ ************************************/
+void color_arm_brake(unsigned int level, unsigned char gain) {
+    PIE0bits.INT1IE = 0;
+    color_update_brake(level, gain);
+    color_writetoaddr(0x0C, 0x01);  // Persistence: one integration out of range (0 would interrupt on every integration)
+    color_clear_int();
+    enableBits = 0x13;
+    color_writetoaddr(0x00, enableBits);  // PON, AEN and AIEN
+    brakeArmed = 1;
+    PIR0bits.INT1IF = 0;
+    PIE0bits.INT1IE = 1;
+}
+
+/************************************
+ * Description:
+ * Stops the emergency brake interrupt
+ ************************************/
+void color_disarm_brake(void) {
+    PIE0bits.INT1IE = 0;
+    brakeArmed = 0;
+    enableBits = 0x03;
+    color_writetoaddr(0x00, enableBits);  // PON and AEN only
+    color_clear_int();
+}
+
+/************************************
+ * Description:
+ * Clears the clear channel interrupt of the colour click, releasing the INT line
+ ************************************/
+void color_clear_int(void) {
+    I2C_2_Master_Start();               // Start condition
+    I2C_2_Master_Write(0x52 | 0x00);    // 7 bit device address + Write mode
+    I2C_2_Master_Write(0xE6);           // Special function: clear RGBC interrupt
+    I2C_2_Master_Stop();                // Stop condition
+}
+
+/************************************
+ * Description:
+ * Reads the colour sensor using the selected sample mode. If an integration does not
+ * complete in time the reading is taken again once, from a restarted integration
+ * Inputs:
+ * The gain value used to scale to 8-bits
+ * Outputs:
+ * The RGBC information as 8-bit values, stale if color_timed_out() returns 1
+ ************************************/
+struct RGB color_sample(unsigned char gain) {
+    struct RGB col;
+    for(unsigned char attempt = 0; attempt < 2; attempt++){
+        if(attempt){
+            color_restart();  // Nothing pipelined is trusted after a timeout
+        }
+        timedOut = 0;
+        col = sampleMode == SAMPLE_DIFFERENTIAL ? color_read_differential(gain) : color_read_all(gain);
+        if(!timedOut){
+            break;
+        }
+    }
+    return col;
+}
+
+/************************************
+ * Description:
+ * Tells whether the latest color_sample() had an integration that did not complete in
+ * time, even after taking the reading again
+ * Outputs:
+ * 1 if it timed out, otherwise 0
+ ************************************/
+unsigned char color_timed_out(void) {
+    return timedOut;
+}
+
 /************************************
  * Description:
  * Return the index of the largest value in runningTallyCol
@@ -216,7 +844,8 @@ struct HSV RgbToHsv(struct RGB rgb) {
     }
     
     // Saturation is the difference between the min and max as a "percentage" of the value of the colour
-    hsv.S = (unsigned char)(255 * (long)(rgbMax - rgbMin) / (255 - abs(2*hsv.V - 255)));
+    int span = 255 - abs(2*hsv.V - 255);  // Zero when the clear channel is saturated
+    hsv.S = (unsigned char)(255 * (long)(rgbMax - rgbMin) / (span > 0 ? span : 1));
     if (hsv.S == 0) {
         // If the saturation is 0 (grey scale), then the hue is irrelevant and therefore set to 0 also
         hsv.H = 0;
@@ -236,48 +865,59 @@ struct HSV RgbToHsv(struct RGB rgb) {
 
 /************************************
  * Description:
- * Returns the square of the Euclidean distance between point (x1, y1, z1) and
- * (x2, y2, z2) as a 16 bit unsigned integer
+ * Sets the variances of a colour class, clamping them to the variance floors, and
+ * derives the distance weights used by HSV_Distance
  * Inputs:
- * Two sets of x,y,z coordinates
- * Outputs:
- * The distance between the given points
+ * The spread to set, the hue, saturation and value variances and the acceptance radius
  ************************************/
-unsigned int euclidean_distance(unsigned char x1, unsigned char y1, unsigned char z1, unsigned char x2, unsigned char y2, unsigned char z2) {
-    // Calculating the sum of squares of the differences between the points
-    unsigned int x_sq = (unsigned int)((int)(x2 - x1) * (int)(x2 - x1));
-    unsigned int y_sq = (unsigned int)((int)(y2 - y1) * (int)(y2 - y1));
-    unsigned int z_sq = (unsigned int)((int)(z2 - z1) * (int)(z2 - z1));
+void setSpread(struct HSVSpread* spread, unsigned int varH, unsigned int varS, unsigned int varV, unsigned int threshold) {
+    spread->varH = varH > VAR_MIN_H ? varH : VAR_MIN_H;
+    spread->varS = varS > VAR_MIN_S ? varS : VAR_MIN_S;
+    spread->varV = varV > VAR_MIN_V ? varV : VAR_MIN_V;
     
-    // Scaling the values so that their sum fits into 16 bits
-    x_sq = x_sq >> 2;
-    y_sq = y_sq >> 2;
-    z_sq = z_sq >> 2;
-    
-    return x_sq + y_sq + z_sq;    
+    // Weights are 4/variance in Q12 fixed point, so the floors give the same distance
+    // as the original (d^2 >> 2) Euclidean distance on H, S >> 1 and V >> 4
+    spread->wH = (unsigned int)(16384UL / spread->varH);
+    spread->wS = (unsigned int)(16384UL / spread->varS);
+    spread->wV = (unsigned int)(16384UL / spread->varV);
+    spread->threshold = threshold;
 }
 
 /************************************
  * Description:
- * Returns the distance between two HSV values in the HSV colour space taking the wrapping from 360->0 into account
+ * Sets every colour class to the default (uncalibrated) spread
  * Inputs:
- * Two HSV colours
+ * The array of 8 colour spreads to initialise, and the acceptance radius of each colour
+ * (from a surface profile, see surface.h)
+ ************************************/
+void initColourSpread(struct HSVSpread* colourSpread, const unsigned int* thresholds) {
+    for (unsigned char i = 0; i < 8; i++){
+        setSpread(&colourSpread[i], VAR_MIN_H, VAR_MIN_S, VAR_MIN_V, thresholds[i]);
+    }
+}
+
+/************************************
+ * Description:
+ * Returns the variance weighted distance between a colour centre and a measured colour,
+ * taking the wrapping of hue from 255->0 into account. This is four times the squared
+ * Mahalanobis distance for a diagonal covariance
+ * Inputs:
+ * The colour centre, the spread of that colour class and the measured colour
  * Outputs:
- * The smallest distance between these HSV values in HSV colour space
- ************************************/
-unsigned int HSV_Distance(struct HSV hsv1, struct HSV hsv2) {
-    hsv1.S >>= 1; // Make saturation play less of a role in the distance calculation
-    hsv2.S >>= 1;
-    hsv1.V >>= 4; // Make value play less of a role in the distance calculation
-    hsv2.V >>= 4;
-    unsigned int dist1 = euclidean_distance(hsv1.H, hsv1.S, hsv1.V, hsv2.H, hsv2.S, hsv2.V);
-    unsigned int dist2;
-    if(hsv1.H < hsv2.H){
-        dist2 = euclidean_distance(0, hsv1.S, hsv1.V, hsv1.H + (255 - hsv2.H), hsv2.S, hsv2.V);
-    } else {
-        dist2 = euclidean_distance(0, hsv1.S, hsv1.V, hsv2.H + (255 - hsv1.H), hsv2.S, hsv2.V);
+ * The weighted distance, saturated to 16 bits
+ ************************************/
+unsigned int HSV_Distance(struct HSV centre, const struct HSVSpread* spread, struct HSV col) {
+    unsigned char dH = (unsigned char)(centre.H - col.H);  // Hue difference modulo 256
+    if (dH > 128){
+        dH = (unsigned char)(256 - dH);  // Take the shorter way around the hue circle
     }
-    return dist1 < dist2 ? dist1 : dist2;  // Return the lowest distance
+    unsigned char dS = centre.S > col.S ? centre.S - col.S : col.S - centre.S;
+    unsigned char dV = centre.V > col.V ? centre.V - col.V : col.V - centre.V;
+    
+    unsigned long dist = ((unsigned long)dH * dH * spread->wH
+                        + (unsigned long)dS * dS * spread->wS
+                        + (unsigned long)dV * dV * spread->wV) >> 12;
+    return dist > 65535 ? 65535 : (unsigned int)dist;
 }
 
 /************************************
@@ -285,14 +925,15 @@ unsigned int HSV_Distance(struct HSV hsv1, struct HSV hsv2) {
  * The function will find the best fitting estimate for the given colour sensor
  * measurement using the HSV_Distance function
  * Inputs:
- * Settings for the colour centres and min saturation and min value to segment
- * black and white colours
+ * Settings for the colour centres and spreads, and min saturation and min value to
+ * segment black and white colours
  * Outputs:
  * The colour/proximity represented as a numeric value
  ************************************/
-unsigned char segment(struct HSV colourCentres[], unsigned char minS, unsigned char minV,  struct HSV col) {
+unsigned char segment(struct HSV colourCentres[], struct HSVSpread colourSpread[], unsigned char minS, unsigned char minV,  struct HSV col) {
     unsigned char colour_out;
     unsigned int minDist = 65535;
+    unsigned char best = 0;
     
     unsigned int proximity = ((col.S * col.S) >> 2) + ((col.V * col.V) >> 2);
     unsigned int proximity1 = ((minS * minS) >> 2) + ((minV * minV) >> 2) + 100;
@@ -306,23 +947,24 @@ unsigned char segment(struct HSV colourCentres[], unsigned char minS, unsigned c
     }
     
     // As blue is very dark, it is the only colour that is not clipped by the global min value limit
-    if(HSV_Distance(colourCentres[7], col) < 100){ // Within acceptable range of colour centre
+    if(HSV_Distance(colourCentres[7], &colourSpread[7], col) < colourSpread[7].threshold){ // Within acceptable range of colour centre
         colour_out = 10;
     }
 
     if(col.V > minV){
         if(col.S > minS){
             for (unsigned char i = 0; i < 8; i++){
-                unsigned int dist = HSV_Distance(colourCentres[i], col);
+                unsigned int dist = HSV_Distance(colourCentres[i], &colourSpread[i], col);
                 if(dist < minDist){
                     minDist = dist;
-                    if(minDist < 300){ // Within acceptable range of colour centre
-                        colour_out = i + 3;
-                    }
+                    best = i;
                 }
             }
+            if(minDist < colourSpread[best].threshold){ // Within acceptable range of the nearest colour centre
+                colour_out = best + 3;
+            }
         } else {
-            if(col.V > 105){
+            if(col.V > WHITE_MIN_V){
                 colour_out = 3; // WHITE
             }
         }
@@ -331,6 +973,135 @@ unsigned char segment(struct HSV colourCentres[], unsigned char minS, unsigned c
     
 }
 
+/************************************
+ * Description:
+ * Returns the least distance a centre with the given spread can have from any hue in a
+ * hue bin, by hue alone, once the centre has drifted as far as DRIFT_LIMIT_H towards it
+ ************************************/
+static unsigned int hueBinBound(struct HSV centre, const struct HSVSpread* spread, unsigned char bin) {
+    unsigned char lo = (unsigned char)(bin << HUE_BIN_SHIFT);
+    unsigned char offset = (unsigned char)(centre.H - lo);  // Centre's hue measured from the bin's start
+    unsigned char dH;
+    if (offset < (1 << HUE_BIN_SHIFT)) {
+        return 0;  // The centre is inside the bin
+    }
+    dH = (unsigned char)(256 - offset) < (unsigned char)(offset - ((1 << HUE_BIN_SHIFT) - 1))
+       ? (unsigned char)(256 - offset) : (unsigned char)(offset - ((1 << HUE_BIN_SHIFT) - 1));
+    dH = dH > DRIFT_LIMIT_H ? dH - DRIFT_LIMIT_H : 0;
+    return (unsigned int)(((unsigned long)dH * dH * spread->wH) >> 12);
+}
+
+/************************************
+ * Description:
+ * Builds the hue bin table segmentFast() uses. A centre is a candidate in a bin if any
+ * hue in the bin could be accepted as it, so the centres left out can never be accepted
+ * there. Call once calibration has finished, with the centres drift tracking is
+ * bounded around
+ * Inputs:
+ * The calibrated colour centres and their spreads
+ ************************************/
+void initColourTable(struct HSV* colourCentres, struct HSVSpread* colourSpread) {
+    for (unsigned char bin = 0; bin < HUE_BINS; bin++) {
+        binCandidates[bin] = 0;
+        binBound[bin] = 65535;
+        for (unsigned char i = 0; i < 8; i++) {
+            unsigned int bound = hueBinBound(colourCentres[i], &colourSpread[i], bin);
+            if (bound < colourSpread[i].threshold) {
+                binCandidates[bin] |= (unsigned char)(1 << i);
+            } else if (bound < binBound[bin]) {
+                binBound[bin] = bound;
+            }
+        }
+    }
+}
+
+/************************************
+ * Description:
+ * Gives the same result as segment() while working out fewer distances. The saturation
+ * and value pick between the proximity levels, white and the colour search as before;
+ * the hue's bin then names the two or three centres that could be accepted, and only
+ * those are measured. Should a centre left out be as near as the nearest candidate, all
+ * eight are measured as segment() does, so that the result is unchanged
+ * Inputs:
+ * Settings for the colour centres and spreads, and min saturation and min value to
+ * segment black and white colours
+ * Outputs:
+ * The colour/proximity represented as a numeric value
+ ************************************/
+unsigned char segmentFast(struct HSV colourCentres[], struct HSVSpread colourSpread[], unsigned char minS, unsigned char minV, struct HSV col) {
+    unsigned char colour_out;
+    unsigned char bin = col.H >> HUE_BIN_SHIFT;
+    unsigned char candidates = binCandidates[bin];
+    unsigned int blueDist = 65535;
+    
+    unsigned int proximity = ((col.S * col.S) >> 2) + ((col.V * col.V) >> 2);
+    unsigned int proximity1 = ((minS * minS) >> 2) + ((minV * minV) >> 2) + 100;
+    unsigned int proximity2 = proximity1 + 400;
+    if (proximity < proximity1) {
+        colour_out = 0; // BLACK (no proximity)
+    } else if (proximity < proximity2) {
+        colour_out = 1; // Low proximity
+    } else {
+        colour_out = 2; // High proximity
+    }
+    fastDistances = 0;
+    
+    if (col.V > minV && col.S > minS) {
+        unsigned int minDist = 65535;
+        unsigned char best = 0;
+        for (unsigned char i = 0; i < 8; i++) {
+            if (candidates & (1 << i)) {
+                unsigned int dist = HSV_Distance(colourCentres[i], &colourSpread[i], col);
+                fastDistances++;
+                if (i == 7) {
+                    blueDist = dist;
+                }
+                if (dist < minDist) {
+                    minDist = dist;
+                    best = i;
+                }
+            }
+        }
+        if (minDist >= binBound[bin]) {
+            // A centre left out may be the nearest, and would then turn the reading down
+            minDist = 65535;
+            for (unsigned char i = 0; i < 8; i++) {
+                unsigned int dist = HSV_Distance(colourCentres[i], &colourSpread[i], col);
+                if (i == 7) {
+                    blueDist = dist;
+                }
+                if (dist < minDist) {
+                    minDist = dist;
+                    best = i;
+                }
+            }
+            fastDistances += 8;
+        }
+        if (minDist < colourSpread[best].threshold) {
+            return best + 3;
+        }
+    } else if (col.V > minV && col.V > WHITE_MIN_V) {
+        return 3; // WHITE
+    } else if (candidates & 0x80) {
+        blueDist = HSV_Distance(colourCentres[7], &colourSpread[7], col);
+        fastDistances++;
+    }
+    
+    // As blue is very dark, it is the only colour that is not clipped by the global min value limit
+    if (blueDist < colourSpread[7].threshold) {
+        colour_out = 10;
+    }
+    return colour_out;
+}
+
+/************************************
+ * Description:
+ * Returns how many distances the latest segmentFast() call worked out, for host/replay
+ ************************************/
+unsigned char segmentFastDistances(void) {
+    return fastDistances;
+}
+
 /************************************
  * Description:
  * This function will calibrate the gain, LED colour and white k-mean centre colours
@@ -338,20 +1109,19 @@ unsigned char segment(struct HSV colourCentres[], unsigned char minS, unsigned c
  * A pointer to the colourCenter variable to calibrate, and the pointer to the gain to calibrate
  ************************************/
 void calibrateGainAndLED(struct HSV* colourCentres, unsigned char* gain){
-    char buf[16];
+    char buf[17];  // One LCD line and the terminator
 
-    struct RGB colRGB;
-    struct HSV colHSV;
+    struct RGB colRGB = { 0, 0, 0, 0 };  // Nothing is saturated before the first sample
     
     // GAIN CALIBRATION AND
     // LED COLOUR CALIBRATION
-    while(PORTFbits.RF2){
+    while(HAL_PIN_RF2){
         unsigned char rgbMax = colRGB.R > colRGB.G ? (colRGB.R > colRGB.B ? colRGB.R : colRGB.B) : (colRGB.G > colRGB.B ? colRGB.G : colRGB.B);
         unsigned char max = rgbMax > colRGB.C ? rgbMax : colRGB.C;
         if(max >= 255){
             (*gain)+=1;
         }
-        colRGB = color_read_all(*gain);
+        colRGB = color_sample(*gain);
         if((int)(colRGB.B - colRGB.R) > 3 && RED_BRIGHTNESS < 255){
             RED_BRIGHTNESS++;
         } else if ((int)(colRGB.B - colRGB.R) < -3 && RED_BRIGHTNESS > 0){
@@ -363,12 +1133,12 @@ void calibrateGainAndLED(struct HSV* colourCentres, unsigned char* gain){
             GREEN_BRIGHTNESS--;
         }
         *(colourCentres) = RgbToHsv(colRGB);
-        sprintf(buf, "WHITE   Gain: %01d ", *gain);
+        sprintf(buf, "WHITE  Gain: %03d", *gain);  // 16 characters whatever the gain
         LCD_sendstring(buf, 0, 0);
         sprintf(buf, "RGB: %03d %03d %03d", RED_BRIGHTNESS, GREEN_BRIGHTNESS, BLUE_BRIGHTNESS);
         LCD_sendstring(buf, 1, 0);
     }
-    while(!PORTFbits.RF2){
+    while(!HAL_PIN_RF2){
         __delay_ms(100);
     }
 }
@@ -381,94 +1151,365 @@ void calibrateGainAndLED(struct HSV* colourCentres, unsigned char* gain){
  * Gain and variables to calibrate
  ************************************/
 void calibrateClear(unsigned char gain, unsigned char* minS, unsigned char* minV){
-    char buf[16];
+    char buf[17];  // One LCD line and the terminator
     struct RGB colRGB;
     struct HSV colHSV;
     
-    while(PORTFbits.RF2){
-        colRGB = color_read_all(gain);
+    trace_set_label(0);  // Nothing is held in front of the sensor
+    while(HAL_PIN_RF2){
+        colRGB = color_sample(gain);
+        traceLastSample(0);
         colHSV = RgbToHsv(colRGB);
         // Add an offset to ensure no colour is measured sporadically
-        *minV = colHSV.V < 240 ? colHSV.V + 10 : 250;
-        *minS = colHSV.S < 240 ? colHSV.S + 10 : 250;
+        *minV = colHSV.V < 250 - CLEAR_MARGIN ? colHSV.V + CLEAR_MARGIN : 250;
+        *minS = colHSV.S < 250 - CLEAR_MARGIN ? colHSV.S + CLEAR_MARGIN : 250;
         
         // Show these values on the LCD
         LCD_sendstring("CLEAR Calibrat.", 0, 0);
-        sprintf(buf, "Min S: %02d V: %02d ", *minS, *minV);
+        sprintf(buf, "Min S:%03d V:%03d ", *minS, *minV);
         LCD_sendstring(buf, 1, 0);
     }
-    while(!PORTFbits.RF2){
+    trace_set_label(TRACE_LABEL_UNKNOWN);
+    while(!HAL_PIN_RF2){
         __delay_ms(100);
     } 
 }
 
 /************************************
  * Description:
- * Calibrates the colour centres by cycling through all colours
+ * Calibrates the colour centres by cycling through all colours. For each card,
+ * CALIB_SAMPLES readings are taken and the mean and variance of each channel are
+ * stored. The acceptance radius is set to twice the furthest calibration sample
  * Inputs:
- * The colour centre variable to calibrate and the gain
+ * The colour centre and spread variables to calibrate and the gain
  ************************************/
-void calibrateKMean(struct HSV* colourCentres, unsigned char gain){
+void calibrateKMean(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char gain){
     struct HSV colHSV;
-    char buf[16];
+    struct HSV samples[CALIB_SAMPLES];
+    char buf[17];  // One LCD line and the terminator
 
-    for(unsigned char currentColour = 1; currentColour < 8; currentColour++){
-        while(PORTFbits.RF2){
-            colHSV = RgbToHsv(color_read_all(gain));
-            *(colourCentres + currentColour) = colHSV;
+    for(unsigned char currentColour = 0; currentColour < 8; currentColour++){
+        while(HAL_PIN_RF2){
+            colHSV = RgbToHsv(color_sample(gain));
             LCD_sendstring("K-Mean ", 0, 0);
             LCD_sendstring(COLOUR[currentColour + 3], 0, 7);
             sprintf(buf, "HSV: %03d %03d %03d", colHSV.H, colHSV.S, colHSV.V);
             LCD_sendstring(buf, 1, 0);
         }
-        while(!PORTFbits.RF2){
+        while(!HAL_PIN_RF2){
             __delay_ms(100);
         }
-        while(PORTFbits.RF2){
+        
+        // Collect the samples, one per sensor integration. A differential reading waits for
+        // its own integrations; a normal one is read as soon as the next integration completes
+        trace_set_label(currentColour + 3);
+        if(sampleMode == SAMPLE_NORMAL){
+            color_restart();
+        }
+        for(unsigned char n = 0; n < CALIB_SAMPLES;){
+            unsigned char failed = 0;
+            if(sampleMode == SAMPLE_NORMAL){
+                failed = color_wait_valid();
+            }
+            samples[n] = RgbToHsv(color_sample(gain));
+            if(sampleMode == SAMPLE_NORMAL){
+                color_restart();  // The next sample integrates while this one is shown
+            }
+            if(failed || color_timed_out()){
+                LCD_sendstring("Sensor timeout  ", 1, 0);  // Take this sample again
+                continue;
+            }
+            traceLastSample(0);
+            n++;
+            sprintf(buf, "Sampling %02d/%02d ", n, CALIB_SAMPLES);
+            LCD_sendstring(buf, 1, 0);
+        }
+        trace_set_label(TRACE_LABEL_UNKNOWN);
+        
+        // Hue is averaged as an offset from the first sample so that it wraps correctly
+        int sumH = 0;
+        unsigned int sumS = 0, sumV = 0;
+        for(unsigned char n = 0; n < CALIB_SAMPLES; n++){
+            sumH += (signed char)(samples[n].H - samples[0].H);
+            sumS += samples[n].S;
+            sumV += samples[n].V;
+        }
+        colHSV.H = (unsigned char)(samples[0].H + sumH / CALIB_SAMPLES);
+        colHSV.S = (unsigned char)(sumS / CALIB_SAMPLES);
+        colHSV.V = (unsigned char)(sumV / CALIB_SAMPLES);
+        
+        // Variance of each channel about the mean
+        unsigned long varH = 0, varS = 0, varV = 0;
+        for(unsigned char n = 0; n < CALIB_SAMPLES; n++){
+            int dH = (signed char)(samples[n].H - colHSV.H);
+            int dS = (int)samples[n].S - colHSV.S;
+            int dV = (int)samples[n].V - colHSV.V;
+            varH += (unsigned long)((long)dH * dH);
+            varS += (unsigned long)((long)dS * dS);
+            varV += (unsigned long)((long)dV * dV);
+        }
+        setSpread(&colourSpread[currentColour], (unsigned int)(varH / CALIB_SAMPLES), (unsigned int)(varS / CALIB_SAMPLES),
+                  (unsigned int)(varV / CALIB_SAMPLES), THRESHOLD_MAX);
+        
+        // Accept up to twice the distance of the furthest calibration sample
+        unsigned int maxDist = 0;
+        for(unsigned char n = 0; n < CALIB_SAMPLES; n++){
+            unsigned int dist = HSV_Distance(colHSV, &colourSpread[currentColour], samples[n]);
+            maxDist = dist > maxDist ? dist : maxDist;
+        }
+        maxDist = maxDist < THRESHOLD_MAX / 2 ? maxDist * 2 : THRESHOLD_MAX;
+        colourSpread[currentColour].threshold = maxDist > THRESHOLD_MIN ? maxDist : THRESHOLD_MIN;
+        *(colourCentres + currentColour) = colHSV;
+        
+        // The easily confused colours also get an averaged spectral signature
+        signed char slot = SPECTRAL_SLOT[currentColour];
+        if(spectralConfirm && slot >= 0){
+            struct Spectral sig;
+            unsigned int sum[12] = {0,0,0,0,0,0,0,0,0,0,0,0};
+            LCD_sendstring("Spectral...     ", 1, 0);
+            for(unsigned char n = 0; n < SPECTRAL_SAMPLES;){
+                if(color_read_spectral(gain, &sig)){
+                    LCD_sendstring("Sensor timeout  ", 1, 0);  // Take this signature again
+                    continue;
+                }
+                for(unsigned char i = 0; i < 12; i++){
+                    sum[i] += sig.v[i];
+                }
+                n++;
+            }
+            for(unsigned char i = 0; i < 12; i++){
+                spectralCentres[slot].v[i] = (unsigned char)(sum[i] / SPECTRAL_SAMPLES);
+            }
+            spectralValid |= (unsigned char)(1 << slot);
+        }
+        
+        while(HAL_PIN_RF2){
             LCD_sendstring("HOLD   ", 0, 0);
+            sprintf(buf, "%03d %03d %03d %03u", colHSV.H, colHSV.S, colHSV.V, colourSpread[currentColour].threshold > 9999 ? 9999 : colourSpread[currentColour].threshold);
+            LCD_sendstring(buf, 1, 0);
             __delay_ms(100);
         }
-        while(!PORTFbits.RF2){
+        while(!HAL_PIN_RF2){
             __delay_ms(100);
         }
     }
 }
 
+// Reading and writing the saved calibration. Every byte goes into a CRC-16, the same one
+// the telemetry frames use
+static unsigned int calibAddress;
+static unsigned int calibCrc;
+
+static void calibPut(unsigned char byte) {
+    eeprom_write(calibAddress++, byte);
+    calibCrc = telemetry_crc(calibCrc, byte);
+}
+
+static void calibPutWord(unsigned int word) {
+    calibPut((unsigned char)(word & 0xFF));
+    calibPut((unsigned char)(word >> 8));
+}
+
+static unsigned char calibGet(void) {
+    unsigned char byte = eeprom_read(calibAddress++);
+    calibCrc = telemetry_crc(calibCrc, byte);
+    return byte;
+}
+
+static unsigned int calibGetWord(void) {
+    unsigned int low = calibGet();
+    return low | ((unsigned int)calibGet() << 8);
+}
+
+/************************************
+ * Description:
+ * Saves the calibration to data EEPROM for loadCalibration() at the next power on: the
+ * gain, minS and minV, the LED brightnesses, the colour centres and spreads and the
+ * spectral signatures, followed by a CRC. Only bytes that have changed are written, at
+ * about 4 ms each
+ * Inputs:
+ * All calibration values
+ ************************************/
+void saveCalibration(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char gain, unsigned char minS, unsigned char minV){
+    LCD_sendstring("Saving calib.   ", 1, 0);
+    calibAddress = CALIB_ADDRESS;
+    calibCrc = 0xFFFF;
+    calibPut(CALIB_MAGIC);
+    calibPut(CALIB_VERSION);
+    calibPut(gain);
+    calibPut(minS);
+    calibPut(minV);
+    calibPut(RED_BRIGHTNESS);
+    calibPut(GREEN_BRIGHTNESS);
+    calibPut(BLUE_BRIGHTNESS);
+    for(unsigned char i = 0; i < 8; i++){
+        calibPut(colourCentres[i].H);
+        calibPut(colourCentres[i].S);
+        calibPut(colourCentres[i].V);
+    }
+    for(unsigned char i = 0; i < 8; i++){  // The weights are derived from the variances again
+        calibPutWord(colourSpread[i].varH);
+        calibPutWord(colourSpread[i].varS);
+        calibPutWord(colourSpread[i].varV);
+        calibPutWord(colourSpread[i].threshold);
+    }
+    calibPut(spectralValid);
+    for(unsigned char slot = 0; slot < 4; slot++){
+        for(unsigned char i = 0; i < 12; i++){
+            calibPut(spectralCentres[slot].v[i]);
+        }
+    }
+    calibPutWord(calibCrc);
+}
+
+/************************************
+ * Description:
+ * Loads the calibration saved by saveCalibration(), if there is one and its CRC is good
+ * Inputs:
+ * Where to put the calibration values
+ * Outputs:
+ * 1 if the calibration was loaded, 0 if nothing was changed
+ ************************************/
+unsigned char loadCalibration(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char* gain, unsigned char* minS, unsigned char* minV){
+    calibAddress = CALIB_ADDRESS;
+    calibCrc = 0xFFFF;
+    for(unsigned int i = 0; i < CALIB_BYTES; i++){
+        calibGet();
+    }
+    unsigned int crc = calibCrc;
+    if(calibGetWord() != crc){
+        return 0;  // Erased, or a save that did not finish
+    }
+    calibAddress = CALIB_ADDRESS;
+    if(calibGet() != CALIB_MAGIC || calibGet() != CALIB_VERSION){
+        return 0;
+    }
+    *gain = calibGet();
+    *minS = calibGet();
+    *minV = calibGet();
+    RED_BRIGHTNESS = calibGet();
+    GREEN_BRIGHTNESS = calibGet();
+    BLUE_BRIGHTNESS = calibGet();
+    for(unsigned char i = 0; i < 8; i++){
+        colourCentres[i].H = calibGet();
+        colourCentres[i].S = calibGet();
+        colourCentres[i].V = calibGet();
+    }
+    for(unsigned char i = 0; i < 8; i++){
+        unsigned int varH = calibGetWord();
+        unsigned int varS = calibGetWord();
+        unsigned int varV = calibGetWord();
+        setSpread(&colourSpread[i], varH, varS, varV, calibGetWord());
+    }
+    spectralValid = calibGet();
+    for(unsigned char slot = 0; slot < 4; slot++){
+        for(unsigned char i = 0; i < 12; i++){
+            spectralCentres[slot].v[i] = calibGet();
+        }
+    }
+    return 1;
+}
+
 /************************************
  * Description:
  * Resets all heaps in the tally array to 0
  ************************************/
 void resetColourAveraging(void){
-    runningTallyCol[0] = 8;
+    runningTallyCol[0] = VOTE_CAP;
     for (int i = 1; i < 11; i++){
         runningTallyCol[i] = 0;
     }
+    trace_reset();
 }
 
 /************************************
  * Description:
- * Used to sense and average the result post segmentation
+ * Turns colour centre drift tracking on or off. The centres stay where they are
  * Inputs:
- * All calibration values
- * Outputs:
- * The averaged colour/proximity represented as a numeric value
+ * 1 to follow slow lighting changes in updateColourDrift(), 0 to keep the centres fixed
  ************************************/
-unsigned char senseColour(struct HSV* colourCentres, unsigned char gain, unsigned char minS, unsigned char minV){
-    char buf[16];
+void setColourDrift(unsigned char enable){
+    driftTracking = enable;
+}
+
+/************************************
+ * Description:
+ * Records the current colour centres as the calibrated values that drift tracking
+ * is bounded around. Call once calibration has finished
+ * Inputs:
+ * The calibrated colour centres
+ ************************************/
+void initColourDrift(struct HSV* colourCentres){
+    for (unsigned char i = 0; i < 8; i++){
+        calibratedCentres[i] = colourCentres[i];
+    }
+    resetColourDrift(colourCentres);
+}
+
+/************************************
+ * Description:
+ * Discards any tracked drift and restores the calibrated colour centres
+ * Inputs:
+ * The colour centres to restore
+ ************************************/
+void resetColourDrift(struct HSV* colourCentres){
+    for (unsigned char i = 0; i < 8; i++){
+        colourCentres[i] = calibratedCentres[i];
+        driftH[i] = 0;
+        driftS[i] = 0;
+        driftV[i] = 0;
+    }
+}
+
+/************************************
+ * Description:
+ * Limits a drift offset (in 1/16ths) to +/- limit units
+ ************************************/
+static int clampDrift(int drift, int limit){
+    limit <<= 4;
+    if (drift > limit){
+        return limit;
+    }
+    if (drift < -limit){
+        return -limit;
+    }
+    return drift;
+}
+
+/************************************
+ * Description:
+ * Nudges a colour centre towards a confidently classified sample using an exponential
+ * moving average with a weight of 1/16. As the drift is held in 1/16ths, adding the
+ * error directly gives that weight without losing small corrections to rounding.
+ * The drift is bounded to DRIFT_LIMIT_H/S/V from the calibrated centre
+ * Inputs:
+ * The colour centres, the index of the matched centre and the sample that matched it
+ ************************************/
+static void trackColourDrift(struct HSV* colourCentres, unsigned char index, struct HSV col){
+    struct HSV* centre = &colourCentres[index];
     
-    struct RGB colRGB;
-    struct HSV colHSV;
+    driftH[index] = clampDrift(driftH[index] + (signed char)(col.H - centre->H), DRIFT_LIMIT_H);
+    driftS[index] = clampDrift(driftS[index] + ((int)col.S - centre->S), DRIFT_LIMIT_S);
+    driftV[index] = clampDrift(driftV[index] + ((int)col.V - centre->V), DRIFT_LIMIT_V);
     
-    // Read the colour sensor value and convert to HSV colour space
-    colRGB = color_read_all(gain);
-    colHSV = RgbToHsv(colRGB);
-
-    unsigned char colour_index = segment(colourCentres, minS, minV,  colHSV);
-    // sprintf(buf,"%03d %03d %03d %03d", colRGB.R, colRGB.G, colRGB.B, colRGB.C);
-    sprintf(buf,"HSV %03d %03d %03d ", colHSV.H, colHSV.S, colHSV.V);
+    int S = (int)calibratedCentres[index].S + driftS[index] / 16;
+    int V = (int)calibratedCentres[index].V + driftV[index] / 16;
+    centre->H = (unsigned char)(calibratedCentres[index].H + driftH[index] / 16);  // Hue wraps naturally
+    centre->S = (unsigned char)(S < 0 ? 0 : (S > 255 ? 255 : S));
+    centre->V = (unsigned char)(V < 0 ? 0 : (V > 255 ? 255 : V));
+}
 
+/************************************
+ * Description:
+ * Adds a classified sample to the running tally and returns the most voted colour
+ * Inputs:
+ * The colour index returned by segment()
+ * Outputs:
+ * The colour with the most votes
+ ************************************/
+unsigned char voteColour(unsigned char colour_index){
     // Averaging
-    if(runningTallyCol[colour_index] < 8){ // This value /2 is the number of measurements to average over
+    if(runningTallyCol[colour_index] < VOTE_CAP){ // This value /2 is the number of measurements to average over
         runningTallyCol[colour_index] += 2;
     }
     
@@ -480,11 +1521,91 @@ unsigned char senseColour(struct HSV* colourCentres, unsigned char gain, unsigne
     }
 
     // Get the most voted colour
-    unsigned char colour_out = getIndexOfMax();
+    return (unsigned char)getIndexOfMax();
+}
+
+/************************************
+ * Description:
+ * Follows slow lighting changes using samples that agree with the vote and sit well
+ * inside their class
+ * Inputs:
+ * The colour centres and spreads, the sample's colour index from segment(), the result
+ * of the vote and the sample itself
+ ************************************/
+void updateColourDrift(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char colour_index, unsigned char colour_out, struct HSV col){
+    if(driftTracking && colour_index >= 3 && colour_index == colour_out){
+        unsigned char i = colour_index - 3;
+        if(HSV_Distance(colourCentres[i], &colourSpread[i], col) < colourSpread[i].threshold / DRIFT_CONFIDENCE){
+            trackColourDrift(colourCentres, i, col);
+        }
+    }
+}
+
+/************************************
+ * Description:
+ * Returns the latest reading taken by senseColour()
+ ************************************/
+struct HSV getLastColour(void){
+    return latest.hsv;
+}
+
+/************************************
+ * Description:
+ * Returns the latest complete reading taken by senseColour(), without waiting for the sensor
+ ************************************/
+struct ColourSample color_latest(void){
+    return latest;
+}
+
+/************************************
+ * Description:
+ * Used to sense and average the result post segmentation
+ * Inputs:
+ * All calibration values
+ * Outputs:
+ * The averaged colour/proximity represented as a numeric value
+ ************************************/
+unsigned char senseColour(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char gain, unsigned char minS, unsigned char minV){
+    char buf[17];  // One LCD line and the terminator
+    
+    struct RGB colRGB;
+    struct HSV colHSV;
+    
+    // Read the colour sensor value and convert to HSV colour space
+    colRGB = color_sample(gain);
+    if(color_timed_out()){
+        // Nothing is published or voted on. A sensor that stays silent reads as nothing in
+        // front, so the mission's lost() search and return home take over
+        LCD_sendstring("Sensor timeout  ", 0, 0);
+        return 0;
+    }
+    unsigned int readTick = tickCount;
+    traceLastSample(TRACE_FLAG_VOTE);
+    PROFILE_BEGIN(PROF_HSV);
+    colHSV = RgbToHsv(colRGB);
+    PROFILE_END(PROF_HSV);
+    latest.rgb = colRGB;
+    latest.hsv = colHSV;
+    latest.tick = readTick;
+
+    PROFILE_BEGIN(PROF_SEGMENT);
+    unsigned char colour_index = segmentFast(colourCentres, colourSpread, minS, minV, colHSV);
+    PROFILE_END(PROF_SEGMENT);
+    colour_index = confirmSpectral(colour_index, gain);
+    // sprintf(buf,"%03d %03d %03d %03d", colRGB.R, colRGB.G, colRGB.B, colRGB.C);
+    PROFILE_BEGIN(PROF_SPRINTF);
+    sprintf(buf,"HSV %03d %03d %03d ", colHSV.H, colHSV.S, colHSV.V);
+    PROFILE_END(PROF_SPRINTF);
+
+    unsigned char colour_out = voteColour(colour_index);
+    updateColourDrift(colourCentres, colourSpread, colour_index, colour_out, colHSV);
+    telemetry_classify(colour_index, colour_out, colHSV.H, colHSV.S, colHSV.V);
     
     // Display what the best guess for the colour is on the LCD
+    PROFILE_BEGIN(PROF_LCD);
     LCD_sendstring(buf, 0, 0);
     LCD_sendstring(COLOUR[colour_out], 1, 0);
+    PROFILE_END(PROF_LCD);
     
     return colour_out;
 }
@@ -9,7 +9,7 @@
 #define _color_H
 #define _XTAL_FREQ 64000000
 
-#include <xc.h>
+#include "hal.h"
 
 // Definition of RGB structure
 struct RGB { 
@@ -19,6 +19,19 @@ struct RGB {
     unsigned char C;
 };
 
+// Definition of the raw 16-bit sensor counts
+struct RGBRaw {
+    unsigned int R;
+    unsigned int G;
+    unsigned int B;
+    unsigned int C;
+};
+
+// Definition of a spectral signature: RGBC read under red, green then blue illumination
+struct Spectral {
+    unsigned char v[12];
+};
+
 // Definition of HSV structure
 struct HSV {
     unsigned char H;
@@ -26,21 +39,161 @@ struct HSV {
     unsigned char V;
 };
 
-struct HSV* HSV(unsigned char H, unsigned char S, unsigned char V);
+// A reading taken by senseColour()
+struct ColourSample {
+    struct RGBRaw raw;   // Counts before normalisation (lit minus ambient when differential)
+    struct RGB rgb;
+    struct HSV hsv;
+    unsigned int tick;   // tickCount once the sensor had been read
+};
+
+// Definition of the per-class spread found during calibration
+struct HSVSpread {
+    unsigned int varH;       // Variance of the hue samples about the colour centre
+    unsigned int varS;       // Variance of the saturation samples
+    unsigned int varV;       // Variance of the value samples
+    unsigned int wH;         // Distance weights derived from the variances (see HSV_Distance)
+    unsigned int wS;
+    unsigned int wV;
+    unsigned int threshold;  // Largest distance still accepted as this colour
+};
+
+// Bits of LED_ENABLE, selecting which illumination LED channels the PWM drives
+#define LED_RED             0x01
+#define LED_GREEN           0x02
+#define LED_BLUE            0x04
+
+// Integration times (ATIME): 0xFF 2.4 ms, 0xF6 24 ms, 0xD5 101 ms, 0xC0 154 ms, 0x00 700 ms
+#define ATIME_LONG          0x90  // 112 cycles, 269 ms
+#define ATIME_DIFF          0xE4  // 28 cycles; an LED on/off pair costs half an ATIME_LONG
+
+#define AGAIN_REF           1     // 4x analogue gain, the gain readings are normalised to
+#define PON_WARMUP_TICKS    2     // Ticks from PON to AEN: over the 2.4 ms warm-up whatever the phase of the tick
+
+// Sample modes for color_sample()
+#define SAMPLE_NORMAL       0     // One long integration with the LED on
+#define SAMPLE_DIFFERENTIAL 1     // LED on minus LED off, rejecting ambient light
+
+#define WAKE_MARGIN_V       8     // Rise in V above the surroundings that wakes colour classification
+#define WAKE_FALSE_LIMIT    8     // Consecutive black readings after a wake before re-arming. The vote
+                                  // takes 5 readings to move off black, so this must be more than that
+
+#define SPECTRAL_SAMPLES    4     // Signatures averaged for each calibrated spectral centre
+
+#define CALIB_SAMPLES       16    // Number of readings taken of each card during calibration
+
+// Saved calibration in data EEPROM (see saveCalibration())
+#define CALIB_ADDRESS       0x000
+#define CALIB_MAGIC         0xC5
+#define CALIB_VERSION       1
+#define CALIB_BYTES         (8 + 8 * 3 + 8 * 8 + 1 + 4 * 12)  // Before the CRC
+
+// Classifier parameters. host/sweep tunes these against recorded traces and writes the best
+// set to a header. Defining COLOR_PARAMS as the quoted name of that header builds with it
+#ifdef COLOR_PARAMS
+#include COLOR_PARAMS
+#endif
+
+// The variance floors reproduce the original fixed weights (H, S >> 1, V >> 4), so
+// calibration can widen a class but never make it more sensitive to lighting
+#ifndef VAR_MIN_H
+#define VAR_MIN_H           16
+#endif
+#ifndef VAR_MIN_S
+#define VAR_MIN_S           64
+#endif
+#ifndef VAR_MIN_V
+#define VAR_MIN_V           4096
+#endif
+
+#ifndef THRESHOLD_DEFAULT
+#define THRESHOLD_DEFAULT   300   // Acceptance radius used before calibration
+#endif
+#ifndef THRESHOLD_BLUE
+#define THRESHOLD_BLUE      100   // Blue is not clipped by minV, so it gets a tighter radius
+#endif
+#ifndef THRESHOLD_MIN
+#define THRESHOLD_MIN       100   // Limits on the calibrated acceptance radius
+#endif
+#ifndef THRESHOLD_MAX
+#define THRESHOLD_MAX       300
+#endif
+
+#ifndef WHITE_MIN_V
+#define WHITE_MIN_V         105   // Unsaturated readings brighter than this are white
+#endif
+#ifndef VOTE_CAP
+#define VOTE_CAP            8     // Most votes a colour can hold. Each reading adds two and removes one
+#endif
+#ifndef CLEAR_MARGIN
+#define CLEAR_MARGIN        10    // Added to the saturation and value seen with nothing in front for minS and minV
+#endif
+
+#define DRIFT_CONFIDENCE    4     // Only samples within threshold / DRIFT_CONFIDENCE move a centre
+#define DRIFT_LIMIT_H       8     // Furthest a centre may drift from its calibrated value
+#define DRIFT_LIMIT_S       24
+#define DRIFT_LIMIT_V       48
+
+#define HUE_BIN_SHIFT       4     // segmentFast() looks up candidate centres by hue >> HUE_BIN_SHIFT
+#define HUE_BINS            (256 >> HUE_BIN_SHIFT)
+
+struct HSV HSV(unsigned char H, unsigned char S, unsigned char V);
 char getIndexOfMax(void);
-void color_click_init(void);  // Function to initialise the colour click module using I2C
+unsigned char color_click_init(void);  // Function to initialise the colour click module using I2C
+void color_click_start(void);
 void setLEDColor(int r, int g, int b);
+void setLEDMask(unsigned char mask);
 void color_writetoaddr(char address, char value);  // Function to write to the colour click module address is the register within the colour click to write to value is the value that will be written to that address
 unsigned int  color_readfromaddr(char address);
+struct RGBRaw color_read_raw(void);  // Reads the raw 16-bit RGBC counts
+void color_set_again(unsigned char index);
+void color_set_atime(unsigned char atime);
+void setAutoGain(unsigned char enable);
+unsigned char color_agc_update(unsigned int clear);
+struct RGBRaw color_normalise(struct RGBRaw raw);
+struct RGBRaw color_normalise_with(struct RGBRaw raw, unsigned char again, unsigned char cycles);
+struct RGB color_scale(struct RGBRaw raw, unsigned char gain);
 struct RGB color_read_all(unsigned char gain);  // Function to read the red channel. Returns a 16 bit ADC value representing colour intensity
+unsigned char color_wait_fresh(void);
+struct RGB color_read_differential(unsigned char gain);
+void setColourSampleMode(unsigned char mode);
+struct RGB color_sample(unsigned char gain);  // Reads the sensor using the selected sample mode
+unsigned char color_timed_out(void);
+void color_restart(void);
+unsigned char color_wait_valid(void);
+unsigned char color_read_spectral(unsigned char gain, struct Spectral* sig);
+unsigned long spectralDistance(const struct Spectral* a, const struct Spectral* b);
+void setSpectralConfirm(unsigned char enable);
+unsigned char confirmSpectral(unsigned char colour_index, unsigned char gain);
+void showSpectralStats(void);
+void color_prime_approach(void);
+void color_arm_approach(unsigned char gain, unsigned char minV);
+void color_disarm_approach(void);
+void color_clear_int(void);
+void color_update_brake(unsigned int level, unsigned char gain);
+void color_arm_brake(unsigned int level, unsigned char gain);
+void color_disarm_brake(void);
 struct HSV RgbToHsv(struct RGB rgb);
-unsigned int euclidean_distance(unsigned char x1, unsigned char y1, unsigned char z1, unsigned char x2, unsigned char y2, unsigned char z2);
-unsigned int HSV_Distance(struct HSV hsv1, struct HSV hsv2);
-unsigned char segment(struct HSV* colourCentres, unsigned char minS, unsigned char minV, struct HSV col);
+void setSpread(struct HSVSpread* spread, unsigned int varH, unsigned int varS, unsigned int varV, unsigned int threshold);
+void initColourSpread(struct HSVSpread* colourSpread, const unsigned int* thresholds);
+unsigned int HSV_Distance(struct HSV centre, const struct HSVSpread* spread, struct HSV col);
+unsigned char segment(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char minS, unsigned char minV, struct HSV col);
+void initColourTable(struct HSV* colourCentres, struct HSVSpread* colourSpread);
+unsigned char segmentFast(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char minS, unsigned char minV, struct HSV col);
+unsigned char segmentFastDistances(void);
 void resetColourAveraging(void);
+unsigned char voteColour(unsigned char colour_index);
+void updateColourDrift(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char colour_index, unsigned char colour_out, struct HSV col);
+void setColourDrift(unsigned char enable);
+void initColourDrift(struct HSV* colourCentres);
+void resetColourDrift(struct HSV* colourCentres);
 void calibrateGainAndLED(struct HSV* colourCentres, unsigned char* gain);
 void calibrateClear(unsigned char gain, unsigned char* minS, unsigned char* minV);
-void calibrateKMean(struct HSV* colourCentres, unsigned char gain);
-unsigned char senseColour(struct HSV colourCentres[], unsigned char gain, unsigned char minS, unsigned char minV);
+void calibrateKMean(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char gain);
+void saveCalibration(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char gain, unsigned char minS, unsigned char minV);
+unsigned char loadCalibration(struct HSV* colourCentres, struct HSVSpread* colourSpread, unsigned char* gain, unsigned char* minS, unsigned char* minV);
+struct HSV getLastColour(void);
+struct ColourSample color_latest(void);
+unsigned char senseColour(struct HSV colourCentres[], struct HSVSpread colourSpread[], unsigned char gain, unsigned char minS, unsigned char minV);
 
 #endif
@@ -0,0 +1,348 @@
+/*
+ * File:   console.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include <stdio.h>
+#include <string.h>
+#include "console.h"
+#include "telemetry.h"
+#include "eeprom.h"
+
+#if CONSOLE_ENABLE
+
+// Received bytes. The interrupt writes at rxHead and console_poll() reads from rxTail
+static unsigned char rx[CONSOLE_RX_SIZE];
+static volatile unsigned char rxHead = 0;
+static volatile unsigned char rxTail = 0;
+
+static char line[CONSOLE_LINE_LEN + 1];
+static unsigned char lineLength = 0;
+static unsigned char lineTooLong = 0;
+
+static char reply[CONSOLE_REPLY_LEN + 1];
+static unsigned char replyLength = 0;   // Non-zero while a reply waits for room
+
+static const struct ConsoleParam* table;
+static unsigned char tableCount = 0;
+static const struct ConsoleHooks* hook;
+static unsigned char listNext;          // The parameter list still to send, from here
+
+/************************************
+ * Description:
+ * Starts the console: the parameter table and hooks, and the EUSART4 receive interrupt
+ * at low priority. telemetry_init() has set up the port
+ * Inputs:
+ * The parameter table, its length, and the hooks
+ ************************************/
+void console_init(const struct ConsoleParam* params, unsigned char count, const struct ConsoleHooks* hooks) {
+    table = params;
+    tableCount = count;
+    hook = hooks;
+    listNext = count;
+    rxHead = 0;
+    rxTail = 0;
+    lineLength = 0;
+    replyLength = 0;
+    IPR4bits.RC4IP = 0;
+    PIE4bits.RC4IE = 1;
+}
+
+/************************************
+ * Description:
+ * Called from the interrupt when EUSART4 has received a byte. The byte is kept if there is
+ * room, and an overrun is cleared so that reception carries on
+ ************************************/
+void console_rx_isr(void) {
+    if (RC4STAbits.OERR) {
+        RC4STAbits.CREN = 0;  // The only way to clear an overrun
+        RC4STAbits.CREN = 1;
+    }
+    unsigned char byte = HAL_UART_READ();
+    if ((unsigned char)(rxHead - rxTail) < CONSOLE_RX_SIZE) {
+        rx[rxHead & (CONSOLE_RX_SIZE - 1)] = byte;
+        rxHead++;
+    }
+}
+
+static void respond(const char* text) {
+    strncpy(reply, text, CONSOLE_REPLY_LEN);
+    reply[CONSOLE_REPLY_LEN] = 0;
+    replyLength = (unsigned char)strlen(reply);
+}
+
+/************************************
+ * Description:
+ * Sends the waiting reply, if the ring buffer has room for it
+ * Outputs:
+ * 1 if nothing is left waiting
+ ************************************/
+static unsigned char flush(void) {
+    if (!replyLength) {
+        return 1;
+    }
+    if (!telemetry_room(replyLength)) {
+        return 0;
+    }
+    telemetry_begin(TELEMETRY_CONSOLE, replyLength, TELEMETRY_WAIT);
+    for (unsigned char i = 0; i < replyLength; i++) {
+        telemetry_byte((unsigned char)reply[i]);
+    }
+    telemetry_end();
+    replyLength = 0;
+    return 1;
+}
+
+static unsigned int readParam(const struct ConsoleParam* p) {
+    if (p->flags & CONSOLE_WORD) {
+        return *(unsigned int*)p->value;
+    }
+    return *(unsigned char*)p->value;
+}
+
+static void respondParam(const struct ConsoleParam* p) {
+    char text[CONSOLE_REPLY_LEN + 8];  // Names are kept short enough to fit the reply
+    sprintf(text, "%s=%u", p->name, readParam(p));
+    respond(text);
+}
+
+static const struct ConsoleParam* findParam(const char* name) {
+    for (unsigned char i = 0; i < tableCount; i++) {
+        if (!strcmp(table[i].name, name)) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
+
+/************************************
+ * Description:
+ * Reads a decimal number of up to 16 bits
+ * Inputs:
+ * The text, and where to put the number
+ * Outputs:
+ * 1 if the whole text was a number in range
+ ************************************/
+static unsigned char parseNumber(const char* text, unsigned int* value) {
+    unsigned long n = 0;
+    if (!text || !*text) {
+        return 0;
+    }
+    for (; *text; text++) {
+        if (*text < '0' || *text > '9') {
+            return 0;
+        }
+        n = n * 10 + (unsigned long)(*text - '0');
+        if (n > 65535) {
+            return 0;
+        }
+    }
+    *value = (unsigned int)n;
+    return 1;
+}
+
+static void set(const char* name, const char* text) {
+    const struct ConsoleParam* p = findParam(name);
+    unsigned int value;
+    if (!p) {
+        respond("err name");
+    } else if (!parseNumber(text, &value)) {
+        respond("err value");
+    } else if (value < p->min || value > p->max) {
+        respond("err range");
+    } else {
+        if (p->flags & CONSOLE_WORD) {
+            *(unsigned int*)p->value = value;
+        } else {
+            *(unsigned char*)p->value = (unsigned char)value;
+        }
+        if ((p->flags & CONSOLE_NOTIFY) && hook->changed) {
+            hook->changed();
+        }
+        respondParam(p);
+    }
+}
+
+static void run(const char* primitive, const char* text) {
+    unsigned char code;
+    unsigned int arg = 0;
+    if (!strcmp(primitive, "stop")) {
+        code = CONSOLE_STOP;
+    } else if (!strcmp(primitive, "left")) {
+        code = CONSOLE_LEFT;
+    } else if (!strcmp(primitive, "right")) {
+        code = CONSOLE_RIGHT;
+    } else if (!strcmp(primitive, "fwd")) {
+        code = CONSOLE_FORWARD;
+    } else if (!strcmp(primitive, "back")) {
+        code = CONSOLE_REVERSE;
+    } else {
+        respond("err motion");
+        return;
+    }
+    if (code != CONSOLE_STOP && !parseNumber(text, &arg)) {
+        respond("err value");
+        return;
+    }
+    respond(hook->motion && hook->motion(code, arg) ? "ok" : "err busy");
+}
+
+/************************************
+ * Description:
+ * Carries out a command line, leaving its reply to be sent
+ ************************************/
+static void execute(char* text) {
+    char* word[3] = { NULL, NULL, NULL };
+    unsigned char words = 0;
+    for (char* token = strtok(text, " \t"); token; token = strtok(NULL, " \t")) {
+        if (words == 3) {
+            respond("err words");
+            return;
+        }
+        word[words++] = token;
+    }
+    if (!words) {
+        return;
+    }
+    if (!strcmp(word[0], "get") && words == 2) {
+        const struct ConsoleParam* p = findParam(word[1]);
+        if (p) {
+            respondParam(p);
+        } else {
+            respond("err name");
+        }
+    } else if (!strcmp(word[0], "set") && words == 3) {
+        set(word[1], word[2]);
+    } else if (!strcmp(word[0], "list") && words == 1) {
+        listNext = 0;
+    } else if (!strcmp(word[0], "run") && words >= 2) {
+        run(word[1], word[2]);
+    } else if (!strcmp(word[0], "save") && words == 1) {
+        if (hook->save && !hook->save()) {
+            respond("err busy");
+        } else {
+            console_save();
+            respond("ok");
+        }
+    } else {
+        respond("err command");
+    }
+}
+
+/************************************
+ * Description:
+ * Does the console's work for one pass of the main loop: sends the waiting reply, or the
+ * next line of a list, or else carries out the next complete command line
+ ************************************/
+void console_poll(void) {
+    if (!flush()) {
+        return;
+    }
+    if (listNext < tableCount) {
+        respondParam(&table[listNext++]);
+        flush();
+        return;
+    }
+    while (rxTail != rxHead) {
+        char c = (char)rx[rxTail & (CONSOLE_RX_SIZE - 1)];
+        rxTail++;
+        if (c == '\r' || c == '\n') {
+            unsigned char tooLong = lineTooLong;
+            line[lineLength] = 0;
+            lineLength = 0;
+            lineTooLong = 0;
+            if (tooLong) {
+                respond("err long");
+            } else {
+                execute(line);
+            }
+            flush();
+            return;
+        }
+        if (lineLength < CONSOLE_LINE_LEN) {
+            line[lineLength++] = c;
+        } else {
+            lineTooLong = 1;
+        }
+    }
+}
+
+// The saved parameters follow CONSOLE_MAGIC and their length in bytes, and are followed by a
+// CRC of all of it, the same one the telemetry frames use
+static unsigned char savedBytes(void) {
+    unsigned char bytes = 0;
+    for (unsigned char i = 0; i < tableCount; i++) {
+        if (table[i].flags & CONSOLE_SAVED) {
+            bytes += (table[i].flags & CONSOLE_WORD) ? 2 : 1;
+        }
+    }
+    return bytes;
+}
+
+/************************************
+ * Description:
+ * Saves the parameters flagged CONSOLE_SAVED to data EEPROM. Only bytes that have changed
+ * are written, at about 4 ms each
+ ************************************/
+void console_save(void) {
+    unsigned int address = CONSOLE_ADDRESS;
+    unsigned int crc = telemetry_crc(0xFFFF, CONSOLE_MAGIC);
+    unsigned char bytes = savedBytes();
+    eeprom_write(address++, CONSOLE_MAGIC);
+    eeprom_write(address++, bytes);
+    crc = telemetry_crc(crc, bytes);
+    for (unsigned char i = 0; i < tableCount; i++) {
+        if (!(table[i].flags & CONSOLE_SAVED)) {
+            continue;
+        }
+        unsigned int value = readParam(&table[i]);
+        eeprom_write(address++, (unsigned char)(value & 0xFF));
+        crc = telemetry_crc(crc, (unsigned char)(value & 0xFF));
+        if (table[i].flags & CONSOLE_WORD) {
+            eeprom_write(address++, (unsigned char)(value >> 8));
+            crc = telemetry_crc(crc, (unsigned char)(value >> 8));
+        }
+    }
+    eeprom_write(address++, (unsigned char)(crc & 0xFF));
+    eeprom_write(address, (unsigned char)(crc >> 8));
+}
+
+/************************************
+ * Description:
+ * Restores the parameters saved by console_save(), if the save is good and was made with
+ * the same table. Values outside a parameter's limits are left alone
+ ************************************/
+void console_load(void) {
+    unsigned char bytes = savedBytes();
+    if (eeprom_read(CONSOLE_ADDRESS) != CONSOLE_MAGIC || eeprom_read(CONSOLE_ADDRESS + 1) != bytes) {
+        return;
+    }
+    unsigned int crc = 0xFFFF;
+    for (unsigned int address = CONSOLE_ADDRESS; address < CONSOLE_ADDRESS + 2 + bytes; address++) {
+        crc = telemetry_crc(crc, eeprom_read(address));
+    }
+    unsigned int end = CONSOLE_ADDRESS + 2 + bytes;
+    if (((unsigned int)eeprom_read(end) | ((unsigned int)eeprom_read(end + 1) << 8)) != crc) {
+        return;  // Erased, or a save that did not finish
+    }
+    unsigned int address = CONSOLE_ADDRESS + 2;
+    for (unsigned char i = 0; i < tableCount; i++) {
+        if (!(table[i].flags & CONSOLE_SAVED)) {
+            continue;
+        }
+        unsigned int value = eeprom_read(address++);
+        if (table[i].flags & CONSOLE_WORD) {
+            value |= (unsigned int)eeprom_read(address++) << 8;
+            if (value >= table[i].min && value <= table[i].max) {
+                *(unsigned int*)table[i].value = value;
+            }
+        } else if (value >= table[i].min && value <= table[i].max) {
+            *(unsigned char*)table[i].value = (unsigned char)value;
+        }
+    }
+}
+
+#endif
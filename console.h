@@ -0,0 +1,89 @@
+/*
+ * File:   console.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Command console on EUSART4 (see serial.c), for tuning the buggy without reflashing it.
+// The RC4 interrupt collects received bytes, and console_poll() runs at most one command
+// each time it is called from the main loop. Replies go back as TELEMETRY_CONSOLE frames, so
+// that they share the line with the telemetry. A reply waits in console.c until the ring
+// buffer has room for it, rather than holding the loop up. host/telemetry_decode -c sends
+// the lines typed at it and prints the replies.
+//
+// Commands are lines of lower case words and decimal numbers:
+//   get NAME               replies NAME=value
+//   set NAME VALUE         sets and replies NAME=value, or "err range" outside its limits
+//   list                   replies NAME=value for every parameter, one per console_poll()
+//   run left|right DEG     turns on the spot
+//   run fwd|back TICKS     drives straight for TICKS of TICK_MS
+//   run stop               stops the motors
+//   save                   saves the parameters to data EEPROM
+// Anything else replies "err" and what was wrong with it.
+//
+// The parameters are a table of named bytes and words in RAM, given to console_init() with
+// the hooks that carry out motion and saving. A hook may refuse, for example during the run.
+#ifndef _console_H
+#define _console_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+#include "telemetry.h"
+
+#define CONSOLE_RX_SIZE     32    // Received bytes waiting for console_poll() (a power of 2)
+#define CONSOLE_LINE_LEN    24    // Longest command line
+#define CONSOLE_REPLY_LEN   24    // Longest reply
+
+// Parameters with CONSOLE_SAVED are kept by console_save() in data EEPROM after the
+// calibration (color.h), and restored by console_load()
+#define CONSOLE_ADDRESS     0x100
+#define CONSOLE_MAGIC       0xC6
+
+// Parameter flags
+#define CONSOLE_WORD        0x01  // An unsigned int, rather than an unsigned char
+#define CONSOLE_SAVED       0x02  // Saved by console_save()
+#define CONSOLE_NOTIFY      0x04  // Setting it calls the changed() hook
+
+// Motion primitives passed to the motion() hook
+#define CONSOLE_STOP        0
+#define CONSOLE_LEFT        1
+#define CONSOLE_RIGHT       2
+#define CONSOLE_FORWARD     3
+#define CONSOLE_REVERSE     4
+
+#define TELEMETRY_CONSOLE   'A'   // A reply, as text without a terminator
+
+struct ConsoleParam {
+    const char* name;
+    void* value;
+    unsigned char flags;
+    unsigned int min;
+    unsigned int max;
+};
+
+struct ConsoleHooks {
+    void (*changed)(void);                                                // A CONSOLE_NOTIFY parameter was set
+    unsigned char (*motion)(unsigned char primitive, unsigned int arg);  // 1 once done, 0 if refused
+    unsigned char (*save)(void);                                          // 1 once saved, 0 if refused
+};
+
+#if CONSOLE_ENABLE
+
+void console_init(const struct ConsoleParam* params, unsigned char count, const struct ConsoleHooks* hooks);
+void console_poll(void);
+void console_rx_isr(void);
+void console_save(void);
+void console_load(void);
+
+#else
+
+#define console_init(params, count, hooks)  ((void)0)
+#define console_poll()                      ((void)0)
+#define console_rx_isr()                    ((void)0)
+#define console_save()                      ((void)0)
+#define console_load()                      ((void)0)
+
+#endif
+
+#endif
@@ -4,14 +4,22 @@
  *
  * Created on February 29, 2024
  */
-#include <xc.h>
+#include "hal.h"
 #include <math.h>
 #include "dc_motor.h"
 #include "utils.h"
 #include "timers.h"
+#include "ADC.h"
+#include "trace.h"
+#include "telemetry.h"
+
+extern volatile unsigned char stallDetected;
 
 #define UNIT_TIME 2130
 
+volatile unsigned char emergencyBrake = 0;  // Set by the INT1 interrupt when it has braked the motors
+unsigned char motorDeadPeriods = MOTOR_DEAD_PERIODS;  // Dead time on a reversal under power, in TMR2 periods
+
 // Function initialise T2 and CCP for DC motor control
 void initDCmotorsPWM(unsigned int PWMperiod) {
     // Initialise your TRIS and LAT registers for PWM  
@@ -71,8 +79,8 @@ void initDCmotorsPWM(unsigned int PWMperiod) {
     CCP4CONbits.EN=1; //turn on
 }
 
-// Function to set CCP PWM output from the values in the motor structure
-void setMotorPWM(struct DC_motor *m) {
+// Function to work out the CCP duty cycles for the +ve and -ve sides of a motor from its structure
+static void motorDuty(struct DC_motor *m, unsigned char duty[2]) {
 	unsigned char posDuty, negDuty;  // Duty cycle values for different sides of the motor
 
 	if(m->brakemode) {
@@ -85,14 +93,64 @@ void setMotorPWM(struct DC_motor *m) {
 	}
 
 	if (m->direction) {
-		*(m->posDutyHighByte) = posDuty;  // Assign values to the CCP duty cycle registers
-		*(m->negDutyHighByte) = negDuty;       
+		duty[0] = posDuty;
+		duty[1] = negDuty;
 	} else {
-		*(m->posDutyHighByte)=negDuty;  // Do it the other way around to change direction
-		*(m->negDutyHighByte)=posDuty;
+		duty[0] = negDuty;  // Do it the other way around to change direction
+		duty[1] = posDuty;
 	}
 }
 
+// Function to write all four CCP duty cycles at the start of a TMR2 period, so that the CCPs
+// latch them at the same period boundary. Interrupts are held off for the writes alone, so that
+// they cannot be split and the emergency brake lands after them rather than between them
+static void applyDuty(struct DC_motor *mL, struct DC_motor *mR, const unsigned char duty[4]) {
+	HAL_PWM_SYNC();
+	unsigned char interrupts = INTCONbits.GIE;
+	INTCONbits.GIE = 0;
+	HAL_PWM_WRITE(mL->posDutyHighByte, duty[0]);
+	HAL_PWM_WRITE(mL->negDutyHighByte, duty[1]);
+	HAL_PWM_WRITE(mR->posDutyHighByte, duty[2]);
+	HAL_PWM_WRITE(mR->negDutyHighByte, duty[3]);
+	INTCONbits.GIE = interrupts;
+}
+
+// Function to record whether a motor is being driven, and report whether that reverses it under power
+static unsigned char motorReverses(struct DC_motor *m) {
+	char driving = m->power ? (char)(1 + m->direction) : 0;
+	unsigned char reverses = driving && m->driving && driving != m->driving;
+	m->driving = driving;
+	return reverses;
+}
+
+// Function to set CCP PWM output for both motors from the values in their structures. A motor
+// reversed under power first has both sides held low (coasting) for motorDeadPeriods, so that
+// the bridge is not switched straight across
+void setMotorsPWM(struct DC_motor *mL, struct DC_motor *mR) {
+	unsigned char duty[4];  // mL +ve, mL -ve, mR +ve, mR -ve
+	unsigned char reverseL = motorReverses(mL);
+	unsigned char reverseR = motorReverses(mR);
+
+	motorDuty(mL, &duty[0]);
+	motorDuty(mR, &duty[2]);
+	if (motorDeadPeriods && (reverseL || reverseR)) {
+		unsigned char coast[4] = { duty[0], duty[1], duty[2], duty[3] };
+		if (reverseL) {
+			coast[0] = 0;
+			coast[1] = 0;
+		}
+		if (reverseR) {
+			coast[2] = 0;
+			coast[3] = 0;
+		}
+		applyDuty(mL, mR, coast);
+		for (unsigned char i = 1; i < motorDeadPeriods; i++) {
+			HAL_PWM_SYNC();
+		}
+	}
+	applyDuty(mL, mR, duty);
+}
+
 // Function to make the robot go straight back in reverse
 void forward(DC_motor *mL, DC_motor *mR, unsigned char power) {
     // Set direction of mL, mR to forward. mL = 1 is forward, as is mR = 0
@@ -103,8 +161,10 @@ void forward(DC_motor *mL, DC_motor *mR, unsigned char power) {
     mL -> power = (unsigned char)(power*1.1);
     mR -> power = power;
     
-    setMotorPWM(mL);
-    setMotorPWM(mR);
+    setMotorsPWM(mL, mR);
+    stall_setLoad(power);
+    trace_set_motion(TRACE_MOTION_FORWARD);
+    telemetry_motion(TRACE_MOTION_FORWARD, power);
 }
 
 // Function to make the robot go straight
@@ -118,38 +178,52 @@ void reverse(DC_motor *mL, DC_motor *mR, unsigned char power)
     mL -> power = (unsigned char)(power*1.1);
     mR -> power = power;
     
-    setMotorPWM(mL);
-    setMotorPWM(mR);
+    setMotorsPWM(mL, mR);
+    stall_setLoad(power);
+    trace_set_motion(TRACE_MOTION_REVERSE);
+    telemetry_motion(TRACE_MOTION_REVERSE, power);
 }
 
 // Function to stop the robot gradually 
 void stop(DC_motor *mL, DC_motor *mR)
 {
+    stall_setLoad(0);
     for (char j = mL -> power; j > 0; j--){
         // Gradually reduce power from the current power to 0%
         mL -> power = j;
         mR -> power = j;
         
-        setMotorPWM(mL);
-        setMotorPWM(mR);
+        setMotorsPWM(mL, mR);
         __delay_us(1000);
     }
     mL -> power = 0;
     mR -> power = 0;
-    setMotorPWM(mL);
-    setMotorPWM(mR);
+    setMotorsPWM(mL, mR);
+    trace_set_motion(TRACE_MOTION_STOPPED);
+    telemetry_motion(TRACE_MOTION_STOPPED, 0);
+}
+
+// Function to brake the robot immediately (both sides of each motor held high)
+void brake(DC_motor *mL, DC_motor *mR)
+{
+    mL -> power = 0;
+    mR -> power = 0;
+    setMotorsPWM(mL, mR);
+    stall_setLoad(0);
+    trace_set_motion(TRACE_MOTION_STOPPED);
+    telemetry_motion(TRACE_MOTION_STOPPED, 0);
 }
 
 // Function to start the robot gradually 
 void start(DC_motor *mL, DC_motor *mR, char power)
 {
+    stall_setLoad((unsigned char)power);
     for (char j = 0; j <= power; j++){
         // Gradually increase power from 0% to specified amount
         mL -> power = j;
         mR -> power = j;
         
-        setMotorPWM(mL);
-        setMotorPWM(mR);
+        setMotorsPWM(mL, mR);
         __delay_us(1000);
     }
 }
@@ -160,6 +234,8 @@ void turnLeft(DC_motor *mL, DC_motor *mR) {
     mL -> direction = 0;
     mR -> direction = 0;
     
+    trace_set_motion(TRACE_MOTION_TURNING);
+    telemetry_motion(TRACE_MOTION_TURNING, 40);
     start(mL, mR, 40);
 }
 
@@ -169,14 +245,17 @@ void turnRight(DC_motor *mL, DC_motor *mR) {
     mL -> direction = 1;
     mR -> direction = 1;
     
+    trace_set_motion(TRACE_MOTION_TURNING);
+    telemetry_motion(TRACE_MOTION_TURNING, 40);
     start(mL, mR, 40);
 }
 
 void turnLeftDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned int deg) {
-    int q = 0;
+    unsigned int q = 0;
+    unsigned int duration = (unsigned int)((unsigned long)turnTime * deg / 90);  // deg / 90 alone would make 135 degrees 90
     turnLeft(mL, mR);
     
-    while (q < (turnTime * (deg / 90)))
+    while (q < duration)
     {
         if (q % 100 == 0)
         {
@@ -190,10 +269,11 @@ void turnLeftDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned int
 }
 
 void turnRightDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned int deg) {
-    int q = 0;
+    unsigned int q = 0;
+    unsigned int duration = (unsigned int)((unsigned long)turnTime * deg / 90);
     turnRight(mL, mR);
     
-    while (q < turnTime * (deg / 90))
+    while (q < duration)
     {
         if (q % 100 == 0)
         {
@@ -207,24 +287,26 @@ void turnRightDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned in
 }
 
 
-void forward_unit(DC_motor *mL, DC_motor *mR, float moveTime) {
+// Drive a distance in half units (one square of the maze is two)
+void forward_unit(DC_motor *mL, DC_motor *mR, unsigned char halfUnits) {
     forward(mL, mR, 40);
     
-    custom_delay_ms((unsigned int)(moveTime*UNIT_TIME));
+    custom_delay_ms((unsigned int)halfUnits * (UNIT_TIME / 2));
     
     stop(mL, mR);
 }
 
-void reverse_unit(DC_motor *mL, DC_motor *mR, float moveTime) {
+void reverse_unit(DC_motor *mL, DC_motor *mR, unsigned char halfUnits) {
     reverse(mL, mR, 40);
     
-    custom_delay_ms((unsigned int)(moveTime*UNIT_TIME));
+    custom_delay_ms((unsigned int)halfUnits * (UNIT_TIME / 2));
     
     stop(mL, mR);
 }
 
 /*
  * Function to pass a variable into a delay, replacing the macro __delay_ms().
+ * The delay ends early if the stall detector reports that the buggy is stuck.
  * 
  * Inputs: ms: rounds to nearest 10ms to save memory.
  * Outputs: None.
@@ -232,7 +314,7 @@ void reverse_unit(DC_motor *mL, DC_motor *mR, float moveTime) {
 void custom_delay_ms(unsigned int delayTime)
 {
     unsigned long tic = 0;
-    while(tic <= delayTime)
+    while(tic <= delayTime && !stallDetected)
     {
         tic++;
         __delay_ms(1);
@@ -240,71 +322,6 @@ void custom_delay_ms(unsigned int delayTime)
 }
 
 
-/******************************************************************************
- * Description:
- * This is a high level set of of functions mapping the output of the vision
- * system to motor commands.
- * 
- *  RED         - turn right 90 degrees.
- *  GREEN       - turn left 90 degrees.
- *  BLUE        - turn 180 degrees (moving clockwise in this implementation)
- *  YELLOW      - reverse 1 unit and turn right 90 degrees.
- *  PINK        - reverse 1 unit and turn left 90 degrees.
- *  ORANGE      - Turn right 135 degrees.
- *  LIGHT BLUE  - Turn left 135 degrees.
- *  WHITE       - Finish, returning home.
- *  BLACK       - indicates a maze wall - somethings gone wrong!
- * 
- * Inputs:
- * Motor structures for left and right sides.
- * 
- * Outputs:
- * None.
- * 
- ******************************************************************************/
-void red(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 0.5);
-    __delay_ms(100);
-    turnRightDeg(mL, mR, turnTime, 90);
-}
-
-void green(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 0.5);
-    __delay_ms(100);
-    turnLeftDeg(mL, mR, turnTime, 90);
-}
-
-void blue(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 0.5);
-    __delay_ms(100);
-    turnRightDeg(mL, mR, turnTime, 180);
-}
-
-void yellow(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 1.5);
-    __delay_ms(100);
-    turnRightDeg(mL, mR, turnTime, 90);
-}
-
-void pink(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 1.5);
-    __delay_ms(100);
-    turnLeftDeg(mL, mR, turnTime, 90);
-}
-
-void orange(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 0.5);
-    __delay_ms(100);
-    turnRightDeg(mL, mR, turnTime, 135);
-}
-
-void light_blue(DC_motor *mL, DC_motor *mR, unsigned int turnTime){
-    reverse_unit(mL, mR, 0.5);
-    __delay_ms(100);
-    turnLeftDeg(mL, mR, turnTime, 135);
-}
-
-
 /* Description:
  * Calibrating the angular and forward distances.
  *
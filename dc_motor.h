@@ -8,7 +8,7 @@
 #define _DC_MOTOR_H
 #define _XTAL_FREQ 64000000
 
-#include <xc.h>
+#include "hal.h"
 
 typedef struct DC_motor { //definition of DC_motor structure
     char power;         //motor power, out of 100
@@ -17,12 +17,17 @@ typedef struct DC_motor { //definition of DC_motor structure
     unsigned int PWMperiod; //base period of PWM cycle
     unsigned char *posDutyHighByte; //PWM duty address for motor +ve side
     unsigned char *negDutyHighByte; //PWM duty address for motor -ve side
+    char driving;       // 0 if last applied without power, otherwise 1 + the direction it was applied in
 } DC_motor;
 
+// Periods of TMR2 that a motor reversed under power coasts for first (motorDeadPeriods, 0 for none)
+#define MOTOR_DEAD_PERIODS 2
+
 //function prototypes
 void initDCmotorsPWM(unsigned int PWMperiod); // function to setup PWM
-void setMotorPWM(DC_motor *m);
+void setMotorsPWM(DC_motor *mL, DC_motor *mR);
 void stop(DC_motor *mL, DC_motor *mR);
+void brake(DC_motor *mL, DC_motor *mR);
 void start(DC_motor *mL, DC_motor *mR, char power);
 void turnLeft(DC_motor *mL, DC_motor *mR);
 void turnRight(DC_motor *mL, DC_motor *mR);
@@ -30,16 +35,9 @@ void turnLeftDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned int
 void turnRightDeg(DC_motor *mL, DC_motor *mR, unsigned int turnTime, unsigned int deg);
 void forward(DC_motor *mL, DC_motor *mR, unsigned char power);
 void reverse(DC_motor *mL, DC_motor *mR, unsigned char power);
-void forward_unit(DC_motor *mL, DC_motor *mR, float moveTime);
-void reverse_unit(DC_motor *mL, DC_motor *mR, float moveTime);
+void forward_unit(DC_motor *mL, DC_motor *mR, unsigned char halfUnits);
+void reverse_unit(DC_motor *mL, DC_motor *mR, unsigned char halfUnits);
 void custom_delay_ms(unsigned int delayTime);
-void red(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void green(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void blue(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void yellow(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void pink(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void orange(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
-void light_blue(DC_motor *mL, DC_motor *mR, unsigned int turnTime);
 
 //unsigned int calibrateLeft(DC_motor *mL, DC_motor *mR, unsigned int baseTurnTime);
 //unsigned int calibrateRight(DC_motor *mL, DC_motor *mR, unsigned int baseTurnTime);
@@ -0,0 +1,48 @@
+/*
+ * File:   eeprom.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "eeprom.h"
+
+/************************************
+ * Description:
+ * Reads a byte of data EEPROM
+ * Inputs:
+ * The address, below EEPROM_SIZE
+ * Outputs:
+ * The byte
+ ************************************/
+unsigned char eeprom_read(unsigned int address) {
+    NVMCON1bits.NVMREG = 0b00;  // Data EEPROM
+    NVMADRL = (unsigned char)(address & 0xFF);
+    NVMADRH = (unsigned char)(address >> 8);
+    NVMCON1bits.RD = 1;
+    return NVMDAT;
+}
+
+/************************************
+ * Description:
+ * Writes a byte of data EEPROM and waits for the write to finish. Bytes that already hold
+ * the value are not written, to save the time and the cell's endurance
+ * Inputs:
+ * The address, below EEPROM_SIZE, and the value
+ ************************************/
+void eeprom_write(unsigned int address, unsigned char value) {
+    if (eeprom_read(address) == value) {
+        return;  // NVMADR is left set up by the read
+    }
+    NVMDAT = value;
+    NVMCON1bits.WREN = 1;
+    unsigned char interrupts = INTCONbits.GIE;
+    INTCONbits.GIE = 0;  // The unlock sequence must not be interrupted
+    NVMCON2 = 0x55;
+    NVMCON2 = 0xAA;
+    NVMCON1bits.WR = 1;
+    INTCONbits.GIE = interrupts;
+    while (NVMCON1bits.WR);
+    NVMCON1bits.WREN = 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * File:   eeprom.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Data EEPROM of the PIC18F67K40. Reads are immediate; a write takes about 4 ms and is
+// skipped if the byte already holds the value
+#ifndef _eeprom_H
+#define _eeprom_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+
+#define EEPROM_SIZE 1024
+
+unsigned char eeprom_read(unsigned int address);
+void eeprom_write(unsigned int address, unsigned char value);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * File:   hal.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Hardware abstraction layer. The firmware includes this instead of <xc.h>.
+//
+// XC8 build: the PIC18 device header, and HAL operations that expand to the same register
+// accesses the code used before.
+// Host build (HAL_HOST, see host/): a simulated register file with the same names, and HAL
+// operations that call into the simulated peripherals.
+//
+// Register writes that only configure a peripheral (TRIS, PPS, CCPxCON...) stay as register
+// writes and land in the simulated register file on the host. Everything the simulation has
+// to react to goes through a HAL operation below, or through the i2c.h and LCD.h functions,
+// which have host implementations of their own
+#ifndef _hal_H
+#define _hal_H
+
+#ifdef HAL_HOST
+
+#include "host/hal_host.h"
+
+#else
+
+#include <xc.h>
+
+// GPIO: raw pin levels (the buttons read 0 when pressed)
+#define HAL_PIN_RF2                 PORTFbits.RF2
+#define HAL_PIN_RF3                 PORTFbits.RF3
+
+// PWM: write a CCP duty cycle high byte, and wait for TMR2 to start a period. The CCPs latch
+// their duty registers at the end of each period, so writes made straight after the wait
+// are applied together
+#define HAL_PWM_WRITE(reg, duty)    (*(reg) = (duty))
+#define HAL_PWM_SYNC()              do { PIR5bits.TMR2IF = 0; while (!PIR5bits.TMR2IF); } while (0)
+
+// ADC: start a conversion, poll it, and read the left justified result
+#define HAL_ADC_START()             (ADCON0bits.GO = 1)
+#define HAL_ADC_BUSY()              (ADCON0bits.GO)
+#define HAL_ADC_RESULTH             ADRESH
+#define HAL_ADC_RESULTL             ADRESL
+
+// UART: send a byte on EUSART4 once its transmit buffer has room, or straight away from
+// the TX4 interrupt. Reading the received byte clears RC4IF
+#define HAL_UART_WRITE(b)           do { while (!PIR4bits.TX4IF); TX4REG = (b); } while (0)
+#define HAL_UART_TX(b)              (TX4REG = (b))
+#define HAL_UART_READ()             RC4REG
+
+// Timers: read the low byte, which latches the high byte into TMRxH
+#define HAL_TMR0L                   TMR0L
+#define HAL_TMR1L                   TMR1L
+#define HAL_TMR3L                   TMR3L
+#define HAL_TMR5L                   TMR5L
+#define HAL_TMR7L                   TMR7L
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * File:   LCD_host.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Host backend of LCD.h. Keeps the 2x16 display contents at byte level (cursor commands
+// and characters), takes as long as the real display, and reports changed lines to the
+// world model
+
+#include "../hal.h"
+#include "../LCD.h"
+
+#define BYTE_US 60  // Both nibbles and the 50 us execution delay
+
+void hal_host_lcd(unsigned char row, const char* text);
+
+static char display[2][17];
+static unsigned char cursorRow = 0;
+static unsigned char cursorCol = 0;
+
+void LCD_E_TOG(void) {
+    hal_host_delay_us(2);
+}
+
+void LCD_sendnibble(unsigned char number) {
+    hal_host_delay_us(8);
+}
+
+void LCD_sendbyte(unsigned char Byte, char type) {
+    hal_host_delay_us(BYTE_US);
+    if (!(type & 1)) {
+        if (Byte & 0x80) {  // Set DDRAM address
+            cursorRow = (Byte & 0x40) ? 1 : 0;
+            cursorCol = Byte & 0x0F;
+        } else if (Byte == 0x01) {  // Clear display
+            for (unsigned char r = 0; r < 2; r++) {
+                for (unsigned char c = 0; c < 16; c++) {
+                    display[r][c] = ' ';
+                }
+            }
+            cursorRow = 0;
+            cursorCol = 0;
+        }
+        return;
+    }
+    if (cursorCol < 16) {
+        display[cursorRow][cursorCol] = (char)Byte;
+    }
+    cursorCol++;
+}
+
+void LCD_Init(void) {
+    LCD_sendbyte(0b00000001, 0);
+}
+
+void LCD_setCursor(char row, char col) {
+    LCD_sendbyte((unsigned char)((row == 0 ? 0x80 : 0xC0) + col), 0);
+}
+
+void LCD_sendstring(const char *string, char row, char col) {
+    LCD_setCursor(row, col);
+    while (*string != 0) {
+        LCD_sendbyte((unsigned char)*string++, 1);
+    }
+    display[(unsigned char)row][16] = 0;
+    hal_host_lcd((unsigned char)row, display[(unsigned char)row]);
+}
@@ -0,0 +1,73 @@
+/*
+ * File:   eeprom_host.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Host backend of eeprom.h. The EEPROM starts erased at power on, or holds the image in the
+// file given to hal_host_eeprom_file(). Every write that changes a byte takes the part's
+// write time and is saved back to the file, so a later run powers on with it
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../hal.h"
+#include "../eeprom.h"
+
+#define WRITE_US    4000    // Data EEPROM write time
+
+static unsigned char rom[EEPROM_SIZE];
+static unsigned char ready = 0;
+static const char* file = NULL;
+
+static void power_on(void) {
+    memset(rom, 0xFF, sizeof(rom));
+    if (file) {
+        FILE* f = fopen(file, "rb");
+        if (f) {
+            if (fread(rom, 1, sizeof(rom), f) != sizeof(rom)) {
+                memset(rom, 0xFF, sizeof(rom));  // Not an image: start erased
+            }
+            fclose(f);
+        }
+    }
+    ready = 1;
+}
+
+/************************************
+ * Description:
+ * Chooses a file to hold the EEPROM image between runs. Call before hal_host_run()
+ * Inputs:
+ * The path, or NULL for an EEPROM that starts erased
+ ************************************/
+void hal_host_eeprom_file(const char* path) {
+    file = path;
+    ready = 0;
+}
+
+unsigned char eeprom_read(unsigned int address) {
+    if (!ready) {
+        power_on();
+    }
+    return rom[address % EEPROM_SIZE];
+}
+
+void eeprom_write(unsigned int address, unsigned char value) {
+    if (eeprom_read(address) == value) {
+        return;
+    }
+    hal_host_delay_us(WRITE_US);
+    rom[address % EEPROM_SIZE] = value;
+    if (file) {
+        // Written to the side and renamed, so that missions running together never see half
+        char tmp[512];
+        snprintf(tmp, sizeof(tmp), "%s.%ld", file, (long)getpid());
+        FILE* f = fopen(tmp, "wb");
+        if (f) {
+            fwrite(rom, 1, sizeof(rom), f);
+            fclose(f);
+            rename(tmp, file);
+        }
+    }
+}
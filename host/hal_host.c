@@ -0,0 +1,311 @@
+/*
+ * File:   hal_host.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#define HAL_HOST_REGISTERS
+#include "../hal.h"
+#include <setjmp.h>
+#include <stddef.h>
+#include "../timers.h"
+#include "../ADC.h"
+
+#define STEP_US         1000    // Longest step the world model is moved on by at once
+#define PIN_READ_US     1       // Cost of polling a pin
+#define PWM_WRITE_US    10      // Cost of a duty cycle write, including the arithmetic before it
+#define UART_BYTE_US    87      // Start, 8 data and stop bits at 115200 baud
+
+#define ISR_LOW         1
+#define ISR_HIGH        2
+
+void HighISR(void);
+void LowISR(void);
+extern volatile unsigned char LED_ENABLE;
+
+static const struct HalHostModel* model = NULL;
+static uint64_t now = 0;
+static uint64_t nextTick = TICK_MS * 1000u;
+static uint64_t limit = 0;
+static uint64_t uartFree = 0;   // When the byte on the wire has gone
+static uint64_t uartRxNext = 0; // When the receiver can next take a byte
+static unsigned char inISR = 0;   // 0 in the main line, else ISR_LOW or ISR_HIGH
+static jmp_buf stopRun;
+
+/************************************
+ * Description:
+ * Chooses what the simulated peripherals sense
+ * Inputs:
+ * The world model, or NULL for the defaults
+ ************************************/
+void hal_host_set_model(const struct HalHostModel* m) {
+    model = m;
+}
+
+/************************************
+ * Description:
+ * Runs the firmware from power on until it returns or the simulated time limit is reached
+ * Inputs:
+ * The firmware entry point and the limit in simulated microseconds (0 for none)
+ * Outputs:
+ * 0 if the firmware returned, 1 if it was stopped at the limit
+ ************************************/
+int hal_host_run(void (*firmware)(void), uint64_t limitUs) {
+    now = 0;
+    nextTick = TICK_MS * 1000u;
+    limit = limitUs;
+    inISR = 0;
+    uartFree = 0;
+    uartRxNext = 0;
+    PIR4bits.TX4IF = 1;
+    PIE4bits.TX4IE = 0;
+    PIR4bits.RC4IF = 0;
+    tcs3472_reset();
+    if (setjmp(stopRun)) {
+        return 1;
+    }
+    firmware();
+    return 0;
+}
+
+uint64_t hal_host_now_us(void) {
+    return now;
+}
+
+/************************************
+ * Description:
+ * Whether an enabled interrupt of the given priority is pending. Without IPEN every
+ * interrupt is high priority
+ ************************************/
+static int pending(unsigned char high) {
+#define SOURCE(ie, flag, ip) ((ie) && (flag) && (!INTCONbits.IPEN || (ip) == high))
+    return SOURCE(PIE5bits.TMR7IE, PIR5bits.TMR7IF, IPR5bits.TMR7IP)
+        || SOURCE(PIE0bits.INT1IE, PIR0bits.INT1IF, IPR0bits.INT1IP)
+        || SOURCE(PIE4bits.TX4IE, PIR4bits.TX4IF, IPR4bits.TX4IP)
+        || SOURCE(PIE4bits.RC4IE, PIR4bits.RC4IF, IPR4bits.RC4IP);
+#undef SOURCE
+}
+
+/************************************
+ * Description:
+ * Calls HighISR() or LowISR() if an enabled interrupt is pending, as the PIC would between
+ * instructions. A high priority interrupt can interrupt LowISR(), but not the other way
+ ************************************/
+static void dispatch(void) {
+    if (!INTCONbits.GIEH) {
+        return;
+    }
+    while (1) {
+        unsigned char was = inISR;
+        if (inISR < ISR_HIGH && pending(1)) {
+            inISR = ISR_HIGH;
+            HighISR();
+        } else if (inISR == 0 && INTCONbits.IPEN && INTCONbits.GIEL && pending(0)) {
+            inISR = ISR_LOW;
+            LowISR();
+        } else {
+            return;
+        }
+        inISR = was;
+    }
+}
+
+/************************************
+ * Description:
+ * Takes the next byte from the world model into RC4REG, if the receiver is on. A byte that
+ * arrives before the last was read is lost. OERR is not simulated
+ ************************************/
+static void uart_receive(void) {
+    if (!model || !model->uartRead || !RC4STAbits.SPEN || !RC4STAbits.CREN || now < uartRxNext) {
+        return;
+    }
+    int byte = model->uartRead();
+    if (byte < 0) {
+        return;
+    }
+    uartRxNext = now + UART_BYTE_US;
+    if (PIR4bits.RC4IF) {
+        return;
+    }
+    RC4REG = (unsigned char)byte;
+    PIR4bits.RC4IF = 1;
+}
+
+/************************************
+ * Description:
+ * Moves simulated time on. The world model, the colour click, the EUSART4 receiver and TMR7
+ * are stepped together, and interrupts are taken as soon as they are raised
+ * Inputs:
+ * The time to wait in microseconds
+ ************************************/
+void hal_host_delay_us(uint32_t us) {
+    uint64_t target = now + us;
+    while (now < target) {
+        uint64_t next = target;
+        if (next > now + STEP_US) {
+            next = now + STEP_US;
+        }
+        if (next > nextTick) {
+            next = nextTick;
+        }
+        if (!PIR4bits.TX4IF && next > uartFree) {
+            next = uartFree;
+        }
+        if (uartRxNext > now && next > uartRxNext) {
+            next = uartRxNext;  // A line arriving is taken at the baud rate
+        }
+        if (model && model->advance) {
+            model->advance((uint32_t)(next - now));
+        }
+        now = next;
+        tcs3472_step(now);
+        if (now >= uartFree) {
+            PIR4bits.TX4IF = 1;
+        }
+        uart_receive();
+        if (now >= nextTick) {
+            nextTick += TICK_MS * 1000u;
+            if (T7CONbits.ON) {
+                PIR5bits.TMR7IF = 1;
+            }
+        }
+        dispatch();
+        if (limit && now >= limit && !inISR) {
+            longjmp(stopRun, 1);
+        }
+    }
+}
+
+unsigned char hal_host_pin(unsigned char pin) {
+    hal_host_delay_us(PIN_READ_US);
+    unsigned char level = (model && model->pin) ? model->pin(pin) : 1;
+    if (pin == HAL_HOST_RF2) {
+        PORTFbits.RF2 = level;
+    } else {
+        PORTFbits.RF3 = level;
+    }
+    return level;
+}
+
+void hal_host_pwm_write(volatile unsigned char* reg, unsigned char duty) {
+    *reg = duty;
+    hal_host_delay_us(PWM_WRITE_US);
+}
+
+/************************************
+ * Description:
+ * Waits for the next TMR2 period to start, counting the period from T2PR and the prescaler
+ * from Fosc/4
+ ************************************/
+void hal_host_pwm_sync(void) {
+    uint64_t period = ((uint64_t)T2PR + 1) * (1u << T2CONbits.CKPS) / 16;  // us
+    if (period) {
+        hal_host_delay_us((uint32_t)(period - now % period));
+    }
+}
+
+/************************************
+ * Description:
+ * Converts the battery voltage (the only ADC channel the firmware uses) straight away,
+ * into a left justified 10-bit result
+ ************************************/
+void hal_host_adc_start(void) {
+    unsigned int mv = (model && model->batteryMilliVolts) ? model->batteryMilliVolts() : 4100;
+    unsigned long counts = ((unsigned long)mv * 1023u) / (BATTERY_DIVIDER * ADC_VREF_MV);
+    if (counts > 1023) {
+        counts = 1023;
+    }
+    ADRESH = (unsigned char)(counts >> 2);
+    ADRESL = (unsigned char)((counts & 0x03) << 6);
+    ADCON0bits.GO = 0;
+}
+
+/************************************
+ * Description:
+ * Sends a byte on EUSART4 after waiting for the previous one to finish
+ ************************************/
+void hal_host_uart_write(unsigned char byte) {
+    if (now < uartFree) {
+        hal_host_delay_us((uint32_t)(uartFree - now));
+    }
+    hal_host_uart_tx(byte);
+}
+
+/************************************
+ * Description:
+ * Puts a byte on the wire straight away, as a write to TX4REG does. The transmitter is
+ * busy, with TX4IF clear, for the byte's time on the wire
+ ************************************/
+void hal_host_uart_tx(unsigned char byte) {
+    PIR4bits.TX4IF = 0;
+    uartFree = now + UART_BYTE_US;
+    if (model && model->uart) {
+        model->uart(byte);
+    }
+}
+
+/************************************
+ * Description:
+ * Reads the byte received on EUSART4, as a read of RC4REG does, which clears RC4IF
+ ************************************/
+unsigned char hal_host_uart_read(void) {
+    PIR4bits.RC4IF = 0;
+    return RC4REG;
+}
+
+/************************************
+ * Description:
+ * Reads TMR0L, and latches the high byte into TMR0H. TMR0 counts Fosc/4 (16 MHz) through
+ * the T0CON1 prescaler, so it runs 16 counts per us at 1:1
+ ************************************/
+unsigned char hal_host_tmr0l(void) {
+    if (T0CON0bits.T0EN) {
+        uint16_t count = (uint16_t)((now * 16) >> T0CON1bits.T0CKPS);
+        TMR0H = (unsigned char)(count >> 8);
+        TMR0L = (unsigned char)count;
+    }
+    return TMR0L;
+}
+
+/************************************
+ * Description:
+ * Reads TMR7L, and latches the high byte into TMR7H. TMR7 counts Fosc/4 / 4 from the tick,
+ * as it does on the PIC from its overflow until the interrupt reloads it
+ ************************************/
+unsigned char hal_host_tmr7l(void) {
+    uint16_t count = (uint16_t)((now - (nextTick - TICK_MS * 1000u)) * 4);
+    TMR7H = (unsigned char)(count >> 8);
+    return (unsigned char)count;
+}
+
+/************************************
+ * Description:
+ * Passes a changed LCD line to the world model (host/LCD_host.c)
+ ************************************/
+void hal_host_lcd(unsigned char row, const char* text) {
+    if (model && model->lcd) {
+        model->lcd(row, text);
+    }
+}
+
+/************************************
+ * Description:
+ * The light at the colour click (host/i2c_host.c)
+ ************************************/
+void hal_host_sensor(uint32_t rate[4]) {
+    if (model && model->sensor) {
+        model->sensor(rate);
+        return;
+    }
+    rate[0] = 20;  // Room light
+    rate[1] = 8;
+    rate[2] = 6;
+    rate[3] = 6;
+    if (LED_ENABLE) {  // A mid grey card close up
+        rate[0] += 100;
+        rate[1] += 42;
+        rate[2] += 34;
+        rate[3] += 39;
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ * File:   hal_host.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Host backend of hal.h. Lets the firmware build as a Linux program (see host/Makefile).
+//
+// The PIC18 registers the firmware touches are plain variables here. Time is simulated:
+// it only moves on in the delay functions and in each HAL operation, which cost about
+// what they take on the PIC. While time moves, the TMR7 tick, the colour click INT line and
+// the EUSART4 transmitter and receiver raise their interrupt flags and HighISR() or LowISR()
+// is called as the hardware would.
+//
+// What the buggy drives into is provided by a struct HalHostModel. Without one there is a
+// fixed grey surface, a full battery and nobody pressing the buttons
+#ifndef _hal_host_H
+#define _hal_host_H
+
+#include <stdint.h>
+
+// XC8 built-ins
+#define __interrupt(priority)
+#define __delay_ms(x)               hal_host_delay_us((uint32_t)(x) * 1000u)
+#define __delay_us(x)               hal_host_delay_us((uint32_t)(x))
+
+// GPIO: raw pin levels (the buttons read 0 when pressed)
+#define HAL_HOST_RF2                0
+#define HAL_HOST_RF3                1
+#define HAL_PIN_RF2                 hal_host_pin(HAL_HOST_RF2)
+#define HAL_PIN_RF3                 hal_host_pin(HAL_HOST_RF3)
+
+// PWM: write a CCP duty cycle high byte, and wait for TMR2 to start a period. The motor model
+// takes writes straight away rather than at the end of the period
+#define HAL_PWM_WRITE(reg, duty)    hal_host_pwm_write((reg), (duty))
+#define HAL_PWM_SYNC()              hal_host_pwm_sync()
+
+// ADC: conversions finish as soon as they start
+#define HAL_ADC_START()             hal_host_adc_start()
+#define HAL_ADC_BUSY()              (ADCON0bits.GO)
+#define HAL_ADC_RESULTH             ADRESH
+#define HAL_ADC_RESULTL             ADRESL
+
+// UART: each byte takes its time on the wire at 115200 baud. PIR4bits.TX4IF is set while
+// the transmitter is free, and PIR4bits.RC4IF while a received byte waits to be read
+#define HAL_UART_WRITE(b)           hal_host_uart_write((unsigned char)(b))
+#define HAL_UART_TX(b)              hal_host_uart_tx((unsigned char)(b))
+#define HAL_UART_READ()             hal_host_uart_read()
+
+// Timers: reading the low byte latches the high byte into TMRxH. TMR0 counts simulated time
+// at the rate T0CON1 sets from Fosc/4, and TMR7 the time since its last tick. The LED PWM
+// timers are not simulated and read back what was written
+#define HAL_TMR0L                   hal_host_tmr0l()
+#define HAL_TMR1L                   TMR1L
+#define HAL_TMR3L                   TMR3L
+#define HAL_TMR5L                   TMR5L
+#define HAL_TMR7L                   hal_host_tmr7l()
+
+// Simulated register file. hal_host.c defines HAL_HOST_REGISTERS to allocate it
+#ifdef HAL_HOST_REGISTERS
+#define HAL_HOST_SFR volatile
+#else
+#define HAL_HOST_SFR extern volatile
+#endif
+
+#define HAL_HOST_BITS8(p)   struct { unsigned p##0:1; unsigned p##1:1; unsigned p##2:1; unsigned p##3:1; \
+                                     unsigned p##4:1; unsigned p##5:1; unsigned p##6:1; unsigned p##7:1; }
+
+HAL_HOST_SFR HAL_HOST_BITS8(RF) PORTFbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATA) LATAbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATC) LATCbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATD) LATDbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATE) LATEbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATF) LATFbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATG) LATGbits;
+HAL_HOST_SFR HAL_HOST_BITS8(LATH) LATHbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISA) TRISAbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISB) TRISBbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISC) TRISCbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISD) TRISDbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISE) TRISEbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISF) TRISFbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISG) TRISGbits;
+HAL_HOST_SFR HAL_HOST_BITS8(TRISH) TRISHbits;
+HAL_HOST_SFR HAL_HOST_BITS8(ANSELB) ANSELBbits;
+HAL_HOST_SFR HAL_HOST_BITS8(ANSELC) ANSELCbits;
+HAL_HOST_SFR HAL_HOST_BITS8(ANSELF) ANSELFbits;
+HAL_HOST_SFR HAL_HOST_BITS8(WPUB) WPUBbits;
+HAL_HOST_SFR unsigned char INT1PPS, RE2PPS, RE4PPS, RC7PPS, RG6PPS;
+
+// Interrupts. With IPEN set, GIE and PEIE are GIEH and GIEL
+HAL_HOST_SFR struct {
+    union { unsigned PEIE:1; unsigned GIEL:1; };
+    union { unsigned GIE:1; unsigned GIEH:1; };
+    unsigned IPEN:1; unsigned INT0EDG:1; unsigned INT1EDG:1;
+} INTCONbits;
+HAL_HOST_SFR struct { unsigned INT1IE:1; } PIE0bits;
+HAL_HOST_SFR struct { unsigned INT1IF:1; } PIR0bits;
+HAL_HOST_SFR struct { unsigned INT1IP:1; } IPR0bits;
+HAL_HOST_SFR struct { unsigned TMR1IE:1; unsigned TMR3IE:1; unsigned TMR5IE:1; unsigned TMR7IE:1; } PIE5bits;
+HAL_HOST_SFR struct { unsigned TMR1IF:1; unsigned TMR3IF:1; unsigned TMR5IF:1; unsigned TMR7IF:1; } PIR5bits;
+HAL_HOST_SFR struct { unsigned TMR1IP:1; unsigned TMR3IP:1; unsigned TMR5IP:1; unsigned TMR7IP:1; } IPR5bits;
+
+// Timers. TMR7 is simulated as a TICK_MS interrupt while T7CONbits.ON is set, and TMR0 is
+// read through HAL_TMR0L. The LED PWM timers are not: the sensor model is given the LED
+// brightness instead
+HAL_HOST_SFR struct { unsigned TMR0MD:1; unsigned TMR1MD:1; unsigned TMR3MD:1; unsigned TMR5MD:1; unsigned TMR7MD:1; } PMD1bits;
+HAL_HOST_SFR struct { unsigned T0OUTPS:4; unsigned T016BIT:1; unsigned T0EN:1; } T0CON0bits;
+HAL_HOST_SFR struct { unsigned T0CKPS:4; unsigned T0ASYNC:1; unsigned T0CS:3; } T0CON1bits;
+HAL_HOST_SFR unsigned char TMR0H, TMR0L;
+HAL_HOST_SFR struct { unsigned CS:4; } TMR1CLKbits, TMR3CLKbits, TMR5CLKbits, TMR7CLKbits;
+HAL_HOST_SFR struct { unsigned T1GE:1; unsigned T1GPOL:1; } T1GCONbits;
+HAL_HOST_SFR struct { unsigned T3GE:1; unsigned T3GPOL:1; } T3GCONbits;
+HAL_HOST_SFR struct { unsigned T5GE:1; unsigned T5GPOL:1; } T5GCONbits;
+HAL_HOST_SFR struct { unsigned T7GE:1; unsigned T7GPOL:1; } T7GCONbits;
+HAL_HOST_SFR struct { unsigned CKPS:2; unsigned T1RD16:1; unsigned NOT_SYNC:1; unsigned ON:1; } T1CONbits;
+HAL_HOST_SFR struct { unsigned CKPS:2; unsigned T3RD16:1; unsigned NOT_SYNC:1; unsigned ON:1; } T3CONbits;
+HAL_HOST_SFR struct { unsigned CKPS:2; unsigned T5RD16:1; unsigned NOT_SYNC:1; unsigned ON:1; } T5CONbits;
+HAL_HOST_SFR struct { unsigned CKPS:2; unsigned T7RD16:1; unsigned NOT_SYNC:1; unsigned ON:1; } T7CONbits;
+HAL_HOST_SFR unsigned char TMR1H, TMR1L, TMR3H, TMR3L, TMR5H, TMR5L, TMR7H, TMR7L;
+
+// PWM (TMR2 and CCP1-4). The motor model reads the CCPRxH duty registers
+HAL_HOST_SFR struct { unsigned CKPS:3; unsigned ON:1; } T2CONbits;
+HAL_HOST_SFR struct { unsigned MODE:5; } T2HLTbits;
+HAL_HOST_SFR struct { unsigned CS:4; } T2CLKCONbits;
+HAL_HOST_SFR unsigned char T2PR, CCPR1H, CCPR2H, CCPR3H, CCPR4H;
+HAL_HOST_SFR struct { unsigned C1TSEL:2; unsigned C2TSEL:2; unsigned C3TSEL:2; unsigned C4TSEL:2; } CCPTMRS0bits;
+HAL_HOST_SFR struct { unsigned CCP1MODE:4; unsigned FMT:1; unsigned EN:1; } CCP1CONbits;
+HAL_HOST_SFR struct { unsigned CCP2MODE:4; unsigned FMT:1; unsigned EN:1; } CCP2CONbits;
+HAL_HOST_SFR struct { unsigned CCP3MODE:4; unsigned FMT:1; unsigned EN:1; } CCP3CONbits;
+HAL_HOST_SFR struct { unsigned CCP4MODE:4; unsigned FMT:1; unsigned EN:1; } CCP4CONbits;
+
+// ADC
+HAL_HOST_SFR struct { unsigned ADNREF:1; unsigned ADPREF:2; } ADREFbits;
+HAL_HOST_SFR struct { unsigned ADFM:1; unsigned ADCS:1; unsigned ADON:1; unsigned GO:1; } ADCON0bits;
+HAL_HOST_SFR unsigned char ADPCH, ADRESH, ADRESL;
+
+// EUSART4. Transmission is simulated through HAL_UART_WRITE and HAL_UART_TX, and reception,
+// while SPEN and CREN are set, through HAL_UART_READ
+HAL_HOST_SFR struct { unsigned TX4IE:1; unsigned RC4IE:1; } PIE4bits;
+HAL_HOST_SFR struct { unsigned TX4IF:1; unsigned RC4IF:1; } PIR4bits;
+HAL_HOST_SFR struct { unsigned TX4IP:1; unsigned RC4IP:1; } IPR4bits;
+HAL_HOST_SFR unsigned char RC0PPS, RX4PPS, SP4BRGL, SP4BRGH, RC4REG;
+HAL_HOST_SFR struct { unsigned BRG16:1; } BAUD4CONbits;
+HAL_HOST_SFR struct { unsigned BRGH:1; unsigned TXEN:1; } TX4STAbits;
+HAL_HOST_SFR struct { unsigned SPEN:1; unsigned CREN:1; unsigned FERR:1; unsigned OERR:1; } RC4STAbits;
+
+// What the simulated peripherals sense. Any member may be left NULL
+struct HalHostModel {
+    void (*advance)(uint32_t dtUs);               // Move the world on by dtUs, driven by CCPR1H-CCPR4H
+    void (*sensor)(uint32_t rate[4]);             // Light at the colour sensor as CRGB counts per 2.4 ms cycle at 1x gain
+    unsigned int (*batteryMilliVolts)(void);
+    unsigned char (*pin)(unsigned char pin);      // Level of HAL_HOST_RF2 or HAL_HOST_RF3
+    void (*lcd)(unsigned char row, const char* text);  // An LCD line has changed
+    void (*uart)(unsigned char byte);             // A byte has been sent on EUSART4
+    int (*uartRead)(void);                        // The next byte to arrive on EUSART4, or -1 for none yet
+};
+
+void hal_host_set_model(const struct HalHostModel* model);
+int hal_host_run(void (*firmware)(void), uint64_t limitUs);  // 0 if the firmware returned, 1 at the time limit
+uint64_t hal_host_now_us(void);
+void hal_host_delay_us(uint32_t us);
+
+unsigned char hal_host_pin(unsigned char pin);
+void hal_host_pwm_write(volatile unsigned char* reg, unsigned char duty);
+void hal_host_pwm_sync(void);
+void hal_host_adc_start(void);
+void hal_host_uart_write(unsigned char byte);
+void hal_host_uart_tx(unsigned char byte);
+unsigned char hal_host_uart_read(void);
+unsigned char hal_host_tmr0l(void);
+unsigned char hal_host_tmr7l(void);
+
+// Data EEPROM (host/eeprom_host.c)
+void hal_host_eeprom_file(const char* path);
+
+// Colour click (host/i2c_host.c)
+void tcs3472_reset(void);
+void tcs3472_step(uint64_t nowUs);
+
+#endif
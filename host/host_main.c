@@ -0,0 +1,130 @@
+/*
+ * File:   host_main.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Runs the firmware on the host against the default peripherals: a grey surface in
+// front of the sensor, a full battery, and an operator who taps the RF2 button every
+// couple of seconds, which walks through calibration and starts the run. The LCD is
+// printed whenever it changes
+//
+// With -p, EUSART4 is connected to a pseudo terminal, whose name is printed, for
+// telemetry_decode to read. The simulation is then held to real time, and bytes that the
+// reader is not keeping up with are lost, as they would be on a serial line. Bytes written
+// to the terminal arrive at the receiver, so telemetry_decode -c can drive the console
+//
+// Usage: robot_host [-t seconds] [-q] [-p]
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "../hal.h"
+
+#define TAP_PERIOD_US   2000000
+#define TAP_LENGTH_US   300000
+
+void firmware_main(void);
+
+static unsigned char quiet = 0;
+static int ptyMaster = -1;
+static struct timespec started;
+
+static unsigned char operator_pin(unsigned char pin) {
+    if (pin != HAL_HOST_RF2) {
+        return 1;
+    }
+    return (hal_host_now_us() % TAP_PERIOD_US) < TAP_LENGTH_US ? 0 : 1;
+}
+
+static void print_lcd(unsigned char row, const char* text) {
+    static char shown[2][17];
+    if (!quiet && strcmp(shown[row], text)) {
+        strcpy(shown[row], text);
+        printf("%9.3f  LCD%u |%-16s|\n", hal_host_now_us() / 1e6, row, text);
+    }
+}
+
+// Holds the simulation back to real time
+static void keep_real_time(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    double ahead = hal_host_now_us() / 1e6 - ((t.tv_sec - started.tv_sec) + (t.tv_nsec - started.tv_nsec) / 1e9);
+    if (ahead > 0.001) {
+        usleep((useconds_t)(ahead * 1e6));
+    }
+}
+
+static void pty_uart(unsigned char byte) {
+    keep_real_time();
+    if (write(ptyMaster, &byte, 1) < 0) {
+        return;  // Nobody is reading
+    }
+}
+
+// Polled by the receiver at every step of simulated time, which keeps the simulation in
+// real time even while nothing is sent
+static int pty_uart_read(void) {
+    unsigned char byte;
+    keep_real_time();
+    return read(ptyMaster, &byte, 1) == 1 ? byte : -1;
+}
+
+/************************************
+ * Description:
+ * Opens a pseudo terminal for EUSART4, in raw mode so that the bytes pass unchanged
+ * Outputs:
+ * 0 on success
+ ************************************/
+static int open_pty(void) {
+    struct termios tio;
+    ptyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if (ptyMaster < 0 || grantpt(ptyMaster) || unlockpt(ptyMaster)) {
+        perror("pty");
+        return 1;
+    }
+    // Hold the terminal open so that writes do not fail before a reader opens it
+    int slave = open(ptsname(ptyMaster), O_RDWR | O_NOCTTY);
+    if (slave < 0 || tcgetattr(slave, &tio)) {
+        perror(ptsname(ptyMaster));
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(ptyMaster, F_SETFL, fcntl(ptyMaster, F_GETFL) | O_NONBLOCK);
+    fprintf(stderr, "EUSART4 on %s\n", ptsname(ptyMaster));
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    double seconds = 60;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-q")) {
+            quiet = 1;
+        } else if (!strcmp(argv[i], "-p")) {
+            if (open_pty()) {
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-t seconds] [-q] [-p]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    static struct HalHostModel bench = { NULL, NULL, NULL, operator_pin, print_lcd, NULL, NULL };
+    bench.uart = ptyMaster >= 0 ? pty_uart : NULL;
+    bench.uartRead = ptyMaster >= 0 ? pty_uart_read : NULL;
+    hal_host_set_model(&bench);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int stopped = hal_host_run(firmware_main, (uint64_t)(seconds * 1e6));
+    printf("%s after %.3f s simulated\n", stopped ? "Stopped" : "Firmware returned", hal_host_now_us() / 1e6);
+    return 0;
+}
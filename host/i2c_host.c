@@ -0,0 +1,215 @@
+/*
+ * File:   i2c_host.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Host backend of i2c.h. The only device on the bus is the colour click's TCS3472,
+// modelled at register level: integrations take (256 - ATIME) * 2.4 ms of simulated time,
+// their counts follow the light given by the world model and the AGAIN setting, and the
+// clear channel interrupt drives the INT1 flag with the AILT/AIHT/PERS behaviour of the part
+
+#include "../hal.h"
+#include "../i2c.h"
+
+#define TCS_ADDRESS     0x29
+#define TCS_ID          0x44    // TCS34721/TCS34725
+#define CYCLE_US        2400    // One ATIME cycle
+#define BIT_US          10      // 100 kHz bus
+
+// Registers
+#define ENABLE  0x00
+#define ATIME   0x01
+#define AILTL   0x04
+#define AIHTL   0x06
+#define PERS    0x0C
+#define CONTROL 0x0F
+#define ID      0x12
+#define STATUS  0x13
+#define CDATAL  0x14
+
+#define PON     0x01
+#define AEN     0x02
+#define AIEN    0x10
+#define AVALID  0x01
+#define AINT    0x10
+
+void hal_host_sensor(uint32_t rate[4]);
+
+enum BusState { BUS_IDLE, BUS_ADDRESS, BUS_COMMAND, BUS_WRITE, BUS_READ, BUS_IGNORE };
+
+static const unsigned char GAIN[4] = { 1, 4, 16, 60 };
+
+static unsigned char regs[32];
+static unsigned char pointer = 0;
+static unsigned char autoIncrement = 0;
+static enum BusState bus = BUS_IDLE;
+static uint64_t integrationStart = 0;
+static unsigned char outOfRange = 0;  // Consecutive integrations outside AILT-AIHT
+
+/************************************
+ * Description:
+ * Puts the TCS3472 in its power on state
+ ************************************/
+void tcs3472_reset(void) {
+    for (unsigned char i = 0; i < sizeof(regs); i++) {
+        regs[i] = 0;
+    }
+    regs[ATIME] = 0xFF;
+    regs[ID] = TCS_ID;
+    pointer = 0;
+    autoIncrement = 0;
+    bus = BUS_IDLE;
+    outOfRange = 0;
+}
+
+static unsigned int reg16(unsigned char address) {
+    return (unsigned int)(regs[address] | (regs[address + 1] << 8));
+}
+
+/************************************
+ * Description:
+ * Number of integrations out of range before AINT is set, from the PERS register.
+ * APERS = 0 gives 0: every integration sets AINT, whatever the thresholds
+ ************************************/
+static unsigned char persistence(void) {
+    unsigned char apers = regs[PERS] & 0x0F;
+    return apers <= 3 ? apers : (unsigned char)(5 * (apers - 3));
+}
+
+/************************************
+ * Description:
+ * Latches the counts of a finished integration, sets AVALID and updates the interrupt
+ ************************************/
+static void complete_integration(void) {
+    uint32_t rate[4];
+    unsigned long cycles = 256 - regs[ATIME];
+    unsigned long full = cycles * 1024 > 65535 ? 65535 : cycles * 1024;
+    hal_host_sensor(rate);
+    for (unsigned char i = 0; i < 4; i++) {
+        unsigned long count = (unsigned long)rate[i] * cycles * GAIN[regs[CONTROL] & 0x03];
+        if (count > full) {
+            count = full;
+        }
+        regs[CDATAL + 2*i] = (unsigned char)(count & 0xFF);
+        regs[CDATAL + 2*i + 1] = (unsigned char)(count >> 8);
+    }
+    regs[STATUS] |= AVALID;
+
+    if (!(regs[ENABLE] & AIEN)) {
+        return;
+    }
+    unsigned int clear = reg16(CDATAL);
+    if (persistence() == 0 || clear < reg16(AILTL) || clear > reg16(AIHTL)) {
+        if (outOfRange < 255) {
+            outOfRange++;
+        }
+        if (outOfRange >= persistence() && !(regs[STATUS] & AINT)) {
+            regs[STATUS] |= AINT;
+            PIR0bits.INT1IF = 1;  // The INT line is active low, and INT1 is set for a falling edge
+        }
+    } else {
+        outOfRange = 0;
+    }
+}
+
+/************************************
+ * Description:
+ * Completes every integration that has finished by the given time
+ ************************************/
+void tcs3472_step(uint64_t nowUs) {
+    if ((regs[ENABLE] & (PON | AEN)) != (PON | AEN)) {
+        return;
+    }
+    uint64_t period = (uint64_t)(256 - regs[ATIME]) * CYCLE_US;
+    while (nowUs >= integrationStart + period) {
+        integrationStart += period;
+        complete_integration();
+    }
+}
+
+static void write_register(unsigned char value) {
+    unsigned char old = regs[pointer];
+    regs[pointer] = value;
+    if (pointer == ENABLE) {
+        if ((value & (PON | AEN)) == (PON | AEN) && (old & (PON | AEN)) != (PON | AEN)) {
+            integrationStart = hal_host_now_us();  // A new integration starts when AEN is set
+            outOfRange = 0;
+        } else if (!(value & AEN)) {
+            regs[STATUS] &= (unsigned char)~AVALID;
+        }
+    }
+    if (pointer == STATUS) {
+        regs[STATUS] = old;  // Read only
+    }
+    if (autoIncrement) {
+        pointer = (pointer + 1) & 0x1F;
+    }
+}
+
+void I2C_2_Master_Init(void) {
+    bus = BUS_IDLE;
+}
+
+unsigned char I2C_2_Master_Idle(void) {
+    return 0;
+}
+
+void I2C_2_Master_Start(void) {
+    hal_host_delay_us(BIT_US);
+    bus = BUS_ADDRESS;
+}
+
+void I2C_2_Master_RepStart(void) {
+    hal_host_delay_us(BIT_US);
+    bus = BUS_ADDRESS;
+}
+
+void I2C_2_Master_Stop(void) {
+    hal_host_delay_us(BIT_US);
+    bus = BUS_IDLE;
+}
+
+void I2C_2_Master_Write(unsigned char data_byte) {
+    hal_host_delay_us(9 * BIT_US);
+    switch (bus) {
+        case BUS_ADDRESS:
+            if ((data_byte >> 1) != TCS_ADDRESS) {
+                bus = BUS_IGNORE;  // Not acknowledged
+            } else {
+                bus = (data_byte & 0x01) ? BUS_READ : BUS_COMMAND;
+            }
+            break;
+        case BUS_COMMAND:
+            if ((data_byte & 0xE0) == 0xE0) {  // Special function
+                if ((data_byte & 0x1F) == 0x06) {  // Clear the clear channel interrupt
+                    regs[STATUS] &= (unsigned char)~AINT;
+                    outOfRange = 0;
+                }
+                bus = BUS_IGNORE;
+            } else {
+                pointer = data_byte & 0x1F;
+                autoIncrement = (data_byte & 0x60) == 0x20;
+                bus = BUS_WRITE;
+            }
+            break;
+        case BUS_WRITE:
+            write_register(data_byte);
+            break;
+        default:
+            break;
+    }
+}
+
+unsigned char I2C_2_Master_Read(unsigned char ack) {
+    hal_host_delay_us(9 * BIT_US);
+    if (bus != BUS_READ) {
+        return 0xFF;
+    }
+    unsigned char value = regs[pointer];
+    if (autoIncrement) {
+        pointer = (pointer + 1) & 0x1F;
+    }
+    return value;
+}
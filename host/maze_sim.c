@@ -0,0 +1,655 @@
+/*
+ * File:   maze_sim.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Maze simulator for the navigation firmware. The firmware runs unchanged on the host
+// backend (hal_host.c). This file supplies the world it senses:
+// - a grid maze with coloured cards, read from a text file (see mazes/simple.txt);
+// - differential drive kinematics from the CCP duty registers;
+// - a TCS3472 response to the cards and LEDs, with sensor noise and room light;
+// - a battery that sags with motor current;
+// - an operator who follows the LCD prompts to calibrate and start the buggy.
+//
+// Each mission runs in a child process, so that every run starts from the firmware's
+// power on state. Missions run several hundred times faster than real time.
+//
+// With -r, each mission's RGBC trace (see trace.h) is written to <prefix>-<run>.rgbc, with
+// the card in front of the sensor as the ground truth label, for host/replay.c.
+//
+// With -e, the firmware's data EEPROM is kept in a file. A mission that calibrates saves its
+// calibration there, and the missions after it start from it without calibrating.
+//
+// --ramp changes the light at the sensor, LEDs and room, from START: red by pct per minute and
+// green and blue by a quarter of that. Red LEDs lose more light than green and blue ones as
+// they warm up, and daylight changes colour as well as level.
+//
+// -c prints a confusion matrix of the colour reads: the card in front against the colour shown.
+//
+// --set NAME=VALUE types "set NAME VALUE" at the firmware's console (console.h) while it waits
+// at a "<- " prompt or runs the maze. It may be given several times.
+//
+// Usage: maze_sim [-m maze] [-n runs] [-j jobs] [-s seed] [-t seconds] [-r prefix] [-e eeprom] [-c]
+//                 [--noise pct] [--light level] [--ramp pct] [--slip pct] [--set NAME=VALUE] [-v]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../hal.h"
+#include "../trace.h"
+
+#define MAX_SIZE        64
+#define CELL_M          0.10    // Size of a maze square
+#define RADIUS_M        0.07    // The buggy is a circle this big for collisions
+#define SENSOR_M        0.07    // Sensor distance ahead of the wheel axle
+#define TRACK_M         0.12    // Distance between the wheels
+#define VMAX_MS         0.32    // Wheel speed at 100% duty
+#define LEFT_GAIN       (1 / 1.1)  // The left motor is weaker, which forward() corrects for
+#define MOTOR_TAU_S     0.05    // Time constant of the wheel speed
+#define RANGE_M         0.30    // Furthest surface the sensor can see
+#define FALLOFF_M       0.02    // Distance at which reflected LED light halves
+#define CARD_M          0.05    // A card closer than this is what the buggy is reading
+#define COUNTS          125.0   // Counts per 2.4 ms cycle at 1x for a white card at contact
+#define BATTERY_MV      4100
+#define BATTERY_MOHM    150     // Internal resistance
+#define TAP_US          300000  // How long the operator holds a button
+#define CONSOLE_LINE_US 250000  // Between console lines, so that each is run before the next
+
+void firmware_main(void);
+
+extern volatile unsigned char RED_BRIGHTNESS, GREEN_BRIGHTNESS, BLUE_BRIGHTNESS, LED_ENABLE;
+
+// Reflectance of each kind of surface in the red, green and blue bands
+struct Surface {
+    char code;
+    const char* name;  // As shown on the LCD
+    double refl[3];
+};
+
+static const struct Surface SURFACES[] = {
+    { 'W', "White",      { 0.90, 0.90, 0.90 } },
+    { 'R', "Red",        { 0.80, 0.10, 0.12 } },
+    { 'P', "Pink",       { 0.90, 0.45, 0.60 } },
+    { 'O', "Orange",     { 0.90, 0.40, 0.08 } },
+    { 'Y', "Yellow",     { 0.90, 0.85, 0.15 } },
+    { 'G', "Green",      { 0.12, 0.50, 0.20 } },
+    { 'L', "Light Blue", { 0.35, 0.70, 0.85 } },
+    { 'B', "Blue",       { 0.08, 0.15, 0.55 } },
+    { '#', "Wall",       { 0.04, 0.04, 0.04 } },
+};
+#define CARDS           8       // The cards at the start of SURFACES, without the wall
+
+struct Options {
+    const char* maze;
+    int runs;
+    int jobs;
+    unsigned long seed;
+    double seconds;
+    double noise;   // Sensor noise, fraction of the reading
+    double light;   // Room light, 1 is a lit lab
+    double ramp;    // Change in the red light per minute of the maze run, fraction
+    double slip;    // Spread of the wheel speed error between runs, fraction
+    int verbose;
+    int confusion;      // Print the confusion matrix of the colour reads
+    const char* trace;  // Prefix of the trace files, NULL for none
+    const char* eeprom; // EEPROM image kept between missions, NULL to start each one erased
+    char console[256];  // Lines typed at the firmware's console
+};
+
+struct Result {
+    double missionS;    // From START to the firmware returning (or the time limit)
+    int finished;       // The firmware returned
+    int sawWhite;       // White was read while facing a white card
+    int collisions;
+    int reads;          // Colours the firmware showed while facing the maze
+    int misreads;       // ... that were not the card in front of it
+    double homeErrorM;  // Distance from the start when the run ended
+    int confusion[CARDS + 2][CARDS];  // Reads by what was in front (a card, the wall or nothing) and colour shown
+};
+
+// World state, one mission per process
+static struct Options opt;
+static char maze[MAX_SIZE][MAX_SIZE + 1];
+static int mazeW, mazeH;
+static double startX, startY, startHeading;
+static double x, y, heading;  // Metres, heading in radians with y pointing down the file
+static double vL, vR;
+static double gainL, gainR;
+static int inMaze = 0;        // Before START the operator holds cards up to the sensor
+static char presented = 0;    // Card the operator is holding, 0 for none
+static int blocked = 0;       // Pushed head on into a wall
+static uint64_t lastContact = 0;  // When the buggy last touched a wall
+static uint64_t missionStart = 0;
+static struct Result result;
+static FILE* traceFile = NULL;
+
+// Operator
+static char prompt[17];
+static uint64_t promptAt = 0;
+static int tapPending = 0;
+static unsigned char tapPin = HAL_HOST_RF2;
+static uint64_t tapAt = 0;
+static size_t consoleNext = 0;     // Next character of opt.console to type
+static uint64_t consoleLineAt = 0; // When the next line may be started
+
+static double uniform(void) {
+    return (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+}
+
+static double gaussian(void) {
+    return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+static const struct Surface* surface(char code) {
+    for (unsigned i = 0; i < sizeof(SURFACES) / sizeof(SURFACES[0]); i++) {
+        if (SURFACES[i].code == code) {
+            return &SURFACES[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_wall(int col, int row) {
+    if (col < 0 || row < 0 || col >= mazeW || row >= mazeH) {
+        return 1;
+    }
+    return surface(maze[row][col]) != NULL;
+}
+
+static int load_maze(const char* path) {
+    FILE* f = fopen(path, "r");
+    char line[256];
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    mazeW = mazeH = 0;
+    while (fgets(line, sizeof(line), f) && mazeH < MAX_SIZE) {
+        if (line[0] == '#' && line[1] == ' ') {
+            continue;  // Comment
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0]) {
+            continue;
+        }
+        int w = (int)strlen(line) > MAX_SIZE ? MAX_SIZE : (int)strlen(line);
+        memset(maze[mazeH], '#', MAX_SIZE);
+        memcpy(maze[mazeH], line, (size_t)w);
+        for (int col = 0; col < w; col++) {
+            const char* start = strchr("^>v<", line[col]);
+            if (start) {
+                startX = (col + 0.5) * CELL_M;
+                startY = (mazeH + 0.5) * CELL_M;
+                startHeading = (start - "^>v<") * M_PI / 2 - M_PI / 2;
+                maze[mazeH][col] = '.';
+            }
+        }
+        mazeW = w > mazeW ? w : mazeW;
+        mazeH++;
+    }
+    fclose(f);
+    return 0;
+}
+
+/************************************
+ * Description:
+ * Pushes a circle of the buggy's size at (*px, *py) out of any walls it overlaps
+ * Outputs:
+ * Whether it overlapped a wall
+ ************************************/
+static int push_out(double* px, double* py) {
+    int hit = 0;
+    int c0 = (int)floor((*px - RADIUS_M) / CELL_M), c1 = (int)floor((*px + RADIUS_M) / CELL_M);
+    int r0 = (int)floor((*py - RADIUS_M) / CELL_M), r1 = (int)floor((*py + RADIUS_M) / CELL_M);
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            if (!is_wall(col, row)) {
+                continue;
+            }
+            // Nearest point of the square to the centre
+            double nx = fmin(fmax(*px, col * CELL_M), (col + 1) * CELL_M);
+            double ny = fmin(fmax(*py, row * CELL_M), (row + 1) * CELL_M);
+            double dist = hypot(*px - nx, *py - ny);
+            if (dist < RADIUS_M && dist > 1e-9) {
+                *px = nx + (*px - nx) * RADIUS_M / dist;
+                *py = ny + (*py - ny) * RADIUS_M / dist;
+                hit = 1;
+            }
+        }
+    }
+    return hit;
+}
+
+/************************************
+ * Description:
+ * Finds the surface in front of the sensor
+ * Outputs:
+ * The distance to it (RANGE_M if there is none in range) and its code in *code
+ ************************************/
+static double look(char* code) {
+    double sx = x + SENSOR_M * cos(heading), sy = y + SENSOR_M * sin(heading);
+    for (double d = 0; d < RANGE_M; d += 0.002) {
+        int col = (int)floor((sx + d * cos(heading)) / CELL_M);
+        int row = (int)floor((sy + d * sin(heading)) / CELL_M);
+        if (is_wall(col, row)) {
+            *code = (col < 0 || row < 0 || col >= mazeW || row >= mazeH) ? '#' : maze[row][col];
+            return d;
+        }
+    }
+    *code = 0;
+    return RANGE_M;
+}
+
+/************************************
+ * Description:
+ * Drives the buggy from the CCP duty registers. Each motor is driven by the difference
+ * between the duty on its two sides, so both sides high (brake) or low (coast) is zero
+ ************************************/
+static void advance(uint32_t dtUs) {
+    double dt = dtUs * 1e-6;
+    double period = T2PR ? T2PR : 1;
+    double dL = ((double)CCPR2H - CCPR1H) / period;
+    double dR = ((double)CCPR4H - CCPR3H) / period;
+    if (!inMaze) {
+        return;
+    }
+    vL += (dL * VMAX_MS * gainL - vL) * dt / MOTOR_TAU_S;
+    vR += (dR * VMAX_MS * gainR - vR) * dt / MOTOR_TAU_S;
+
+    double v = (vL + vR) / 2;
+    double nx = x + v * cos(heading) * dt, ny = y + v * sin(heading) * dt;
+    heading -= (vR - vL) / TRACK_M * dt;  // Left turns are anticlockwise with y pointing down
+    if (opt.verbose && hal_host_now_us() / 250000 != (hal_host_now_us() + dtUs) / 250000) {
+        char code;
+        double d = look(&code);
+        printf("%9.3f  x %5.2f y %5.2f heading %4.0f  %c at %4.1f cm  wheels %5.2f %5.2f\n", hal_host_now_us() / 1e6,
+               x, y, heading * 180 / M_PI, code ? code : '-', d * 100, vL, vR);
+    }
+    // A glancing blow slides the buggy along the wall, a head on one stalls it
+    double want = hypot(nx - x, ny - y);
+    if (push_out(&nx, &ny)) {
+        if (hal_host_now_us() - lastContact > 200000) {
+            result.collisions++;  // A new hit, rather than the same one continuing
+        }
+        lastContact = hal_host_now_us();
+        blocked = hypot(nx - x, ny - y) < 0.3 * want;
+        if (blocked) {
+            // Stalled, although it can still turn on the spot
+            double common = (vL + vR) / 2;
+            vL -= common;
+            vR -= common;
+        }
+    } else {
+        blocked = 0;
+    }
+    x = nx;
+    y = ny;
+}
+
+/************************************
+ * Description:
+ * Light at the colour sensor: the LEDs reflected off the surface in front, falling off with
+ * the square of distance, plus room light, through the sensor's overlapping colour filters
+ ************************************/
+static void sensor(uint32_t rate[4]) {
+    double led[3] = {
+        (LED_ENABLE & 0x01) ? RED_BRIGHTNESS / 255.0 : 0,
+        (LED_ENABLE & 0x02) ? GREEN_BRIGHTNESS / 255.0 : 0,
+        (LED_ENABLE & 0x04) ? BLUE_BRIGHTNESS / 255.0 : 0,
+    };
+    char code = presented;
+    double d = 0.005;
+    if (inMaze) {
+        d = look(&code);
+    } else if (!code) {
+        d = RANGE_M;
+    }
+    const struct Surface* s = surface(code);
+    if (inMaze) {
+        // Ground truth for the trace: the card being read, or nothing
+        unsigned char label = 0;
+        if (s && code != '#' && d <= CARD_M) {
+            label = (unsigned char)(s - SURFACES + 3);
+        }
+        trace_set_label(label);
+    }
+    double band[3];
+    for (int c = 0; c < 3; c++) {
+        double lit = s ? led[c] * s->refl[c] / (1 + (d / FALLOFF_M) * (d / FALLOFF_M)) : 0;
+        band[c] = lit + 0.03 * opt.light;
+    }
+    if (inMaze) {
+        static const double tint[3] = { 1.0, 0.25, 0.25 };
+        double minutes = (hal_host_now_us() - missionStart) / 60e6;
+        for (int c = 0; c < 3; c++) {
+            double scale = 1 + opt.ramp * tint[c] * minutes;
+            band[c] *= scale > 0 ? scale : 0;
+        }
+    }
+    double out[4] = {
+        0.9 * (band[0] + band[1] + band[2]) / 2.7,
+        band[0] + 0.08 * band[1] + 0.02 * band[2],
+        0.10 * band[0] + band[1] + 0.15 * band[2],
+        0.02 * band[0] + 0.12 * band[1] + band[2],
+    };
+    static const double responsivity[4] = { 1.0, 1.0, 0.5, 0.5 };  // Red is twice as sensitive as green and blue
+    for (int i = 0; i < 4; i++) {
+        double counts = COUNTS * out[i] * responsivity[i] * (1 + opt.noise * gaussian()) + 0.5 * gaussian();
+        rate[i] = counts > 0 ? (uint32_t)counts : 0;
+    }
+}
+
+static void uart(unsigned char byte) {
+    if (traceFile) {
+        fputc(byte, traceFile);
+    }
+}
+
+/************************************
+ * Description:
+ * The operator types the --set lines at the console, one at a time, while the firmware is
+ * polling it: at a "<- " prompt or in the maze
+ ************************************/
+static int uart_read(void) {
+    uint64_t now = hal_host_now_us();
+    if (!opt.console[consoleNext] || now < consoleLineAt || !(inMaze || !strncmp(prompt, "<- ", 3))) {
+        return -1;
+    }
+    char c = opt.console[consoleNext++];
+    if (c == '\n') {
+        consoleLineAt = now + CONSOLE_LINE_US;
+    }
+    return (unsigned char)c;
+}
+
+static unsigned int battery(void) {
+    double period = T2PR ? T2PR : 1;
+    double drive = fabs((double)CCPR2H - CCPR1H) / period + fabs((double)CCPR4H - CCPR3H) / period;
+    double amps = 0.1 + drive * (blocked ? 3.0 : 0.8);
+    return (unsigned int)(BATTERY_MV - amps * BATTERY_MOHM + 5 * gaussian());
+}
+
+static unsigned char pin(unsigned char p) {
+    uint64_t now = hal_host_now_us();
+    if (tapPending && now >= tapAt) {
+        if (now < tapAt + TAP_US) {
+            return p == tapPin ? 0 : 1;
+        }
+        tapPending = 0;
+    }
+    return 1;
+}
+
+static void tap(unsigned char p, double afterS) {
+    tapPin = p;
+    tapAt = promptAt + (uint64_t)(afterS * 1e6);
+    tapPending = 1;
+}
+
+/************************************
+ * Description:
+ * The operator reads the LCD. Calibration prompts on the top line are answered with the
+ * card the prompt asks for and a button press. In the maze the colour on the bottom line
+ * is checked against the card the buggy is facing
+ ************************************/
+static void lcd(unsigned char row, const char* text) {
+    uint64_t now = hal_host_now_us();
+    if (opt.verbose) {
+        printf("%9.3f  LCD%u |%-16s|\n", now / 1e6, row, text);
+    }
+    if (row == 1) {
+        if (!inMaze) {
+            // Wait for the LED balance to settle, to within the noise, before pressing
+            static int settled[3];
+            int led[3];
+            if (!strncmp(prompt, "WHITE", 5) && sscanf(text, "RGB: %d %d %d", &led[0], &led[1], &led[2]) == 3) {
+                for (int c = 0; c < 3; c++) {
+                    if (abs(led[c] - settled[c]) > 3) {
+                        memcpy(settled, led, sizeof(settled));
+                        promptAt = now;
+                        tap(HAL_HOST_RF2, 1.5);
+                        break;
+                    }
+                }
+            }
+            return;
+        }
+        for (unsigned i = 0; i < sizeof(SURFACES) / sizeof(SURFACES[0]) - 1; i++) {
+            size_t n = strlen(SURFACES[i].name);
+            if (!strncmp(text, SURFACES[i].name, n) && text[n] == ' ') {
+                char code;
+                double d = look(&code);
+                int truth = d > CARD_M ? CARDS + 1 : (code == '#' ? CARDS : (int)(surface(code) - SURFACES));
+                result.confusion[truth][i]++;
+                result.reads++;
+                if (d > CARD_M || code != SURFACES[i].code) {
+                    result.misreads++;
+                } else if (code == 'W') {
+                    result.sawWhite = 1;
+                }
+            }
+        }
+        return;
+    }
+    if (!strcmp(prompt, text)) {
+        return;
+    }
+    strcpy(prompt, text);
+    promptAt = now;
+    if (inMaze) {
+        return;
+    }
+    if (!strncmp(text, "WHITE", 5)) {
+        presented = 'W';
+        tap(HAL_HOST_RF2, 1.5);
+    } else if (!strncmp(text, "CLEAR", 5)) {
+        presented = 0;
+        tap(HAL_HOST_RF2, 1.0);
+    } else if (!strncmp(text, "<- Skip", 7)) {
+        tap(HAL_HOST_RF3, 0.5);  // Calibrate the colour centres
+    } else if (!strncmp(text, "K-Mean ", 7)) {
+        // The name may be cut short by the end of the line
+        size_t n = strlen(text + 7);
+        while (n && text[7 + n - 1] == ' ') {
+            n--;
+        }
+        presented = 0;
+        for (unsigned i = 0; n && i < sizeof(SURFACES) / sizeof(SURFACES[0]); i++) {
+            if (n <= strlen(SURFACES[i].name) && !strncmp(text + 7, SURFACES[i].name, n)) {
+                presented = SURFACES[i].code;
+            }
+        }
+        tap(HAL_HOST_RF2, 1.0);
+    } else if (!strncmp(text, "HOLD", 4)) {
+        tap(HAL_HOST_RF2, 0.5);
+    } else if (!strncmp(text, "<- START", 8)) {
+        presented = 0;
+        inMaze = 1;
+        missionStart = now;
+        tap(HAL_HOST_RF2, 0.5);
+    } else if (!strncmp(text, "START", 5)) {
+        inMaze = 1;  // Started from the saved calibration, with nothing to press
+        missionStart = now;
+    }
+}
+
+static void mission(int run, struct Result* out) {
+    srand((unsigned)(opt.seed + (unsigned long)run));
+    if (opt.trace) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s-%03d.rgbc", opt.trace, run);
+        traceFile = fopen(path, "wb");
+        if (!traceFile) {
+            perror(path);
+        }
+    }
+    x = startX;
+    y = startY;
+    heading = startHeading;
+    gainL = LEFT_GAIN * (1 + opt.slip * gaussian());
+    gainR = 1 + opt.slip * gaussian();
+
+    static const struct HalHostModel world = { advance, sensor, battery, pin, lcd, uart, uart_read };
+    hal_host_set_model(&world);
+    hal_host_eeprom_file(opt.eeprom);
+    int stopped = hal_host_run(firmware_main, (uint64_t)(opt.seconds * 1e6));
+
+    result.finished = !stopped;
+    result.missionS = inMaze ? (hal_host_now_us() - missionStart) / 1e6 : 0;
+    result.homeErrorM = hypot(x - startX, y - startY);
+    *out = result;
+    if (traceFile) {
+        fclose(traceFile);
+    }
+}
+
+/************************************
+ * Description:
+ * Runs one mission in a child process and collects its result through a pipe
+ ************************************/
+static pid_t spawn(int run, int* fd) {
+    int p[2];
+    if (pipe(p)) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct Result r;
+        close(p[0]);
+        mission(run, &r);
+        fflush(stdout);
+        if (write(p[1], &r, sizeof(r)) != sizeof(r)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(p[1]);
+    *fd = p[0];
+    return pid;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-m maze] [-n runs] [-j jobs] [-s seed] [-t seconds] [-r prefix] [-e eeprom] [-c]\n"
+                    "          [--noise pct] [--light level] [--ramp pct] [--slip pct] [--set NAME=VALUE] [-v]\n", name);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    opt = (struct Options){ "mazes/simple.txt", 20, 4, 1, 300, 0.02, 1.0, 0, 0.02, 0, 0, NULL, NULL, "" };
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(a, "-v")) {
+            opt.verbose = 1;
+            continue;
+        }
+        if (!strcmp(a, "-c")) {
+            opt.confusion = 1;
+            continue;
+        }
+        if (!v) {
+            usage(argv[0]);
+        }
+        i++;
+        if (!strcmp(a, "-m")) opt.maze = v;
+        else if (!strcmp(a, "-n")) opt.runs = atoi(v);
+        else if (!strcmp(a, "-j")) opt.jobs = atoi(v);
+        else if (!strcmp(a, "-s")) opt.seed = strtoul(v, NULL, 0);
+        else if (!strcmp(a, "-t")) opt.seconds = atof(v);
+        else if (!strcmp(a, "-r")) opt.trace = v;
+        else if (!strcmp(a, "-e")) opt.eeprom = v;
+        else if (!strcmp(a, "--noise")) opt.noise = atof(v) / 100;
+        else if (!strcmp(a, "--light")) opt.light = atof(v);
+        else if (!strcmp(a, "--ramp")) opt.ramp = atof(v) / 100;
+        else if (!strcmp(a, "--slip")) opt.slip = atof(v) / 100;
+        else if (!strcmp(a, "--set")) {
+            const char* eq = strchr(v, '=');
+            size_t used = strlen(opt.console);
+            if (!eq || snprintf(opt.console + used, sizeof(opt.console) - used, "set %.*s %s\n",
+                                (int)(eq - v), v, eq + 1) >= (int)(sizeof(opt.console) - used)) {
+                usage(argv[0]);
+            }
+        }
+        else usage(argv[0]);
+    }
+    if (load_maze(opt.maze)) {
+        return 1;
+    }
+    if (opt.verbose) {
+        opt.runs = 1;
+        opt.jobs = 1;
+    }
+    if (opt.jobs < 1) {
+        opt.jobs = 1;
+    }
+
+    struct Result* results = calloc((size_t)opt.runs, sizeof(*results));
+    pid_t* pids = calloc((size_t)opt.runs, sizeof(*pids));
+    int* fds = calloc((size_t)opt.runs, sizeof(*fds));
+    int next = 0, done = 0;
+    printf("%4s %8s %8s %5s %5s %10s %8s\n", "run", "time_s", "finished", "white", "hits", "misreads", "home_cm");
+    while (done < opt.runs) {
+        while (next < opt.runs && next - done < opt.jobs) {
+            pids[next] = spawn(next, &fds[next]);
+            next++;
+        }
+        struct Result* r = &results[done];
+        if (read(fds[done], r, sizeof(*r)) != sizeof(*r)) {
+            memset(r, 0, sizeof(*r));
+            fprintf(stderr, "run %d failed\n", done);
+        }
+        close(fds[done]);
+        waitpid(pids[done], NULL, 0);
+        printf("%4d %8.1f %8d %5d %5d %4d/%-5d %8.1f\n", done, r->missionS, r->finished, r->sawWhite,
+               r->collisions, r->misreads, r->reads, r->homeErrorM * 100);
+        done++;
+    }
+
+    int finished = 0, white = 0, hits = 0, misreads = 0, reads = 0, home = 0;
+    double time = 0;
+    for (int i = 0; i < opt.runs; i++) {
+        finished += results[i].finished;
+        white += results[i].sawWhite;
+        hits += results[i].collisions;
+        misreads += results[i].misreads;
+        reads += results[i].reads;
+        home += results[i].finished && results[i].homeErrorM < 2 * CELL_M;
+        time += results[i].missionS;
+    }
+    printf("\n%d runs: %d reached white, %d finished, %d back within %.0f cm of the start\n",
+           opt.runs, white, finished, home, 2 * CELL_M * 100);
+    printf("mean mission %.1f s, %.2f collisions per run, %d of %d colour reads wrong\n",
+           time / opt.runs, (double)hits / opt.runs, misreads, reads);
+    if (opt.confusion) {
+        printf("\ncolour reads (rows: in front, columns: shown)\n%-10s", "");
+        for (int c = 0; c < CARDS; c++) {
+            printf(" %10s", SURFACES[c].name);
+        }
+        printf("\n");
+        for (int t = 0; t < CARDS + 2; t++) {
+            int row[CARDS] = { 0 }, any = 0;
+            for (int i = 0; i < opt.runs; i++) {
+                for (int c = 0; c < CARDS; c++) {
+                    row[c] += results[i].confusion[t][c];
+                    any |= row[c];
+                }
+            }
+            if (!any) {
+                continue;
+            }
+            printf("%-10s", t < CARDS ? SURFACES[t].name : (t == CARDS ? "Wall" : "Nothing"));
+            for (int c = 0; c < CARDS; c++) {
+                printf(" %10d", row[c]);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * File:   replay.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Replays RGBC traces (see trace.h) through the firmware's own classification code:
+// color_normalise_with() and color_scale(), RgbToHsv(), segment(), and the vote and drift
+// tracking of senseColour(). The spectral check is not replayed, as a trace only holds RGBC.
+// senseColour() classifies with segmentFast(), which must give what segment() gives.
+//
+// Samples are classified with the calibration recorded in their trace, so the samples
+// taken while calibrating are classified with the centres they produced. Reports:
+// - the cost of each stage per sample, timed on this machine. This ranks the stages and
+//   shows regressions; it is not a PIC cycle count
+// - segment() against segmentFast(): host cycles and distances worked out per sample, and
+//   every sample where they disagree
+// - a confusion matrix of segment() over every labelled sample, and of the vote over the
+//   samples senseColour() took
+// - decision latency: from a card coming into view to the vote showing it
+//
+// -d replays without drift tracking (setColourDrift()), to see what it is worth.
+//
+// Usage: replay [-n repeats] [-d] trace.rgbc...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../hal.h"
+#include "../color.h"
+#include "../trace.h"
+#include "trace_file.h"
+
+#define CLASSES     11
+#define STAGES      4
+
+struct Latency {
+    int shown;          // Times the card came into view
+    int decided;        // ... and the vote showed it before it went out of view
+    double sumMs, maxMs;
+    int sumReads;
+};
+
+static const char* NAME[CLASSES] = { "-", "--", "---", "White", "Red", "Pink", "Orange", "Yellow",
+                                     "Green", "LtBlue", "Blue" };
+static const char* STAGE[STAGES] = { "normalise+scale", "RgbToHsv", "segment", "vote+drift" };
+static const char* MOTION[4] = { "stopped", "forward", "reverse", "turning" };
+
+static unsigned long segmentMatrix[CLASSES][CLASSES];
+static unsigned long voteMatrix[CLASSES][CLASSES];
+static unsigned long motionReads[4], motionRight[4];
+static struct Latency latency[CLASSES];
+static double stageNs[STAGES];
+static unsigned long timedSamples;
+static double segmentCycles[2];             // segment(), segmentFast()
+static unsigned long segmentDistances[2];
+static unsigned long fastFallbacks, fastDisagree, fastCompared;
+
+static double now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// CPU cycles where the timestamp counter can be read, otherwise nanoseconds
+static double now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return (double)__rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+/************************************
+ * Description:
+ * Times each classification stage over every sample of a trace, repeated to get past
+ * the clock's resolution. The stages are timed one at a time over the whole trace
+ ************************************/
+static void time_stages(struct Trace* t, int repeats) {
+    const struct Event** sample = calloc(t->count + 1, sizeof(*sample));
+    size_t n = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->events[i].type == TRACE_SAMPLE) {
+            sample[n++] = &t->events[i];
+        }
+    }
+    struct RGB* rgb = calloc(n + 1, sizeof(*rgb));
+    struct HSV* hsv = calloc(n + 1, sizeof(*hsv));
+    unsigned char* seg = calloc(n + 1, 1);
+    struct HSV centres[8];
+    double start;
+
+    start = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        for (size_t i = 0; i < n; i++) {
+            const struct Event* e = sample[i];
+            rgb[i] = color_scale(color_normalise_with(e->raw, e->again, e->atime), t->gain);
+        }
+    }
+    stageNs[0] += now_ns() - start;
+
+    start = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        for (size_t i = 0; i < n; i++) {
+            hsv[i] = RgbToHsv(rgb[i]);
+        }
+    }
+    stageNs[1] += now_ns() - start;
+
+    start = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        for (size_t i = 0; i < n; i++) {
+            seg[i] = segment(t->centres, t->spread, t->minS, t->minV, hsv[i]);
+        }
+    }
+    stageNs[2] += now_ns() - start;
+
+    initColourTable(t->centres, t->spread);
+    for (int f = 0; f < 2; f++) {
+        start = now_cycles();
+        for (int r = 0; r < repeats; r++) {
+            for (size_t i = 0; i < n; i++) {
+                seg[i] = f ? segmentFast(t->centres, t->spread, t->minS, t->minV, hsv[i])
+                           : segment(t->centres, t->spread, t->minS, t->minV, hsv[i]);
+            }
+        }
+        segmentCycles[f] += now_cycles() - start;
+    }
+
+    memcpy(centres, t->centres, sizeof(centres));
+    initColourDrift(centres);
+    start = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        resetColourAveraging();
+        for (size_t i = 0; i < n; i++) {
+            unsigned char out = voteColour(seg[i]);
+            updateColourDrift(centres, t->spread, seg[i], out, hsv[i]);
+        }
+    }
+    stageNs[3] += now_ns() - start;
+    timedSamples += (unsigned long)n * (unsigned long)repeats;
+
+    free(sample);
+    free(rgb);
+    free(hsv);
+    free(seg);
+}
+
+/************************************
+ * Description:
+ * Classifies a trace in order, as the firmware did, and adds it to the statistics.
+ * The vote is reset where the firmware reset it, and the colour centres drift with it
+ ************************************/
+static void replay(struct Trace* t) {
+    struct HSV centres[8];
+    memcpy(centres, t->centres, sizeof(centres));
+    initColourDrift(centres);
+    initColourTable(centres, t->spread);
+    resetColourAveraging();
+
+    unsigned char inView = 0;   // The card the vote should be showing, 0 for none
+    unsigned int viewTick = 0;  // When it came into view
+    int viewReads = 0;
+    int decided = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        const struct Event* e = &t->events[i];
+        if (e->type == TRACE_RESET) {
+            resetColourAveraging();
+            continue;
+        }
+        struct HSV hsv = trace_file_hsv(t, e);
+        unsigned char seg = segment(centres, t->spread, t->minS, t->minV, hsv);
+        unsigned char fast = segmentFast(centres, t->spread, t->minS, t->minV, hsv);
+        unsigned char known = e->label < CLASSES;
+        segmentDistances[0] += hsv.V > t->minV && hsv.S > t->minS ? 9 : 1;
+        segmentDistances[1] += segmentFastDistances();
+        fastFallbacks += segmentFastDistances() >= 8;
+        fastCompared++;
+        if (fast != seg) {
+            fastDisagree++;
+            printf("segmentFast() disagrees: HSV %3d %3d %3d gave %d, segment() %d\n",
+                   hsv.H, hsv.S, hsv.V, fast, seg);
+        }
+        if (known) {
+            segmentMatrix[e->label][seg]++;
+        }
+        if (!(e->flags & TRACE_FLAG_VOTE)) {
+            continue;
+        }
+        unsigned char out = voteColour(seg);
+        updateColourDrift(centres, t->spread, seg, out, hsv);
+        if (!known) {
+            continue;
+        }
+        voteMatrix[e->label][out]++;
+        motionReads[e->motion]++;
+        motionRight[e->motion] += out == e->label || (out < 3 && e->label < 3);
+
+        if (e->label != inView) {
+            inView = e->label >= 3 ? e->label : 0;
+            viewTick = e->tick;
+            viewReads = 0;
+            decided = 0;
+            if (inView) {
+                latency[inView].shown++;
+            }
+        }
+        viewReads++;
+        if (inView && !decided && out == inView) {
+            double ms = (double)(unsigned int)((e->tick - viewTick) & 0xFFFF) * t->tickMs;
+            struct Latency* l = &latency[inView];
+            decided = 1;
+            l->decided++;
+            l->sumMs += ms;
+            l->maxMs = ms > l->maxMs ? ms : l->maxMs;
+            l->sumReads += viewReads;
+        }
+    }
+}
+
+static void print_matrix(const char* title, unsigned long m[CLASSES][CLASSES]) {
+    unsigned long total = 0, right = 0;
+    printf("\n%s (rows: truth, columns: result)\n%-7s", title, "");
+    for (int c = 0; c < CLASSES; c++) {
+        printf("%7s", NAME[c]);
+    }
+    printf("\n");
+    for (int r = 0; r < CLASSES; r++) {
+        unsigned long row = 0;
+        for (int c = 0; c < CLASSES; c++) {
+            row += m[r][c];
+        }
+        if (!row) {
+            continue;
+        }
+        printf("%-7s", NAME[r]);
+        for (int c = 0; c < CLASSES; c++) {
+            printf("%7lu", m[r][c]);
+            total += m[r][c];
+            right += (r == c || (r < 3 && c < 3)) ? m[r][c] : 0;
+        }
+        printf("\n");
+    }
+    printf("%lu of %lu right (%.1f%%), counting -, -- and --- as the same\n", right, total,
+           total ? 100.0 * right / total : 0);
+}
+
+int main(int argc, char** argv) {
+    int repeats = 20;
+    int traces = 0;
+    setColourDrift(1);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+            repeats = repeats < 1 ? 1 : repeats;
+            continue;
+        }
+        if (!strcmp(argv[i], "-d")) {
+            setColourDrift(0);
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-n repeats] [-d] trace.rgbc...\n", argv[0]);
+            return 2;
+        }
+        struct Trace t;
+        if (trace_file_load(argv[i], &t)) {
+            return 1;
+        }
+        if (!t.calibrated) {
+            fprintf(stderr, "%s: no calibration record, skipped\n", argv[i]);
+        } else {
+            replay(&t);
+            time_stages(&t, repeats);
+            traces++;
+        }
+        trace_file_free(&t);
+    }
+    if (!traces) {
+        fprintf(stderr, "usage: %s [-n repeats] [-d] trace.rgbc...\n", argv[0]);
+        return 2;
+    }
+
+    double total = 0;
+    for (int s = 0; s < STAGES; s++) {
+        total += stageNs[s];
+    }
+    printf("%d traces, %lu samples timed\n\n%-16s %10s %7s\n", traces, timedSamples / (unsigned long)repeats,
+           "stage", "ns/sample", "share");
+    for (int s = 0; s < STAGES; s++) {
+        printf("%-16s %10.1f %6.1f%%\n", STAGE[s], stageNs[s] / timedSamples, total ? 100 * stageNs[s] / total : 0);
+    }
+
+    printf("\n%-16s %10s %10s\n", "classifier", "cycles", "distances");
+    for (int f = 0; f < 2; f++) {
+        printf("%-16s %10.1f %10.2f\n", f ? "segmentFast" : "segment", segmentCycles[f] / timedSamples,
+               fastCompared ? (double)segmentDistances[f] / fastCompared : 0);
+    }
+    printf("segmentFast() parity: %lu of %lu samples differ, %lu fell back to the full search\n",
+           fastDisagree, fastCompared, fastFallbacks);
+
+    print_matrix("segment(), every labelled sample", segmentMatrix);
+    print_matrix("senseColour() vote", voteMatrix);
+
+    printf("\nVote accuracy by motion\n");
+    for (int m = 0; m < 4; m++) {
+        if (motionReads[m]) {
+            printf("%-8s %6lu of %6lu\n", MOTION[m], motionRight[m], motionReads[m]);
+        }
+    }
+
+    printf("\nDecision latency, from a card coming into view to the vote showing it\n%-7s %6s %8s %8s %8s %6s\n",
+           "card", "shown", "decided", "mean_ms", "max_ms", "reads");
+    for (int c = 3; c < CLASSES; c++) {
+        struct Latency* l = &latency[c];
+        if (!l->shown) {
+            continue;
+        }
+        printf("%-7s %6d %8d %8.0f %8.0f %6.1f\n", NAME[c], l->shown, l->decided,
+               l->decided ? l->sumMs / l->decided : 0, l->maxMs, l->decided ? (double)l->sumReads / l->decided : 0);
+    }
+    return fastDisagree ? 1 : 0;
+}
@@ -0,0 +1,695 @@
+/*
+ * File:   sweep.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Tunes the classifier parameters in color.h against recorded RGBC traces (see trace.h).
+// The parameters are the variance floors behind the HSV_Distance() weights, the acceptance
+// radii, the white cutoff in segment(), the vote cap and the margin that gives minS and minV.
+//
+// Every parameter set is scored by calibrating each trace again from its own K-Mean
+// samples, then classifying and voting on the readings senseColour() took in the maze.
+// A card shown wrongly costs WRONG_COST, and a card not shown (yet) costs one. The batch
+// kernel does segment() for all of a trace's readings at once, one colour centre at a
+// time, in loops the compiler vectorises. Before sweeping, the kernel and the
+// recalibration are checked against the firmware's own code with the default parameters.
+//
+// The sets are split into chunks, dealt out to one deque per thread. Each thread works
+// through its own deque from the back and steals from the front of the others when it runs
+// out. The best set is printed, and written as a header for COLOR_PARAMS with -o.
+//
+// Drift tracking and the spectral check are not modelled, and minV does not move the
+// approach wake threshold, which decides when readings are taken.
+//
+// Usage: sweep [-j threads] [-r random_sets] [-s seed] [-p NAME=lo:hi:step]... [-o header]
+//              trace.rgbc...
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../hal.h"
+#include "../color.h"
+#include "../trace.h"
+#include "trace_file.h"
+
+#define WRONG_COST  10      // A wrong card sends the buggy the wrong way; a late one only costs time
+#define CHUNK       64      // Parameter sets per task
+#define MAX_JOBS    256
+
+enum { P_VAR_MIN_H, P_VAR_MIN_S, P_VAR_MIN_V, P_THRESHOLD_DEFAULT, P_THRESHOLD_BLUE,
+       P_THRESHOLD_MIN, P_THRESHOLD_MAX, P_WHITE_MIN_V, P_VOTE_CAP, P_CLEAR_MARGIN, PARAMS };
+
+struct Range {
+    const char* name;
+    long def, lo, hi, step;
+};
+
+// The firmware's values, and the grid searched around them unless changed with -p. The
+// variance floors stay at 4 or more, which keeps the kernel's distances within 32 bits
+static struct Range range[PARAMS] = {
+    { "VAR_MIN_H",         VAR_MIN_H,         8,    32,   8 },
+    { "VAR_MIN_S",         VAR_MIN_S,         32,   128,  32 },
+    { "VAR_MIN_V",         VAR_MIN_V,         2048, 8192, 2048 },
+    { "THRESHOLD_DEFAULT", THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, 1 },
+    { "THRESHOLD_BLUE",    THRESHOLD_BLUE,    THRESHOLD_BLUE, THRESHOLD_BLUE, 1 },
+    { "THRESHOLD_MIN",     THRESHOLD_MIN,     50,   150,  25 },
+    { "THRESHOLD_MAX",     THRESHOLD_MAX,     200,  500,  100 },
+    { "WHITE_MIN_V",       WHITE_MIN_V,       85,   125,  10 },
+    { "VOTE_CAP",          VOTE_CAP,          4,    12,   2 },
+    { "CLEAR_MARGIN",      CLEAR_MARGIN,      0,    20,   5 },
+};
+
+// One trace, laid out for the kernel
+struct Batch {
+    size_t n;                   // Readings senseColour() took
+    uint8_t *H, *S, *V;
+    uint8_t* label;             // Ground truth, TRACE_LABEL_UNKNOWN if not known
+    uint8_t* reset;             // The vote was reset before this reading
+    struct HSV centres[8];      // Calibrated (or default) colour centres
+    int calibrated[8];          // Whether the trace holds the class's K-Mean samples
+    unsigned int var[8][3];     // Their variances about the centre
+    struct HSV calib[8][CALIB_SAMPLES];
+    uint8_t clearS, clearV;     // Reading with nothing in front, before CLEAR_MARGIN
+};
+
+struct Score {
+    unsigned long cost, right, wrong, missed;
+};
+
+struct Deque {
+    pthread_mutex_t lock;
+    long* task;
+    long head, tail;
+};
+
+struct Worker {
+    pthread_t thread;
+    int id;
+    struct Deque deque;
+    uint32_t *dist, *blue;      // Kernel scratch, one entry per reading
+    uint8_t *best, *seg;
+    long bestIndex;
+    struct Score bestScore;
+    unsigned long stolen;
+};
+
+static struct Batch* batch;
+static int batches;
+static size_t maxReadings;
+static struct Worker worker[MAX_JOBS];
+static int jobs;
+static long sets;               // Parameter sets to try
+static long randomSets = 0;     // 0 for the whole grid
+static uint64_t seed = 1;
+static volatile long done = 0;
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static long steps(const struct Range* r) {
+    return (r->hi - r->lo) / r->step + 1;
+}
+
+/************************************
+ * Description:
+ * Finds the parameters of set number index: a point of the grid, or with -r a random
+ * point of it that depends only on the seed and the index
+ ************************************/
+static void decode(long index, long p[PARAMS]) {
+    uint64_t x = (uint64_t)index;
+    for (int i = 0; i < PARAMS; i++) {
+        long k = steps(&range[i]);
+        long pick;
+        if (randomSets) {
+            x = splitmix64(seed ^ x);
+            pick = (long)(x % (uint64_t)k);
+        } else {
+            pick = index % k;
+            index /= k;
+        }
+        p[i] = range[i].lo + pick * range[i].step;
+    }
+}
+
+/************************************
+ * Description:
+ * HSV_Distance() for one centre. Matches the firmware exactly while the weights stay
+ * at 4096 or less
+ ************************************/
+static inline uint32_t distance(uint8_t cH, uint8_t cS, uint8_t cV, uint32_t wH, uint32_t wS, uint32_t wV,
+                                uint8_t H, uint8_t S, uint8_t V) {
+    uint32_t dH = (uint8_t)(cH - H);
+    dH = dH > 128 ? 256 - dH : dH;
+    uint32_t dS = cS > S ? (uint32_t)(cS - S) : (uint32_t)(S - cS);
+    uint32_t dV = cV > V ? (uint32_t)(cV - V) : (uint32_t)(V - cV);
+    uint32_t d = (dH * dH * wH + dS * dS * wS + dV * dV * wV) >> 12;
+    return d > 65535 ? 65535 : d;
+}
+
+/************************************
+ * Description:
+ * setSpread() and the acceptance radius from calibrateKMean() for one parameter set
+ ************************************/
+static void spreads(const struct Batch* b, const long p[PARAMS], struct HSVSpread spread[8]) {
+    for (int c = 0; c < 8; c++) {
+        struct HSVSpread* s = &spread[c];
+        unsigned int vH = b->calibrated[c] ? b->var[c][0] : 0;
+        unsigned int vS = b->calibrated[c] ? b->var[c][1] : 0;
+        unsigned int vV = b->calibrated[c] ? b->var[c][2] : 0;
+        s->varH = vH > p[P_VAR_MIN_H] ? vH : (unsigned int)p[P_VAR_MIN_H];
+        s->varS = vS > p[P_VAR_MIN_S] ? vS : (unsigned int)p[P_VAR_MIN_S];
+        s->varV = vV > p[P_VAR_MIN_V] ? vV : (unsigned int)p[P_VAR_MIN_V];
+        s->wH = (unsigned int)(16384UL / s->varH);
+        s->wS = (unsigned int)(16384UL / s->varS);
+        s->wV = (unsigned int)(16384UL / s->varV);
+        if (!b->calibrated[c]) {
+            s->threshold = (unsigned int)(c == 7 ? p[P_THRESHOLD_BLUE] : p[P_THRESHOLD_DEFAULT]);
+            continue;
+        }
+        unsigned int maxDist = 0;
+        const struct HSV* ctr = &b->centres[c];
+        for (int n = 0; n < CALIB_SAMPLES; n++) {
+            const struct HSV* x = &b->calib[c][n];
+            unsigned int d = distance(ctr->H, ctr->S, ctr->V, s->wH, s->wS, s->wV, x->H, x->S, x->V);
+            maxDist = d > maxDist ? d : maxDist;
+        }
+        maxDist = maxDist < p[P_THRESHOLD_MAX] / 2 ? maxDist * 2 : (unsigned int)p[P_THRESHOLD_MAX];
+        s->threshold = maxDist > p[P_THRESHOLD_MIN] ? maxDist : (unsigned int)p[P_THRESHOLD_MIN];
+    }
+}
+
+/************************************
+ * Description:
+ * segment() for every reading of a batch. Each centre is a pass over all readings that
+ * keeps the nearest centre so far, then a last pass applies the black, proximity, blue
+ * and white rules
+ ************************************/
+static void segment_batch(const struct Batch* b, const struct HSVSpread spread[8], uint8_t minS, uint8_t minV,
+                          uint8_t whiteMinV, struct Worker* w) {
+    size_t n = b->n;
+    const uint8_t* restrict H = b->H;
+    const uint8_t* restrict S = b->S;
+    const uint8_t* restrict V = b->V;
+    uint32_t* restrict dist = w->dist;
+    uint32_t* restrict blue = w->blue;
+    uint8_t* restrict best = w->best;
+    uint8_t* restrict seg = w->seg;
+
+    for (size_t i = 0; i < n; i++) {
+        dist[i] = 65535;
+        best[i] = 0;
+    }
+    for (int c = 0; c < 8; c++) {
+        const uint8_t cH = b->centres[c].H, cS = b->centres[c].S, cV = b->centres[c].V;
+        const uint32_t wH = spread[c].wH, wS = spread[c].wS, wV = spread[c].wV;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t d = distance(cH, cS, cV, wH, wS, wV, H[i], S[i], V[i]);
+            uint32_t nearer = d < dist[i];
+            dist[i] = nearer ? d : dist[i];
+            best[i] = nearer ? (uint8_t)c : best[i];
+            if (c == 7) {
+                blue[i] = d;
+            }
+        }
+    }
+
+    const unsigned int proximity1 = ((minS * minS) >> 2) + ((minV * minV) >> 2) + 100;
+    const unsigned int proximity2 = proximity1 + 400;
+    const uint32_t blueThreshold = spread[7].threshold;
+    for (size_t i = 0; i < n; i++) {
+        unsigned int proximity = ((S[i] * S[i]) >> 2) + ((V[i] * V[i]) >> 2);
+        uint8_t out = proximity < proximity1 ? 0 : (proximity < proximity2 ? 1 : 2);
+        out = blue[i] < blueThreshold ? 10 : out;
+        if (V[i] > minV) {
+            if (S[i] > minS) {
+                out = dist[i] < spread[best[i]].threshold ? best[i] + 3 : out;
+            } else if (V[i] > whiteMinV) {
+                out = 3;
+            }
+        }
+        seg[i] = out;
+    }
+}
+
+/************************************
+ * Description:
+ * The senseColour() vote over a batch, scoring each labelled reading
+ ************************************/
+static void vote_batch(const struct Batch* b, const uint8_t* seg, unsigned int cap, struct Score* score,
+                       uint8_t* outs) {
+    uint8_t tally[11] = { 0 };
+    tally[0] = (uint8_t)cap;
+    for (size_t i = 0; i < b->n; i++) {
+        if (b->reset[i]) {
+            memset(tally, 0, sizeof(tally));
+            tally[0] = (uint8_t)cap;
+        }
+        if (tally[seg[i]] < cap) {
+            tally[seg[i]] += 2;
+        }
+        for (int c = 0; c < 11; c++) {
+            tally[c] -= tally[c] > 0;
+        }
+        uint8_t out = 0, max = tally[0];
+        for (int c = 0; c < 11; c++) {
+            if (tally[c] > max) {
+                max = tally[c];
+                out = (uint8_t)c;
+            }
+        }
+        if (outs) {
+            outs[i] = out;
+        }
+        uint8_t truth = b->label[i];
+        if (truth == TRACE_LABEL_UNKNOWN) {
+            continue;
+        }
+        if (out == truth || (out < 3 && truth < 3)) {
+            score->right++;
+        } else if (out >= 3) {
+            score->wrong++;
+        } else {
+            score->missed++;
+        }
+    }
+    score->cost = score->wrong * WRONG_COST + score->missed;
+}
+
+static void evaluate(const long p[PARAMS], struct Worker* w, struct Score* total) {
+    memset(total, 0, sizeof(*total));
+    for (int t = 0; t < batches; t++) {
+        const struct Batch* b = &batch[t];
+        struct HSVSpread spread[8];
+        struct Score s = { 0, 0, 0, 0 };
+        spreads(b, p, spread);
+        uint8_t minS = (uint8_t)(b->clearS < 250 - p[P_CLEAR_MARGIN] ? b->clearS + p[P_CLEAR_MARGIN] : 250);
+        uint8_t minV = (uint8_t)(b->clearV < 250 - p[P_CLEAR_MARGIN] ? b->clearV + p[P_CLEAR_MARGIN] : 250);
+        segment_batch(b, spread, minS, minV, (uint8_t)p[P_WHITE_MIN_V], w);
+        vote_batch(b, w->seg, (unsigned int)p[P_VOTE_CAP], &s, NULL);
+        total->right += s.right;
+        total->wrong += s.wrong;
+        total->missed += s.missed;
+    }
+    total->cost = total->wrong * WRONG_COST + total->missed;
+}
+
+/************************************
+ * Description:
+ * Lays a trace out for the kernel, and works out each class's centre and variance from
+ * its K-Mean samples as calibrateKMean() did
+ ************************************/
+static void prepare(const struct Trace* t, struct Batch* b) {
+    memset(b, 0, sizeof(*b));
+    b->H = malloc(t->count + 1);
+    b->S = malloc(t->count + 1);
+    b->V = malloc(t->count + 1);
+    b->label = malloc(t->count + 1);
+    b->reset = calloc(t->count + 1, 1);
+    memcpy(b->centres, t->centres, sizeof(b->centres));
+    b->clearS = t->minS >= CLEAR_MARGIN ? (uint8_t)(t->minS - CLEAR_MARGIN) : 0;
+    b->clearV = t->minV >= CLEAR_MARGIN ? (uint8_t)(t->minV - CLEAR_MARGIN) : 0;
+
+    int count[8] = { 0 };
+    uint8_t pendingReset = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        const struct Event* e = &t->events[i];
+        if (e->type == TRACE_RESET) {
+            pendingReset = 1;
+            continue;
+        }
+        struct HSV hsv = trace_file_hsv(t, e);
+        if (!(e->flags & TRACE_FLAG_VOTE)) {
+            if (e->label == 0) {  // calibrateClear() keeps the last reading before the button
+                b->clearS = hsv.S;
+                b->clearV = hsv.V;
+            } else if (e->label >= 3 && e->label < 11) {
+                int c = e->label - 3;
+                b->calib[c][count[c] % CALIB_SAMPLES] = hsv;
+                count[c]++;
+            }
+            continue;
+        }
+        b->H[b->n] = hsv.H;
+        b->S[b->n] = hsv.S;
+        b->V[b->n] = hsv.V;
+        b->label[b->n] = e->label;
+        b->reset[b->n] = pendingReset;
+        pendingReset = 0;
+        b->n++;
+    }
+
+    for (int c = 0; c < 8; c++) {
+        if (count[c] < CALIB_SAMPLES) {
+            continue;  // Left at its default
+        }
+        // Put the last CALIB_SAMPLES back in order, then average as calibrateKMean() does
+        struct HSV s[CALIB_SAMPLES];
+        for (int n = 0; n < CALIB_SAMPLES; n++) {
+            s[n] = b->calib[c][(count[c] + n) % CALIB_SAMPLES];
+        }
+        memcpy(b->calib[c], s, sizeof(s));
+        int sumH = 0;
+        unsigned int sumS = 0, sumV = 0;
+        for (int n = 0; n < CALIB_SAMPLES; n++) {
+            sumH += (signed char)(s[n].H - s[0].H);
+            sumS += s[n].S;
+            sumV += s[n].V;
+        }
+        struct HSV m;
+        m.H = (unsigned char)(s[0].H + sumH / CALIB_SAMPLES);
+        m.S = (unsigned char)(sumS / CALIB_SAMPLES);
+        m.V = (unsigned char)(sumV / CALIB_SAMPLES);
+        unsigned long varH = 0, varS = 0, varV = 0;
+        for (int n = 0; n < CALIB_SAMPLES; n++) {
+            int dH = (signed char)(s[n].H - m.H);
+            int dS = (int)s[n].S - m.S;
+            int dV = (int)s[n].V - m.V;
+            varH += (unsigned long)((long)dH * dH);
+            varS += (unsigned long)((long)dS * dS);
+            varV += (unsigned long)((long)dV * dV);
+        }
+        b->centres[c] = m;
+        b->var[c][0] = (unsigned int)(varH / CALIB_SAMPLES);
+        b->var[c][1] = (unsigned int)(varS / CALIB_SAMPLES);
+        b->var[c][2] = (unsigned int)(varV / CALIB_SAMPLES);
+        b->calibrated[c] = 1;
+    }
+    maxReadings = b->n > maxReadings ? b->n : maxReadings;
+}
+
+/************************************
+ * Description:
+ * Checks, with the default parameters, that the recalibration reproduces the calibration
+ * recorded in the trace, and that the kernel and vote agree with segment() and
+ * voteColour() reading by reading
+ * Outputs:
+ * The number of disagreements
+ ************************************/
+static unsigned long check_parity(const struct Trace* t, const struct Batch* b, struct Worker* w) {
+    long p[PARAMS];
+    struct HSVSpread spread[8];
+    unsigned long bad = 0;
+    for (int i = 0; i < PARAMS; i++) {
+        p[i] = range[i].def;
+    }
+    spreads(b, p, spread);
+    for (int c = 0; c < 8; c++) {
+        if (b->calibrated[c] && (b->centres[c].H != t->centres[c].H || b->centres[c].S != t->centres[c].S ||
+                                 b->centres[c].V != t->centres[c].V || spread[c].threshold != t->spread[c].threshold ||
+                                 spread[c].wH != t->spread[c].wH || spread[c].wS != t->spread[c].wS ||
+                                 spread[c].wV != t->spread[c].wV)) {
+            fprintf(stderr, "%s: recalibrated class %d differs from the recorded calibration\n", t->path, c);
+            bad++;
+        }
+    }
+
+    // The kernel against the firmware, both with the recorded calibration
+    struct Batch recorded = *b;
+    memcpy(recorded.centres, t->centres, sizeof(recorded.centres));
+    uint8_t* outs = malloc(b->n + 1);
+    struct Score s = { 0, 0, 0, 0 };
+    segment_batch(&recorded, t->spread, t->minS, t->minV, WHITE_MIN_V, w);
+    vote_batch(&recorded, w->seg, VOTE_CAP, &s, outs);
+    struct HSV centres[8];
+    struct HSVSpread firmwareSpread[8];
+    memcpy(centres, t->centres, sizeof(centres));
+    memcpy(firmwareSpread, t->spread, sizeof(firmwareSpread));
+    resetColourAveraging();
+    for (size_t i = 0; i < b->n; i++) {
+        struct HSV hsv = { b->H[i], b->S[i], b->V[i] };
+        if (b->reset[i]) {
+            resetColourAveraging();
+        }
+        unsigned char seg = segment(centres, firmwareSpread, t->minS, t->minV, hsv);
+        unsigned char out = voteColour(seg);
+        if (seg != w->seg[i] || out != outs[i]) {
+            if (bad < 10) {
+                fprintf(stderr, "%s: reading %zu: firmware %u/%u, kernel %u/%u\n", t->path, i, seg, out,
+                        w->seg[i], outs[i]);
+            }
+            bad++;
+        }
+    }
+    free(outs);
+    return bad;
+}
+
+static int pop_back(struct Deque* d, long* task) {
+    int got = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *task = d->task[--d->tail];
+        got = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return got;
+}
+
+static int steal_front(struct Deque* d, long* task) {
+    int got = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *task = d->task[d->head++];
+        got = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return got;
+}
+
+/************************************
+ * Description:
+ * Works through this thread's chunks, then steals from the others. No task makes new
+ * ones, so the thread is finished once every deque has been found empty
+ ************************************/
+static void* work(void* arg) {
+    struct Worker* w = arg;
+    uint64_t victimSeed = (uint64_t)w->id;
+    long task;
+    for (;;) {
+        if (!pop_back(&w->deque, &task)) {
+            int found = 0;
+            victimSeed = splitmix64(victimSeed);
+            int first = (int)(victimSeed % (uint64_t)jobs);
+            for (int k = 0; k < jobs && !found; k++) {
+                int v = (first + k) % jobs;
+                found = v != w->id && steal_front(&worker[v].deque, &task);
+            }
+            if (!found) {
+                break;
+            }
+            w->stolen++;
+        }
+        long end = (task + 1) * CHUNK < sets ? (task + 1) * CHUNK : sets;
+        for (long index = task * CHUNK; index < end; index++) {
+            long p[PARAMS];
+            struct Score s;
+            decode(index, p);
+            evaluate(p, w, &s);
+            if (w->bestIndex < 0 || s.cost < w->bestScore.cost) {
+                w->bestScore = s;
+                w->bestIndex = index;
+            }
+        }
+        __atomic_add_fetch(&done, end - task * CHUNK, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void alloc_scratch(struct Worker* w) {
+    w->dist = malloc((maxReadings + 1) * sizeof(*w->dist));
+    w->blue = malloc((maxReadings + 1) * sizeof(*w->blue));
+    w->best = malloc(maxReadings + 1);
+    w->seg = malloc(maxReadings + 1);
+    w->bestIndex = -1;
+}
+
+static void write_header(const char* path, const long p[PARAMS], const struct Score* s, const struct Score* base) {
+    FILE* f = fopen(path, "w");
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "/*\n * File:   %s\n * Generated by host/sweep from %d traces\n */\n\n", name, batches);
+    fprintf(f, "// Vote readings: %lu right, %lu wrong cards, %lu cards not shown (defaults: %lu, %lu, %lu).\n",
+            s->right, s->wrong, s->missed, base->right, base->wrong, base->missed);
+    fprintf(f, "// Build with COLOR_PARAMS=\"\\\"%s\\\"\" defined to use these\n", name);
+    fprintf(f, "#ifndef _color_params_H\n#define _color_params_H\n\n");
+    for (int i = 0; i < PARAMS; i++) {
+        fprintf(f, "#define %-18s %ld\n", range[i].name, p[i]);
+    }
+    fprintf(f, "\n#endif\n");
+    fclose(f);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-j threads] [-r random_sets] [-s seed] [-p NAME=lo:hi:step]... [-o header]\n"
+                    "          trace.rgbc...\n", name);
+    exit(2);
+}
+
+static void set_range(const char* arg) {
+    char name[32];
+    long lo, hi, step = 1;
+    int n = sscanf(arg, "%31[A-Z_]=%ld:%ld:%ld", name, &lo, &hi, &step);
+    if (n == 2) {
+        hi = lo;
+    }
+    for (int i = 0; n >= 2 && i < PARAMS; i++) {
+        if (!strcmp(name, range[i].name)) {
+            if (hi < lo || step < 1 || (i <= P_VAR_MIN_V && lo < 4)) {
+                break;
+            }
+            range[i].lo = lo;
+            range[i].hi = hi;
+            range[i].step = step;
+            return;
+        }
+    }
+    fprintf(stderr, "bad range %s: expected NAME=lo[:hi[:step]] for a parameter above, with variance floors of 4 or more\n", arg);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* header = NULL;
+    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    batch = calloc((size_t)argc, sizeof(*batch));
+    struct Trace* traces = calloc((size_t)argc, sizeof(*traces));
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (a[0] == '-') {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            const char* v = argv[++i];
+            if (!strcmp(a, "-j")) jobs = atoi(v);
+            else if (!strcmp(a, "-r")) randomSets = atol(v);
+            else if (!strcmp(a, "-s")) seed = strtoull(v, NULL, 0);
+            else if (!strcmp(a, "-p")) set_range(v);
+            else if (!strcmp(a, "-o")) header = v;
+            else usage(argv[0]);
+            continue;
+        }
+        struct Trace* t = &traces[batches];
+        if (trace_file_load(a, t)) {
+            return 1;
+        }
+        if (!t->calibrated) {
+            fprintf(stderr, "%s: no calibration record, skipped\n", a);
+            trace_file_free(t);
+            continue;
+        }
+        prepare(t, &batch[batches++]);
+    }
+    if (!batches) {
+        usage(argv[0]);
+    }
+    jobs = jobs < 1 ? 1 : (jobs > MAX_JOBS ? MAX_JOBS : jobs);
+    for (int i = 0; i < jobs; i++) {
+        alloc_scratch(&worker[i]);
+    }
+
+    size_t readings = 0;
+    unsigned long bad = 0;
+    for (int t = 0; t < batches; t++) {
+        readings += batch[t].n;
+        bad += check_parity(&traces[t], &batch[t], &worker[0]);
+        trace_file_free(&traces[t]);
+    }
+    printf("%d traces, %zu vote readings. Parity with the firmware: %s (%lu differences)\n", batches, readings,
+           bad ? "FAILED" : "ok", bad);
+    if (bad) {
+        return 1;
+    }
+
+    long def[PARAMS];
+    struct Score base;
+    for (int i = 0; i < PARAMS; i++) {
+        def[i] = range[i].def;
+    }
+    evaluate(def, &worker[0], &base);
+
+    sets = 1;
+    for (int i = 0; i < PARAMS; i++) {
+        sets *= steps(&range[i]);
+    }
+    if (randomSets) {
+        sets = randomSets;
+    }
+    long chunks = (sets + CHUNK - 1) / CHUNK;
+    for (int i = 0; i < jobs; i++) {
+        struct Deque* d = &worker[i].deque;
+        pthread_mutex_init(&d->lock, NULL);
+        d->task = malloc((size_t)(chunks / jobs + 1) * sizeof(*d->task));
+        d->head = d->tail = 0;
+        worker[i].id = i;
+    }
+    for (long c = 0; c < chunks; c++) {
+        struct Deque* d = &worker[c % jobs].deque;
+        d->task[d->tail++] = c;
+    }
+
+    printf("%ld %s parameter sets on %d threads\n", sets, randomSets ? "random" : "grid", jobs);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < jobs; i++) {
+        pthread_create(&worker[i].thread, NULL, work, &worker[i]);
+    }
+    fflush(stdout);
+    int progress = isatty(2);
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) < sets) {
+        usleep(100000);
+        if (progress) {
+            fprintf(stderr, "\r%5.1f%%", 100.0 * __atomic_load_n(&done, __ATOMIC_RELAXED) / sets);
+        }
+    }
+    if (progress) {
+        fprintf(stderr, "\r      \r");
+    }
+    long bestIndex = -1;
+    struct Score best = { 0, 0, 0, 0 };
+    unsigned long stolen = 0;
+    for (int i = 0; i < jobs; i++) {
+        struct Worker* w = &worker[i];
+        pthread_join(w->thread, NULL);
+        stolen += w->stolen;
+        if (w->bestIndex >= 0 && (bestIndex < 0 || w->bestScore.cost < best.cost ||
+                                  (w->bestScore.cost == best.cost && w->bestIndex < bestIndex))) {
+            best = w->bestScore;
+            bestIndex = w->bestIndex;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%.1f s, %.0f sets/s, %lu chunks stolen\n\n", seconds, sets / seconds, stolen);
+
+    long p[PARAMS];
+    if (best.cost >= base.cost) {
+        memcpy(p, def, sizeof(p));  // Nothing beat the defaults
+        best = base;
+    } else {
+        decode(bestIndex, p);
+    }
+    printf("%-18s %8s %8s\n", "parameter", "default", "best");
+    for (int i = 0; i < PARAMS; i++) {
+        printf("%-18s %8ld %8ld\n", range[i].name, def[i], p[i]);
+    }
+    printf("%-18s %8lu %8lu\n%-18s %8lu %8lu\n%-18s %8lu %8lu\n%-18s %8lu %8lu\n", "cost", base.cost, best.cost,
+           "right", base.right, best.right, "wrong cards", base.wrong, best.wrong, "not shown", base.missed,
+           best.missed);
+    if (header) {
+        write_header(header, p, &best, &base);
+        printf("\nWritten to %s\n", header);
+    }
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * File:   telemetry_decode.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Decodes the telemetry stream (see telemetry.h) into CSV on stdout, one row per frame.
+// Columns a frame does not have are left empty. The stream can be a serial device or pty,
+// which is set to raw 115200 baud, a capture such as a maze_sim trace, or stdin ("-").
+// A device is read until interrupted, a file to its end.
+//
+// Profile frames (profile.h) are printed on stderr as a table rather than as rows, and the boot
+// frame, mission transitions (mission.h) and console replies (console.h) as lines. With -c, the
+// lines read from stdin are sent to the device as console commands.
+//
+// Frames that fail their CRC are skipped. At the end, the frames seen of each type, the CRC
+// failures, the frames lost (gaps in the sequence numbers) and the time spent in each mission
+// state are reported on stderr.
+//
+// Usage: telemetry_decode [device | file | -]
+//        telemetry_decode -c device
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../hal.h"
+#include "../trace.h"
+#include "../telemetry.h"
+#include "../profile.h"
+#include "../console.h"
+#include "../mission.h"
+#include "../timers.h"
+
+#define BUFFER_SIZE 4096
+
+static unsigned long frames[256];
+static unsigned long badFrames, lostFrames;
+static int expected = -1;   // Next sequence number, -1 until the first frame
+static unsigned long stateMs[MISSION_STATES];
+static const char* stateNames[MISSION_STATES] = MISSION_STATE_NAMES;
+static const char* eventNames[MISSION_EVENTS] = MISSION_EVENT_NAMES;
+
+static unsigned int word(const unsigned char* p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+/************************************
+ * Description:
+ * Prints a frame as a CSV row, after counting any frames lost before it
+ ************************************/
+static void print_frame(unsigned char type, unsigned char length, unsigned char seq, const unsigned char* p) {
+    if (type == TRACE_START) {
+        expected = -1;  // The firmware has restarted
+    }
+    if (expected >= 0) {
+        lostFrames += (unsigned char)(seq - expected);
+    }
+    expected = (unsigned char)(seq + 1);
+    frames[type]++;
+
+    // seq,type,tick,c,r,g,b,again,atime,motion,label,flags,segment,vote,h,s,v,power,move,state,
+    // delta_time,recorded_time,battery_mv,battery_slow_mv,stall
+    if (type == TRACE_SAMPLE && length == TRACE_SAMPLE_LEN) {
+        printf("%u,R,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,,,,,,,,,,,,,\n", seq, word(p), word(p + 2), word(p + 4),
+               word(p + 6), word(p + 8), p[10], p[11], p[12], p[13], p[14]);
+    } else if (type == TRACE_RESET && length == TRACE_RESET_LEN) {
+        printf("%u,Z,%u,,,,,,,,,,,,,,,,,,,,,,\n", seq, word(p));
+    } else if (type == TELEMETRY_CLASSIFY && length == TELEMETRY_CLASSIFY_LEN) {
+        printf("%u,C,%u,,,,,,,,,,%u,%u,%u,%u,%u,,,,,,,,\n", seq, word(p), p[2], p[3], p[4], p[5], p[6]);
+    } else if (type == TELEMETRY_MOTION && length == TELEMETRY_MOTION_LEN) {
+        printf("%u,M,%u,,,,,,,%u,,,,,,,,%u,,,,,,,\n", seq, word(p), p[2], p[3]);
+    } else if (type == TELEMETRY_SEGMENT && length == TELEMETRY_SEGMENT_LEN) {
+        printf("%u,T,%u,,,,,,,,,,,,,,,,%u,%u,%u,%u,,,\n", seq, word(p), p[2], p[3], word(p + 4), word(p + 6));
+    } else if (type == TELEMETRY_BATTERY && length == TELEMETRY_BATTERY_LEN) {
+        printf("%u,B,%u,,,,,,,,,,,,,,,,,,,,%u,%u,%u\n", seq, word(p), word(p + 2), word(p + 4), p[6]);
+    } else if (type == TELEMETRY_PROFILE && length == TELEMETRY_PROFILE_LEN) {
+        if (frames[type] == 1) {
+            fprintf(stderr, "%-8s %8s %8s %8s %8s  (us)\n", "section", "calls", "min", "mean", "max");
+        }
+        fprintf(stderr, "%-8.8s %8u %8u %8u %8u\n", (const char*)p + 1, word(p + 9), word(p + 11), word(p + 13),
+                word(p + 15));
+    } else if (type == TELEMETRY_BOOT && length == TELEMETRY_BOOT_LEN) {
+        fprintf(stderr, "boot: ready %u ms, calibrated %u ms, moving %u ms (%s calibration)\n", word(p), word(p + 2),
+                word(p + 4), p[6] ? "saved" : "new");
+    } else if (type == TELEMETRY_MISSION && length == TELEMETRY_MISSION_LEN) {
+        if (p[2] < MISSION_STATES && p[3] < MISSION_EVENTS && p[4] < MISSION_STATES) {
+            stateMs[p[2]] += (unsigned long)word(p + 5) * TICK_MS;
+            fprintf(stderr, "mission: %s -> %s on %s after %u ms\n", stateNames[p[2]], stateNames[p[4]],
+                    eventNames[p[3]], word(p + 5) * TICK_MS);
+        }
+    } else if (type == TELEMETRY_CONSOLE) {
+        fprintf(stderr, "> %.*s\n", length, (const char*)p);
+    } else if (type == TRACE_START || type == TRACE_CALIBRATION) {
+        printf("%u,%c,,,,,,,,,,,,,,,,,,,,,,,\n", seq, type);  // Marks a restart or a new calibration
+    }
+}
+
+/************************************
+ * Description:
+ * Decodes the complete frames in a buffer
+ * Outputs:
+ * How many bytes were used. The rest start a frame that has not all arrived
+ ************************************/
+static size_t decode(const unsigned char* data, size_t size) {
+    size_t i = 0;
+    while (i + TELEMETRY_OVERHEAD <= size) {
+        unsigned char length = data[i + 2];
+        if (data[i] != TELEMETRY_SYNC) {
+            i++;
+            continue;
+        }
+        if (i + TELEMETRY_OVERHEAD + length > size) {
+            break;
+        }
+        unsigned int crc = 0xFFFF;
+        for (size_t k = i + 1; k < i + 4 + length; k++) {
+            crc = telemetry_crc(crc, data[k]);
+        }
+        if (crc != word(data + i + 4 + length)) {
+            badFrames++;
+            i++;
+            continue;
+        }
+        print_frame(data[i + 1], length, data[i + 3], data + i + 4);
+        i += TELEMETRY_OVERHEAD + length;
+    }
+    return i;
+}
+
+/************************************
+ * Description:
+ * Sends what has arrived on stdin to the device, as console commands
+ * Outputs:
+ * 0 once stdin has ended
+ ************************************/
+static int send_commands(int fd) {
+    char text[256];
+    ssize_t got = read(0, text, sizeof(text));
+    if (got <= 0) {
+        return 0;
+    }
+    if (write(fd, text, (size_t)got) != got) {
+        perror("console");
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    int console = argc == 3 && !strcmp(argv[1], "-c");
+    if ((argc > 2 && !console) || (argc == 2 && argv[1][0] == '-' && argv[1][1]) || (console && !strcmp(argv[2], "-"))) {
+        fprintf(stderr, "usage: %s [device | file | -]\n       %s -c device\n", argv[0], argv[0]);
+        return 2;
+    }
+    int fd = 0;
+    const char* path = argv[argc - 1];
+    if (argc >= 2 && strcmp(path, "-")) {
+        fd = open(path, (console ? O_RDWR : O_RDONLY) | O_NOCTTY);
+        if (fd < 0) {
+            perror(path);
+            return 1;
+        }
+    }
+    struct termios tio;
+    if (isatty(fd) && !tcgetattr(fd, &tio)) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+        setvbuf(stdout, NULL, _IOLBF, 0);  // Show frames as they arrive
+    }
+
+    printf("seq,type,tick,c,r,g,b,again,atime,motion,label,flags,segment,vote,h,s,v,power,move,state,"
+           "delta_time,recorded_time,battery_mv,battery_slow_mv,stall\n");
+    static unsigned char buffer[BUFFER_SIZE];
+    size_t held = 0;
+    ssize_t got;
+    struct pollfd wait[2] = { { fd, POLLIN, 0 }, { 0, POLLIN, 0 } };
+    while (1) {
+        if (console) {
+            poll(wait, 2, -1);
+            if ((wait[1].revents & (POLLIN | POLLHUP)) && !send_commands(fd)) {
+                wait[1].fd = -1;  // stdin has ended: carry on reading the replies
+            }
+            if (!(wait[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+        }
+        if ((got = read(fd, buffer + held, BUFFER_SIZE - held)) <= 0) {
+            break;
+        }
+        held += (size_t)got;
+        size_t used = decode(buffer, held);
+        if (used == 0 && held == BUFFER_SIZE) {
+            used = 1;  // Cannot happen with frames of at most 261 bytes, but never stall
+        }
+        memmove(buffer, buffer + used, held - used);
+        held -= used;
+    }
+
+    unsigned long total = 0;
+    fprintf(stderr, "frames:");
+    for (int type = 0; type < 256; type++) {
+        if (frames[type]) {
+            fprintf(stderr, " %c %lu", type, frames[type]);
+            total += frames[type];
+        }
+    }
+    fprintf(stderr, "\n%lu frames, %lu failed their CRC, %lu lost\n", total, badFrames, lostFrames);
+    if (frames[TELEMETRY_MISSION]) {
+        fprintf(stderr, "ms in each state:");
+        for (int state = 0; state < MISSION_STATES; state++) {
+            fprintf(stderr, " %s %lu", stateNames[state], stateMs[state]);
+        }
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
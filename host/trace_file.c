@@ -0,0 +1,126 @@
+/*
+ * File:   trace_file.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../hal.h"
+#include "../trace.h"
+#include "../telemetry.h"
+#include "trace_file.h"
+
+static unsigned int word(const unsigned char* p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+/************************************
+ * Description:
+ * Reads a trace file into memory. The trace records are picked out of the telemetry
+ * frames (see telemetry.h); other frames, frames that fail their CRC and bytes between
+ * frames are skipped, so a capture from the middle of a run still loads
+ * Outputs:
+ * 0 on success, 1 if the file could not be read
+ ************************************/
+int trace_file_load(const char* path, struct Trace* t) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* data = malloc(size > 0 ? (size_t)size : 1);
+    if (size < 0 || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return 1;
+    }
+    fclose(f);
+
+    memset(t, 0, sizeof(*t));
+    t->path = path;
+    t->tickMs = 5;
+    t->events = calloc((size_t)size / (TELEMETRY_OVERHEAD + TRACE_RESET_LEN) + 1, sizeof(*t->events));
+    unsigned long badFrames = 0;
+    long i = 0;
+    while (i + TELEMETRY_OVERHEAD <= size) {
+        unsigned char length = data[i + 2];
+        if (data[i] != TELEMETRY_SYNC || i + TELEMETRY_OVERHEAD + length > size) {
+            i++;
+            continue;
+        }
+        unsigned int crc = 0xFFFF;
+        for (long k = i + 1; k < i + 4 + length; k++) {
+            crc = telemetry_crc(crc, data[k]);
+        }
+        if (crc != word(data + i + 4 + length)) {
+            badFrames++;
+            i++;
+            continue;
+        }
+        unsigned char type = data[i + 1];
+        const unsigned char* p = data + i + 4;
+        struct Event* e = &t->events[t->count];
+        i += TELEMETRY_OVERHEAD + length;
+        if (type == TRACE_START && length == TRACE_START_LEN) {
+            if (p[0] != TRACE_VERSION) {
+                fprintf(stderr, "%s: trace version %u, expected %u\n", path, p[0], TRACE_VERSION);
+            }
+            t->tickMs = p[1];
+        } else if (type == TRACE_CALIBRATION && length == TRACE_CALIBRATION_LEN) {
+            t->gain = p[0];
+            t->minS = p[1];
+            t->minV = p[2];
+            for (int c = 0; c < 8; c++) {
+                const unsigned char* q = p + 3 + 11 * c;
+                t->centres[c].H = q[0];
+                t->centres[c].S = q[1];
+                t->centres[c].V = q[2];
+                setSpread(&t->spread[c], word(q + 3), word(q + 5), word(q + 7), word(q + 9));
+            }
+            t->calibrated = 1;
+        } else if (type == TRACE_SAMPLE && length == TRACE_SAMPLE_LEN) {
+            e->type = TRACE_SAMPLE;
+            e->tick = word(p);
+            e->raw.C = word(p + 2);
+            e->raw.R = word(p + 4);
+            e->raw.G = word(p + 6);
+            e->raw.B = word(p + 8);
+            e->again = p[10] & 0x03;
+            e->atime = p[11] ? p[11] : 1;
+            e->motion = p[12] & 0x03;
+            e->label = p[13];
+            e->flags = p[14];
+            t->count++;
+        } else if (type == TRACE_RESET && length == TRACE_RESET_LEN) {
+            e->type = TRACE_RESET;
+            e->tick = word(p);
+            t->count++;
+        }
+    }
+    if (badFrames) {
+        fprintf(stderr, "%s: %lu frames failed their CRC\n", path, badFrames);
+    }
+    free(data);
+    return 0;
+}
+
+void trace_file_free(struct Trace* t) {
+    free(t->events);
+    t->events = NULL;
+    t->count = 0;
+}
+
+/************************************
+ * Description:
+ * Converts a sample to HSV as color_sample() and RgbToHsv() did on the buggy
+ ************************************/
+struct HSV trace_file_hsv(const struct Trace* t, const struct Event* e) {
+    return RgbToHsv(color_scale(color_normalise_with(e->raw, e->again, e->atime), t->gain));
+}
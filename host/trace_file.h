@@ -0,0 +1,37 @@
+/*
+ * File:   trace_file.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Loads the RGBC traces described in trace.h, for the host tools that replay them
+#ifndef _trace_file_H
+#define _trace_file_H
+
+#include <stddef.h>
+#include "../color.h"
+
+struct Event {
+    unsigned char type;         // TRACE_SAMPLE or TRACE_RESET
+    unsigned int tick;
+    struct RGBRaw raw;
+    unsigned char again, atime, motion, label, flags;
+};
+
+struct Trace {
+    const char* path;
+    unsigned char tickMs;
+    int calibrated;
+    unsigned char gain, minS, minV;
+    struct HSV centres[8];
+    struct HSVSpread spread[8];
+    struct Event* events;
+    size_t count;
+};
+
+int trace_file_load(const char* path, struct Trace* t);  // 0 on success
+void trace_file_free(struct Trace* t);
+struct HSV trace_file_hsv(const struct Trace* t, const struct Event* e);
+
+#endif
@@ -5,7 +5,7 @@
  * Created on February 23, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "i2c.h"
 
 void I2C_2_Master_Init(void) {
@@ -10,7 +10,7 @@
 #define _XTAL_FREQ 64000000 //note intrinsic _delay function is 62.5ns at 64,000,000Hz  
 #define _I2C_CLOCK 100000 //100kHz for I2C
 
-#include <xc.h>
+#include "hal.h"
 
 /********************************************//**
  *  Function to inialise I2C module and pins
@@ -5,65 +5,137 @@
  * Created on March 1, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "interrupts.h"
+#include "ADC.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "console.h"
 
 extern volatile unsigned char RED_BRIGHTNESS;
 extern volatile unsigned char GREEN_BRIGHTNESS;
 extern volatile unsigned char BLUE_BRIGHTNESS;
+extern volatile unsigned char LED_ENABLE;
+extern volatile unsigned char wallNear;
+extern volatile unsigned char brakeArmed;
+extern volatile unsigned char emergencyBrake;
 extern volatile unsigned int deltaTime;
 
-// Function to turn on interrupts
+volatile unsigned int tickCount = 0;  // Free-running count of TMR7 ticks (TICK_MS each)
+
+// Function to turn on interrupts. Timekeeping and the brake are high priority, so that the
+// LED PWM and telemetry interrupts (low priority) can never hold them up
 void Interrupts_init(void) {
 	// Turn on peripheral interrupts, the interrupt source, global interrupts
-    INTCONbits.PEIE = 1;    // Enable peripheral interrupts
+    INTCONbits.IPEN = 1;    // Two priority levels: HighISR() and LowISR()
     INTCONbits.INT0EDG = 1; // Explicitly set all interrupts to rising edge
 
-    PIE5bits.TMR1IE = 1;    // Enable interrupt source TMR1 (hardware timer 1)
-    IPR5bits.TMR1IP = 1;    // Set TMR1 interrupt to high priority
+    PIE5bits.TMR1IE = 1;    // Enable interrupt source TMR1 (red LED PWM)
+    IPR5bits.TMR1IP = 0;    // Set TMR1 interrupt to low priority
+    
+    PIE5bits.TMR3IE = 1;    // Enable interrupt source TMR3 (green LED PWM)
+    IPR5bits.TMR3IP = 0;    // Set TMR3 interrupt to low priority
+    
+    PIE5bits.TMR5IE = 1;    // Enable interrupt source TMR5 (blue LED PWM)
+    IPR5bits.TMR5IP = 0;    // Set TMR5 interrupt to low priority
     
-    PIE5bits.TMR3IE = 1;    // Enable interrupt source TMR1 (hardware timer 1)
-    IPR5bits.TMR3IP = 1;    // Set TMR1 interrupt to high priority
+    PIE5bits.TMR7IE = 1;    // Enable interrupt source TMR7 (movement timing tick)
+    IPR5bits.TMR7IP = 1;    // Set TMR7 interrupt to high priority
     
-    PIE5bits.TMR5IE = 1;    // Enable interrupt source TMR1 (hardware timer 1)
-    IPR5bits.TMR5IP = 1;    // Set TMR1 interrupt to high priority
+    INTCONbits.INT1EDG = 0; // Colour click INT line is active low
+    IPR0bits.INT1IP = 1;    // Set INT1 interrupt to high priority (enabled when armed)
     
-    INTCONbits.GIE = 1;     // Turn on interrupts globally
+    IPR4bits.TX4IP = 0;     // Telemetry transmitter at low priority (enabled while sending)
+    IPR4bits.RC4IP = 0;     // Console receiver at low priority (enabled by console_init())
+    
+    INTCONbits.GIEL = 1;    // Turn on low priority interrupts
+    INTCONbits.GIEH = 1;    // Turn on interrupts globally
 }
 
-// ISR for timers 1, 3, 5 and 7
+// ISR for the colour click INT line (the emergency brake) and the TMR7 movement tick
 void __interrupt(high_priority) HighISR() {
+    PROFILE_ISR_ENTER();
+
+    if (PIE0bits.INT1IE && PIR0bits.INT1IF) // ISR for INT1 (colour click approach or brake threshold)
+    {
+        PROFILE_BEGIN(PROF_ISR_INT1);
+        if (brakeArmed) // Collision imminent: hold both sides of both motors high (slow decay brake)
+        {
+            CCPR1H = T2PR;
+            CCPR2H = T2PR;
+            CCPR3H = T2PR;
+            CCPR4H = T2PR;
+            emergencyBrake = 1;
+            brakeArmed = 0;
+        }
+        wallNear = 1;
+        PIE0bits.INT1IE = 0;  // One shot until re-armed
+        PIR0bits.INT1IF = 0;
+        PROFILE_END(PROF_ISR_INT1);
+    }
+
+    if (PIR5bits.TMR7IF) // ISR for TMR7
+    { 	
+        PROFILE_LATENCY(PROF_LAT_TMR7, HAL_TMR7L, TMR7H, 4);  // Fosc/4 / 4
+        PROFILE_BEGIN(PROF_ISR_TMR7);
+        deltaTime++;
+        tickCount++;
+        ADC_backgroundTick();  // Battery sampling for stall detection
+        TMR7H = 0xB1;  // Reset to have 20000 counts before overflow
+        TMR7L = 0xE0;
+        PIR5bits.TMR7IF = 0;
+        PROFILE_END(PROF_ISR_TMR7);
+    }
+    PROFILE_ISR_EXIT();
+}
+
+// ISR for the LED PWM timers 1, 3 and 5, the telemetry transmitter and the console receiver
+void __interrupt(low_priority) LowISR() {
+    PROFILE_ISR_ENTER();
 
     if (PIR5bits.TMR1IF) // ISR for TMR1
     { 	
-        LATGbits.LATG0 = !LATGbits.LATG0;
+        PROFILE_LATENCY(PROF_LAT_TMR1, HAL_TMR1L, TMR1H, 16);  // Fosc/4
+        PROFILE_BEGIN(PROF_ISR_TMR1);
+        LATGbits.LATG0 = (LED_ENABLE & 0x01) ? !LATGbits.LATG0 : 0;  // Held off when masked out
         TMR1H = LATGbits.LATG0 ? ~RED_BRIGHTNESS : RED_BRIGHTNESS;    // A1        
         TMR1L = 0x00;
         PIR5bits.TMR1IF = 0;
+        PROFILE_END(PROF_ISR_TMR1);
     }
     
     if (PIR5bits.TMR3IF) // ISR for TMR3
     { 	
-        LATEbits.LATE7 = !LATEbits.LATE7;
+        PROFILE_LATENCY(PROF_LAT_TMR3, HAL_TMR3L, TMR3H, 16);
+        PROFILE_BEGIN(PROF_ISR_TMR3);
+        LATEbits.LATE7 = (LED_ENABLE & 0x02) ? !LATEbits.LATE7 : 0;
         TMR3H = LATEbits.LATE7 ? ~GREEN_BRIGHTNESS : GREEN_BRIGHTNESS;
         TMR3L = 0x00;
         PIR5bits.TMR3IF = 0;
+        PROFILE_END(PROF_ISR_TMR3);
     }
     
     if (PIR5bits.TMR5IF) // ISR for TMR5
     { 	
-        LATAbits.LATA3 = !LATAbits.LATA3;
+        PROFILE_LATENCY(PROF_LAT_TMR5, HAL_TMR5L, TMR5H, 16);
+        PROFILE_BEGIN(PROF_ISR_TMR5);
+        LATAbits.LATA3 = (LED_ENABLE & 0x04) ? !LATAbits.LATA3 : 0;
         TMR5H = LATAbits.LATA3 ? ~BLUE_BRIGHTNESS : BLUE_BRIGHTNESS;
         TMR5L = 0x00;
         PIR5bits.TMR5IF = 0;
+        PROFILE_END(PROF_ISR_TMR5);
     }
     
-    if (PIR5bits.TMR7IF) // ISR for TMR7
-    { 	
-        deltaTime++;
-        TMR5H = 0xB1;  // Reset to have 20000 counts before overflow
-        TMR5L = 0xE0;
-        PIR5bits.TMR7IF = 0;
+    if (PIE4bits.TX4IE && PIR4bits.TX4IF) // ISR for EUSART4 TX (telemetry ring buffer), cleared by the write
+    {
+        PROFILE_BEGIN(PROF_ISR_TX4);
+        telemetry_tx_isr();
+        PROFILE_END(PROF_ISR_TX4);
     }
+    
+    if (PIE4bits.RC4IE && PIR4bits.RC4IF) // ISR for EUSART4 RX (console), cleared by the read
+    {
+        console_rx_isr();
+    }
+    PROFILE_ISR_EXIT();
 }
-
@@ -9,9 +9,10 @@
 #define _interrupts_H
 #define _XTAL_FREQ 64000000
 
-#include <xc.h>
+#include "hal.h"
 
 void Interrupts_init(void);
 void __interrupt(high_priority) HighISR();
+void __interrupt(low_priority) LowISR();
 
 #endif
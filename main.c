@@ -17,7 +17,7 @@
 #pragma config CSWEN = OFF     // Clock switch is disabled
 #pragma config FCMEN = OFF     // Fail-Safe Clock Monitor is disabled
 
-#include <xc.h>
+#include "hal.h"
 #include <stdio.h>
 #include "ADC.h"
 #include "LCD.h"
@@ -27,34 +27,588 @@
 #include "utils.h"
 #include "i2c.h"
 #include "color.h"
+#include "approach.h"
+#include "surface.h"
+#include "manoeuvre.h"
+#include "mission.h"
+#include "profile.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "console.h"
 
 volatile unsigned int deltaTime;
+extern volatile unsigned char wallNear;
+extern volatile unsigned int tickCount;
+extern volatile unsigned char brakeArmed;
+extern volatile unsigned char emergencyBrake;
+extern volatile unsigned char stallDetected;
+extern unsigned char motorDeadPeriods;
 
 
 // Defines
 #define MOVES_ARRAY_SIZE 80
-#define SPEED 6
+#define STALL_LOG_SIZE 8
 
-#define LOW_POWER 3*SPEED
-#define MED_POWER (unsigned char)(3.5*SPEED)
-#define HIGH_POWER 4*SPEED
+#define LOST_TIME (8000 / TICK_MS)      // Ticks of black-only driving before the buggy is lost
+#define LOST_BUDGET (20000 / TICK_MS)   // Ticks the search may take before giving up and returning home
+#define PROBE_TIME (3000 / TICK_MS)     // Ticks to drive down each searched heading
 
-#define BUTTONF2 !PORTFbits.RF2
-#define BUTTONF3 !PORTFbits.RF3
+#define LOW_POWER (3*speed)
+#define MED_POWER (unsigned char)(7*speed/2)
+#define HIGH_POWER (4*speed)
+
+#define BUTTONF2 !HAL_PIN_RF2
+#define BUTTONF3 !HAL_PIN_RF3
 
 struct action{
     unsigned char type;
     unsigned int time;
 };
 
+struct stallEvent{
+    unsigned int move;  // Index into moves[] of the segment that stalled
+    unsigned int time;  // deltaTime into that segment when the stall was detected
+};
+
+// Settings and calibration. The console (console.h) can read and change them while the buggy runs
+static unsigned char speed;  // Unit of LOW_POWER, MED_POWER and HIGH_POWER
+static unsigned int leftTurnTime90;  // These three come from the surface profile (surface.h)
+static unsigned int rightTurnTime90;
+static unsigned char gain = 5;
+static unsigned char minVal = 10;
+static unsigned char minSat = 10;
+static unsigned char trackDrift = 1;  // Follow slow lighting changes (updateColourDrift())
+static unsigned char spectralCheck = 0;  // 1 re-checks pink/white and blue/light blue under R, G and B light
+static unsigned char approachSteps = 1;  // HIGH/MED/LOW power steps on the approach, 0 for the continuous controller
+static struct HSV colourCentres[8];
+static struct HSVSpread colourSpread[8];
+
+static DC_motor motorL, motorR;
+static unsigned char running = 0;  // Set once the maze run has started
+
+// The maze run, shared by the mission's state handlers (mission.h)
+static struct action moves[MOVES_ARRAY_SIZE];
+static unsigned int moveCounter = 0;
+static struct stallEvent stalls[STALL_LOG_SIZE];
+static unsigned char stallCount = 0;
+static struct Approach approach;
+static unsigned char colourState = 0;   // The latest vote
+static unsigned char falseWakes = 0;    // Black votes in a row since the approach interrupt
+static unsigned char power;             // Forward power chosen by the approach controller
+static unsigned char lastPower;         // Power applied since the last pass
+static unsigned int lastDelta;          // deltaTime at the last pass
+static unsigned long powerTicks;        // Sum of power * ticks over the current segment
+static unsigned int blackSince;         // deltaTime when the vote was last something other than black
+static int returnIndex;                 // The move the return leg undoes next
+static unsigned char surfaceChanged = 0;    // A surface profile was chosen at power on
+static unsigned char savedCalibration = 0;
+static unsigned int readyTick, calibratedTick, movingTick;  // From reset to the end of each phase of start-up
+
+// Records a stall in the log, if there is room
+static void logStall(struct stallEvent* stalls, unsigned char* count, unsigned int move, unsigned int time){
+    if (*count < STALL_LOG_SIZE) {
+        stalls[*count].move = move;
+        stalls[*count].time = time;
+        (*count)++;
+    }
+}
+
+// Converts ticks to ms, saturating at 16 bits
+static unsigned int tickMs(unsigned int ticks){
+    return ticks < 65535 / TICK_MS ? ticks * TICK_MS : 65535;
+}
+
+// Copies a surface profile from flash into the settings, before calibration adjusts them
+static void useSurface(const struct Surface* surface){
+    for (unsigned char i = 0; i < 8; i++) {
+        colourCentres[i] = surface->centres[i];
+    }
+    initColourSpread(colourSpread, surface->thresholds);
+    leftTurnTime90 = surface->leftTurnTime90;
+    rightTurnTime90 = surface->rightTurnTime90;
+    speed = surface->speed;
+}
+
+/************************************
+ * Description:
+ * Recovers from driving on black for too long. The black segment is retraced to
+ * the position after the last card, and struck from the move history. Then the
+ * headings to the left and right are each probed for PROBE_TIME, returning to the
+ * same spot in between, until a card is seen or LOST_BUDGET runs out
+ * Inputs:
+ * The motors, move history and current move, turn times, colour calibration, and
+ * where to return the power * ticks already driven down the successful heading
+ * Outputs:
+ * 1 if a card was found, with the turn and probe recorded at moveCounter and
+ * moveCounter + 1. 0 if the buggy should return home
+ ************************************/
+static unsigned char lost(DC_motor *mL, DC_motor *mR, struct action *moves, unsigned int moveCounter,
+                          unsigned int leftTurnTime90, unsigned int rightTurnTime90,
+                          struct HSV *colourCentres, struct HSVSpread *colourSpread,
+                          unsigned char gain, unsigned char minS, unsigned char minV, unsigned long *powerTicks){
+    unsigned int start = tickCount;
+    unsigned char state = 0;
+    
+    LCD_sendstring("LOST            ", 0, 0);
+    stop(mL, mR);
+    color_disarm_approach();
+    color_disarm_brake();
+    emergencyBrake = 0;
+    
+    // Back to the last known card position
+    for(deltaTime = 0; deltaTime < moves[moveCounter].time && !stallDetected;){
+        reverse(mL, mR, HIGH_POWER);
+    }
+    stop(mL, mR);
+    moves[moveCounter].type = 3;  // Strike the wandering from the record
+    moves[moveCounter].time = 0;
+    
+    for(unsigned char heading = 0; heading < 2 && moveCounter + 1 < MOVES_ARRAY_SIZE; heading++){
+        if((unsigned int)(tickCount - start) >= LOST_BUDGET){
+            break;
+        }
+        manoeuvre_run(mL, mR, heading == 0 ? TURNED_LEFT_90 : TURNED_RIGHT_90, MANOEUVRE_DO,
+                      leftTurnTime90, rightTurnTime90);
+        
+        // Probe this heading slowly, classifying all the way
+        resetColourAveraging();
+        for(deltaTime = 0; deltaTime < PROBE_TIME && (unsigned int)(tickCount - start) < LOST_BUDGET && !stallDetected;){
+            state = senseColour(colourCentres, colourSpread, gain, minS, minV);
+            if(state >= 3){
+                break;
+            }
+            forward(mL, mR, LOW_POWER);
+        }
+        unsigned int probe = deltaTime;
+        stop(mL, mR);
+        
+        if(state >= 3){
+            moves[moveCounter].type = heading == 0 ? TURNED_LEFT_90 : TURNED_RIGHT_90;
+            moves[moveCounter].time = 0;
+            *powerTicks = (unsigned long)probe * LOW_POWER;
+            moves[moveCounter + 1].type = 0;
+            moves[moveCounter + 1].time = (unsigned int)(*powerTicks / HIGH_POWER);
+            return 1;
+        }
+        
+        // Nothing here: retrace the probe and face the original heading again
+        for(deltaTime = 0; deltaTime < probe && !stallDetected;){
+            reverse(mL, mR, LOW_POWER);
+        }
+        stop(mL, mR);
+        manoeuvre_run(mL, mR, heading == 0 ? TURNED_LEFT_90 : TURNED_RIGHT_90, MANOEUVRE_UNDO,
+                      leftTurnTime90, rightTurnTime90);
+    }
+    return 0;
+}
+
+#if CONSOLE_ENABLE
+
+// Each calibrated colour is NAME.h, NAME.s, NAME.v and NAME.thr (its acceptance threshold)
+#define COLOUR_PARAMS(colour, i) \
+    { colour ".h",   &colourCentres[i].H,        CONSOLE_NOTIFY, 0, 255 }, \
+    { colour ".s",   &colourCentres[i].S,        CONSOLE_NOTIFY, 0, 255 }, \
+    { colour ".v",   &colourCentres[i].V,        CONSOLE_NOTIFY, 0, 255 }, \
+    { colour ".thr", &colourSpread[i].threshold, CONSOLE_WORD | CONSOLE_NOTIFY, 0, 65535 }
+
+static const struct ConsoleParam consoleParams[] = {
+    { "turnl", &leftTurnTime90,  CONSOLE_WORD | CONSOLE_SAVED, 100, 3000 },  // ms per 90 degrees
+    { "turnr", &rightTurnTime90, CONSOLE_WORD | CONSOLE_SAVED, 100, 3000 },
+    { "speed", &speed,           CONSOLE_SAVED, 1, 25 },
+    { "gain",  &gain,            0, 0, 13 },   // Right shift of the raw counts
+    { "mins",  &minSat,          0, 0, 255 },
+    { "minv",  &minVal,          0, 0, 255 },
+    { "dead",  &motorDeadPeriods, 0, 0, 20 },  // PWM periods of dead time on a reversal under power
+    { "drift", &trackDrift,      CONSOLE_NOTIFY, 0, 1 },
+    { "spectral", &spectralCheck, CONSOLE_NOTIFY, 0, 1 },
+    { "steps", &approachSteps,   0, 0, 1 },
+    COLOUR_PARAMS("white", 0),
+    COLOUR_PARAMS("red", 1),
+    COLOUR_PARAMS("pink", 2),
+    COLOUR_PARAMS("orange", 3),
+    COLOUR_PARAMS("yellow", 4),
+    COLOUR_PARAMS("green", 5),
+    COLOUR_PARAMS("lblue", 6),
+    COLOUR_PARAMS("blue", 7)
+};
+
+// A colour centre, threshold or switch has been set: the centres become the calibrated values
+static void consoleChanged(void){
+    setColourDrift(trackDrift);
+    setSpectralConfirm(spectralCheck);
+    initColourDrift(colourCentres);
+    initColourTable(colourCentres, colourSpread);
+}
+
+/************************************
+ * Description:
+ * Carries out a console motion command, unless the maze run has started
+ * Inputs:
+ * CONSOLE_* and its argument: degrees for a turn, ticks for a straight
+ * Outputs:
+ * 1 once done, 0 if refused
+ ************************************/
+static unsigned char consoleMotion(unsigned char primitive, unsigned int arg){
+    if (running) {
+        return 0;
+    }
+    switch (primitive){
+        case CONSOLE_LEFT:
+            turnLeftDeg(&motorL, &motorR, leftTurnTime90, arg > 360 ? 360 : arg);
+            break;
+        case CONSOLE_RIGHT:
+            turnRightDeg(&motorL, &motorR, rightTurnTime90, arg > 360 ? 360 : arg);
+            break;
+        case CONSOLE_FORWARD:
+            for(deltaTime = 0; deltaTime < arg;){
+                forward(&motorL, &motorR, HIGH_POWER);
+            }
+            break;
+        case CONSOLE_REVERSE:
+            for(deltaTime = 0; deltaTime < arg;){
+                reverse(&motorL, &motorR, HIGH_POWER);
+            }
+            break;
+    }
+    stop(&motorL, &motorR);
+    return 1;
+}
+
+// Saves the calibration with the console's settings, unless the maze run has started
+static unsigned char consoleSave(void){
+    if (running) {
+        return 0;
+    }
+    saveCalibration(colourCentres, colourSpread, gain, minSat, minVal);
+    return 1;
+}
+
+static const struct ConsoleHooks consoleHooks = { consoleChanged, consoleMotion, consoleSave };
+
+#endif
+
+// Moves on to the next entry of the move history, staying within it
+static void nextMove(void){
+    moveCounter = moveCounter < (MOVES_ARRAY_SIZE - 1) ? (moveCounter + 1) : (MOVES_ARRAY_SIZE - 1);  // Keep within range
+}
+
+// Starts recording a driven segment at moves[moveCounter]
+static void startSegment(void){
+    moves[moveCounter].type = 0;
+    moves[moveCounter].time = 0;
+    deltaTime = 0;
+    lastDelta = 0;
+    blackSince = 0;
+    powerTicks = 0;
+    power = HIGH_POWER;
+    lastPower = HIGH_POWER;
+}
+
+// Sends the timing of moves[moveCounter], which has ended, and restarts the timer
+static void endMove(void){
+    telemetry_segment((unsigned char)moveCounter, moves[moveCounter].type, deltaTime, moves[moveCounter].time);
+    deltaTime = 0;
+}
+
+/************************************
+ * Description:
+ * Drives down the current segment for one pass: the power from the approach controller,
+ * the emergency brake and stall detection, and the segment's time at HIGH_POWER
+ * Outputs:
+ * MISSION_EV_LOST after LOST_TIME with only black, otherwise MISSION_EV_NONE
+ ************************************/
+static unsigned char drive(void){
+    PROFILE_BEGIN(PROF_APPROACH);
+    // The controller's power falls continuously from HIGH_POWER to LOW_POWER as the surface nears.
+    // It runs with either scheme, as the brake uses its estimate. The reading carries its own
+    // tick, so one seen on two passes is not taken for a stop
+    struct ColourSample latest = color_latest();
+    power = wallNear ? approachPower(&approach, latest.hsv.V, minVal, latest.tick, LOW_POWER, HIGH_POWER) : HIGH_POWER;
+    if (approachSteps) {
+        // The default: a power step for each proximity class. It takes the class of the latest
+        // reading, as the vote now starts from black at each wake
+        unsigned char nearness = wallNear ? segmentFast(colourCentres, colourSpread, minSat, minVal, latest.hsv) : 0;
+        power = nearness == 0 ? HIGH_POWER : (nearness == 1 ? MED_POWER : LOW_POWER);
+    }
+    if (wallNear && !emergencyBrake) {
+        // Keep the collision threshold ahead of the closing speed
+        unsigned int brakeAt = minVal + approachLevel(approachBrakeDistance(&approach));
+        if (brakeArmed) {
+            color_update_brake(brakeAt, gain);
+        } else {
+            color_arm_brake(brakeAt, gain);
+        }
+    }
+    if (stallDetected && !emergencyBrake) {
+        // Pushing against the card: stop, and stop counting time for this segment
+        emergencyBrake = 1;
+        logStall(stalls, &stallCount, moveCounter, deltaTime);
+    }
+    if (emergencyBrake) {
+        brake(&motorL, &motorR);  // Hold the brake until the card is read
+        power = 0;
+    } else {
+        forward(&motorL, &motorR, power);
+        if (emergencyBrake) {  // The interrupt fired while the power was being set
+            brake(&motorL, &motorR);
+            power = 0;
+        }
+    }
+    PROFILE_END(PROF_APPROACH);
+    
+    // The power varies, so record the time this segment would take at HIGH_POWER
+    powerTicks += (unsigned long)lastPower * (deltaTime - lastDelta);
+    lastDelta = deltaTime;
+    moves[moveCounter].time = (unsigned int)(powerTicks / HIGH_POWER);
+    lastPower = power;
+    
+    // Only black for too long: search, then either carry on down the probed heading or go home
+    if (colourState != 0) {
+        blackSince = deltaTime;
+    }
+    return colourState == 0 && (unsigned int)(deltaTime - blackSince) > LOST_TIME ? MISSION_EV_LOST : MISSION_EV_NONE;
+}
+
+/************************************
+ * Description:
+ * The mission's state handlers (mission.h), each run once per pass of the main loop
+ * Inputs:
+ * 1 on the first pass after the state was entered
+ * Outputs:
+ * The event that ends the state, or MISSION_EV_NONE
+ ************************************/
+
+// Loads or runs the calibration and waits for START
+static unsigned char stateCalibrate(unsigned char entering){
+    // A saved calibration is used straight away, unless RF3 is held at power on or the surface has changed
+    savedCalibration = !BUTTONF3 && !surfaceChanged && loadCalibration(colourCentres, colourSpread, &gain, &minSat, &minVal);
+    if (savedCalibration) {
+        LCD_sendstring("START Saved Cal.", 0, 0);
+    } else {
+        calibrateGainAndLED(&colourCentres[0], &gain);
+        calibrateClear(gain, &minSat, &minVal);
+    
+        while(!BUTTONF3 && !BUTTONF2){  // Wait for input
+            LCD_sendstring("<- Skip         ", 0, 0);
+            LCD_sendstring("<- Calib. K-Mean", 1, 0);
+            console_poll();
+            __delay_ms(100);
+        }
+    
+        if (BUTTONF3){ 
+            calibrateKMean(&colourCentres[0], &colourSpread[0], gain);
+        }
+    
+        while(BUTTONF3 || BUTTONF2){
+            __delay_ms(100);
+        }
+    
+        saveCalibration(colourCentres, colourSpread, gain, minSat, minVal);  // For the next power on
+        
+        while(1){
+            while(!BUTTONF3 && !BUTTONF2){  // Wait for input
+                LCD_sendstring("<- START        ", 0, 0);
+                LCD_sendstring("<- Calib. Motors", 1, 0);
+                console_poll();
+                __delay_ms(100);
+            }
+            if (!BUTTONF3){
+                break;
+            }
+
+            //ENTER MOTOR CALIBRATION MODE. Each RF2 press turns 90 degrees, left and right in
+            //turn, with the turn times set from the console. RF3 goes back to the menu
+            unsigned char turnRight = 0;
+            LCD_sendstring("RF2 Turn  RF3 OK", 0, 0);
+            while(BUTTONF3){
+                __delay_ms(10);
+            }
+            while(!BUTTONF3){
+                if (BUTTONF2){
+                    __delay_ms(1000);
+                    if (turnRight){
+                        turnRightDeg(&motorL, &motorR, rightTurnTime90, 90);
+                        LCD_sendstring("RIGHT           ", 1, 0);
+                    } else {
+                        turnLeftDeg(&motorL, &motorR, leftTurnTime90, 90);
+                        LCD_sendstring("LEFT            ", 1, 0);
+                    }
+                    turnRight = !turnRight;
+                }
+                console_poll();
+                __delay_ms(10);
+            }
+            while(BUTTONF3){
+                __delay_ms(10);
+            }
+        }
+    }
+    calibratedTick = tickCount;
+    
+    //ENTER SPELUNKING MODE
+    trace_calibration(colourCentres, colourSpread, gain, minSat, minVal);
+    initColourDrift(colourCentres);  // Drift tracking is bounded around the calibrated centres
+    initColourTable(colourCentres, colourSpread);  // Candidate centres for each hue bin
+    resetColourAveraging();  // Start the vote from black, so the first card needs as many reads as the rest
+    ADC_startBackground();  // Sample the battery for stall detection from now on
+    MAIN_BEAM = 1;
+    while(BUTTONF3 || BUTTONF2){  // Wait for the START press to end
+        __delay_ms(10);
+    }
+    approachReset(&approach);
+    moveCounter = 0;
+    startSegment();
+    return MISSION_EV_READY;
+}
+
+// Full power down the segment until the approach interrupt sees a surface
+static unsigned char stateExplore(unsigned char entering){
+    if (entering) {
+        color_arm_approach(gain, minVal);  // Wait for the next surface
+        if (!running) {
+            movingTick = tickCount;
+            running = 1;  // The console may still change settings, but not move the buggy
+            telemetry_boot(tickMs(readyTick), tickMs(calibratedTick), tickMs(movingTick), savedCalibration);
+        }
+    }
+    if (wallNear) {
+        return MISSION_EV_NEAR;
+    }
+    colourState = 0;  // Nothing in front, so classification is skipped
+    return drive();
+}
+
+// Classifies on every pass while the approach controller closes on the surface
+static unsigned char stateApproach(unsigned char entering){
+    colourState = senseColour(colourCentres, colourSpread, gain, minSat, minVal); // Takes a long duration (~100ms)
+    falseWakes = colourState == 0 ? falseWakes + 1 : 0;
+    if (falseWakes >= WAKE_FALSE_LIMIT) {
+        falseWakes = 0;
+        resetColourAveraging();
+        approachReset(&approach);
+        emergencyBrake = 0;
+        return MISSION_EV_FALSE;  // MISSION_EXPLORE arms the interrupt again
+    }
+    if (colourState >= 3) {
+        return MISSION_EV_VOTED;
+    }
+    return drive();
+}
+
+// Ends the segment and records the card, or stops on white
+static unsigned char stateConfirm(unsigned char entering){
+    if (brakeArmed) {
+        color_disarm_brake();  // The manoeuvre must not be interrupted by the brake
+    }
+    endMove();
+    nextMove();
+    moves[moveCounter].type = colourState;  // White is ignored on the way back
+    moves[moveCounter].time = 0;
+    if (colourState == 3) {
+        stop(&motorL, &motorR);
+        resetColourAveraging();
+        color_disarm_approach();
+        emergencyBrake = 0;
+        return MISSION_EV_WHITE;
+    }
+    return MISSION_EV_CARD;
+}
+
+// The card's manoeuvre. The baseline integration for the next approach starts as soon as
+// the buggy has stopped, and runs while the next segment is set up
+static unsigned char stateAct(unsigned char entering){
+    manoeuvre_run(&motorL, &motorR, colourState, MANOEUVRE_DO, leftTurnTime90, rightTurnTime90);
+    stop(&motorL, &motorR);
+    color_prime_approach();
+    resetColourAveraging();
+    approachReset(&approach);
+    emergencyBrake = 0;
+    endMove();
+    nextMove();
+    startSegment();
+    return MISSION_EV_DONE;
+}
+
+// Searches for a card after too long on black
+static unsigned char stateRecover(unsigned char entering){
+    if (entering) {
+        resetColourDrift(colourCentres);  // A misread may have come from drifted centres, so search with the calibrated ones
+    }
+    if(lost(&motorL, &motorR, moves, moveCounter, leftTurnTime90, rightTurnTime90,
+            colourCentres, colourSpread, gain, minSat, minVal, &powerTicks)){
+        moveCounter++;  // The probe is now the current segment
+        deltaTime = 0;
+        lastDelta = 0;
+        blackSince = 0;
+        lastPower = LOW_POWER;
+        approachReset(&approach);
+        return MISSION_EV_FOUND;
+    }
+    stop(&motorL, &motorR);
+    return MISSION_EV_GIVE_UP;
+}
+
+// Navigates the maze in reverse, one move per pass
+static unsigned char stateReturn(unsigned char entering){
+    char buf[17];  // One LCD line and the terminator
+    if (entering) {
+        showSpectralStats();  // How often the spectral check changed the result, and what it cost
+        __delay_ms(1000);
+        profile_report();  // Only with PROFILE_ENABLE
+        sprintf(buf, "Stalls: %02d     ", stallCount > 99 ? 99 : stallCount);
+        LCD_sendstring(buf, 0, 0);
+        sprintf(buf, "Boot: %05u ms  ", tickMs(movingTick));
+        LCD_sendstring(buf, 1, 0);
+        __delay_ms(1000);
+        returnIndex = (int)moveCounter;
+    }
+    if (returnIndex < 0) {
+        stop(&motorL, &motorR);
+        return MISSION_EV_HOME;
+    }
+    struct action currentAction = moves[returnIndex];
+    sprintf(buf, "Action #: %-6u", (unsigned char)returnIndex);  // moveCounter < MOVES_ARRAY_SIZE
+    LCD_sendstring(buf, 0, 0);
+    if (currentAction.type == 0) {
+        // A segment, recorded as its time at HIGH_POWER
+        for(deltaTime = 0; deltaTime < currentAction.time && !stallDetected;){
+            reverse(&motorL, &motorR, HIGH_POWER);
+            telemetry_poll();
+            sprintf(buf, "Time: %05u     ", deltaTime);
+            LCD_sendstring(buf, 1, 0);
+        }
+        if (stallDetected) {
+            logStall(stalls, &stallCount, (unsigned int)returnIndex, deltaTime);
+        }
+        stop(&motorL, &motorR);
+    } else {
+        // A card, or a turn by lost(): its manoeuvre run backwards. White is ignored
+        manoeuvre_run(&motorL, &motorR, currentAction.type, MANOEUVRE_UNDO, leftTurnTime90, rightTurnTime90);
+    }
+    telemetry_segment((unsigned char)returnIndex, currentAction.type, currentAction.type == 0 ? deltaTime : 0, currentAction.time);
+    returnIndex--;
+    return MISSION_EV_NONE;
+}
+
+static const MissionHandler missionHandlers[MISSION_STATES] = {
+    stateCalibrate, stateExplore, stateApproach, stateConfirm, stateAct, stateRecover, stateReturn, NULL
+};
+
+
 void main(void){
-    // Initialisation Function Calls
-    LCD_Init();
-    color_click_init();
-    Interrupts_init();
+    // Start up in overlapping phases, timed by the TMR7 tick from here. The colour click
+    // warms up and the battery is sampled while the LCD waits for its supply to rise
     Timer_init();
+    Interrupts_init();
+    unsigned char clickBusy = color_click_init();  // Powers the click on, without starting an integration
     initDCmotorsPWM(10000);
     ADC_init();
+    unsigned int value = ADC_getval() * 3;  // Battery voltage, shown once the LCD is up
+    telemetry_init();  // Only with TELEMETRY_ENABLE or TRACE_ENABLE, see telemetry.h
+    profile_init();    // Only with PROFILE_ENABLE, see profile.h
+    trace_init();
+    console_init(consoleParams, sizeof(consoleParams) / sizeof(consoleParams[0]), &consoleHooks);  // Only with CONSOLE_ENABLE
+    unsigned char surface = surface_saved();
     
     // Initialise RF2 as go button
     TRISFbits.TRISF2 = 1; // Set TRIS value for pin (input)
@@ -67,21 +621,34 @@ void main(void){
     // Initialise LED for battery status
     TRISDbits.TRISD7 = 0;
     LATDbits.LATD7 = 0;
-
-    unsigned char gain = 5;
-    unsigned char minVal = 10;
-    unsigned char minSat = 10;
-    struct HSV colourCentres[8];
     
-    // Initialise default values
-    colourCentres[0] = *HSV(120,  60,  60);  // WHITE
-    colourCentres[1] = *HSV(250, 150,  80);  // RED
-    colourCentres[2] = *HSV(245,  40, 100);  // PINK
-    colourCentres[3] = *HSV(0,   100, 100);  // ORANGE
-    colourCentres[4] = *HSV(70,  100, 100);  // GREEN
-    colourCentres[5] = *HSV(20,   80, 110);  // YELLOW
-    colourCentres[6] = *HSV(130,  40, 100);  // LIGHT BLUE
-    colourCentres[7] = *HSV(155, 110,  60);  // BLUE
+    while (tickCount < LCD_POWER_UP_MS / TICK_MS) {  // Until the LCD's supply has had time to rise
+        __delay_ms(1);
+    }
+    LCD_Init();
+    while (clickBusy) {  // Inform the user that there is a problem with the colour sensor on the I2C bus
+        LCD_sendstring("I2C Busy...     ", 0, 0);
+        clickBusy = color_click_init();
+    }
+    setColourSampleMode(SAMPLE_DIFFERENTIAL);  // Reject ambient light (SAMPLE_NORMAL for one long integration)
+    setAutoGain(1);  // Switch the sensor's analogue gain to keep readings in range
+    setSpectralConfirm(spectralCheck);
+    setColourDrift(trackDrift);
+    color_click_start();  // The first integration runs while the calibration is loaded
+
+    // Default values from the surface profile, chosen again if RF2 is held at power on. A
+    // new choice replaces the settings saved from the console, and the saved calibration
+    surfaceChanged = BUTTONF2;
+    if (surfaceChanged) {
+        surface = surface_choose(surface);
+    }
+    useSurface(&SURFACES[surface]);
+    if (surfaceChanged) {
+        console_save();
+    } else {
+        console_load();  // The turn times and speed last saved from the console
+    }
+    readyTick = tickCount;
 
 
     // buggy LEDs
@@ -94,29 +661,7 @@ void main(void){
     RIGHT_LIGHT = 0;
     MAIN_BEAM = 0;
     
-    /*
-     * CARPET SETTINGS:
-     * leftTurnTime90 = 740;
-     * rightTurnOffset = 0;
-     * travelTime = 1500;
-     * 
-     * HARD FLOOR SETTINGS:
-     * leftTurnTime90 = 740;
-     * rightTurnOffset = 0;
-     * travelTime = 1500;
-     */
-    
-    unsigned char goFlag = 1;
-    unsigned char colourState = 0;
-    unsigned char previousState = 0;
-
-    unsigned int leftTurnTime90 = 760;
-    unsigned int rightTurnTime90 = 802;
-
-    char buf[16];
-    unsigned int moveCounter = 0;
-    
-    struct action moves[MOVES_ARRAY_SIZE];
+    char buf[17];  // One LCD line and the terminator
     for(int i = 0; i < MOVES_ARRAY_SIZE; i++){
         moves[i].type = 3;  // Default action is white (ignores actions)
         moves[i].time = 0;  // Default action has zero duration
@@ -125,7 +670,6 @@ void main(void){
     // Battery voltage sensing block. Lights LED if BatVolts is less than 3.75V
     
     while (1) { // Warn if battery is less than 3.75 V
-        unsigned int value = ADC_getval() * 3;
         unsigned int int_part = (unsigned int)(value * (3.3/255));
         unsigned int frac_part = (unsigned int)(value * 100 * (3.3/255) - int_part * 100);
         sprintf(buf,"%d.%02d V          ", int_part, frac_part);
@@ -135,11 +679,9 @@ void main(void){
         }
         LATDbits.LATD7 = 1;
         LCD_sendstring(" LOW BATT.", 0, 6);
+        value = ADC_getval() * 3;
     }
-    __delay_ms(1000);
-    // define motor structures and populate fields.
-    DC_motor motorL, motorR; 
-    
+    // populate motor structure fields.
     motorL.power = 0;                                       //zero power to start
     motorL.direction = 1;                                   //set default motor direction
     motorL.brakemode = 1;                                   // brake mode (slow decay)
@@ -154,175 +696,11 @@ void main(void){
     motorR.negDutyHighByte = (unsigned char *)(&CCPR3H);    //store address of CCP4 duty high byte
     motorR.PWMperiod = T2PR;                                //store PWMperiod for motor (value of T2PR in this case)
     
-    calibrateGainAndLED(&colourCentres[0], &gain);
-    calibrateClear(gain, &minSat, &minVal);
-    
-    while(!BUTTONF3 && !BUTTONF2){  // Wait for input
-        LCD_sendstring("<- Skip         ", 0, 0);
-        LCD_sendstring("<- Calib. K-Mean", 1, 0);
-        __delay_ms(100);
-    }
-    
-    if (BUTTONF3){ 
-        calibrateKMean(&colourCentres[0], gain);
-    }
-    
-    while(BUTTONF3 || BUTTONF2){
-        __delay_ms(100);
-    }
-    
-    while(!BUTTONF3 && !BUTTONF2){  // Wait for input
-        LCD_sendstring("<- START        ", 0, 0);
-        LCD_sendstring("<- Calib. Motors", 1, 0);
-        __delay_ms(100);
-    }
-
-    //ENTER MOTOR CALIBRATION MODE
-    if (BUTTONF3){ 
-        while(1){
-            __delay_ms(1000);
-            turnLeftDeg(&motorL, &motorR, leftTurnTime90, 90);
-            LCD_sendstring("LEFT            ", 1, 0);
-            while(!BUTTONF2){  // Wait for input
-                __delay_ms(100);
-            }
-            __delay_ms(1000);
-            turnRightDeg(&motorL, &motorR, rightTurnTime90, 90);
-            LCD_sendstring("RIGHT           ", 1, 0);
-            while(!BUTTONF2){  // Wait for input
-                __delay_ms(100);
-            }
-        }
-        //leftTurnTime90 = calibrateLeft(&motorL, &motorR, leftTurnTime90);
-        //rightTurnTime90 = calibrateRight(&motorL, &motorR, rightTurnTime90);
-    }
-    
-    //ENTER SPELUNKING MODE
-    MAIN_BEAM = 1;
-    __delay_ms(1000);
-    deltaTime = 0; // Reset the timer
-     
-    // Navigate the maze.
-    while (goFlag) {
-        colourState = senseColour(colourCentres, gain, minSat, minVal); // Takes a long duration (~100ms)
-        switch(colourState){
-            case 0:
-                forward(&motorL, &motorR, HIGH_POWER);
-                break;
-            case 1:
-                forward(&motorL, &motorR, MED_POWER);
-                break;
-            case 2:
-                forward(&motorL, &motorR, LOW_POWER);
-                break;
-            case 3:
-                stop(&motorL, &motorR);  // Stop moving
-                resetColourAveraging();
-                goFlag = 0; // Exit while loop
-                break;
-            case 4:
-                red(&motorL, &motorR, rightTurnTime90);
-                break;
-            case 5:
-                pink(&motorL, &motorR, leftTurnTime90);
-                break;
-            case 6:
-                orange(&motorL, &motorR, rightTurnTime90);
-                break;
-            case 7:
-                yellow(&motorL, &motorR, rightTurnTime90);
-                break;
-            case 8:
-                green(&motorL, &motorR, leftTurnTime90);
-                break;
-            case 9:
-                light_blue(&motorL, &motorR, leftTurnTime90);
-                break;
-            case 10:
-                blue(&motorL, &motorR, rightTurnTime90);
-                break;        
-        }
-        if(colourState != previousState){
-            moveCounter = moveCounter < (MOVES_ARRAY_SIZE - 1) ? (moveCounter + 1) : (MOVES_ARRAY_SIZE - 1);  // Keep within range
-        }
-        // Add the move to the moveArray
-        if(colourState >= 4){
-            stop(&motorL, &motorR); // TODO: Think carefully about where to put this
-            resetColourAveraging();
-            moves[moveCounter].type = colourState;
-            moves[moveCounter].time = 0;
-        } else if(colourState <= 2){
-            moves[moveCounter].type = colourState;
-            moves[moveCounter].time = deltaTime;
-        }
-        if(colourState != previousState){ // Reset the timer
-            deltaTime = 0;
-        }
-        previousState = colourState;
-    }
-    __delay_ms(1000);
-    
-    // Navigate the maze in reverse
-    for (int currentMoveIndex = (int)moveCounter; currentMoveIndex >= 0; currentMoveIndex--) // TODO: Should this be >= 0?
-    {
-        struct action currentAction = moves[currentMoveIndex];
-        sprintf(buf, "Action #: %d     ", currentMoveIndex);
-        LCD_sendstring(buf, 0, 0);
-
-        switch (currentAction.type){
-            case 0:
-                for(deltaTime = 0; deltaTime < currentAction.time;){
-                    reverse(&motorL, &motorR, HIGH_POWER);
-                    sprintf(buf, "Time: %05d     ", deltaTime);
-                    LCD_sendstring(buf, 1, 0);
-                }
-                stop(&motorL, &motorR);
-                break;
-            case 1:
-                for(deltaTime = 0; deltaTime < currentAction.time;){
-                    reverse(&motorL, &motorR, MED_POWER);
-                    sprintf(buf, "Time: %05d     ", deltaTime);
-                    LCD_sendstring(buf, 1, 0);
-                }
-                stop(&motorL, &motorR);
-                break;
-            case 2:
-                for(deltaTime = 0; deltaTime < currentAction.time;){
-                    reverse(&motorL, &motorR, LOW_POWER);
-                    sprintf(buf, "Time: %05d    ", deltaTime);
-                    LCD_sendstring(buf, 1, 0);
-                }
-                stop(&motorL, &motorR);
-                break;
-            case 3:
-                // White: Ignore
-                break;
-            case 4: // Had seen Red
-                turnLeftDeg(&motorL, &motorR, leftTurnTime90, 90);
-                break;
-            case 5: // Had seen Pink: turn right 90 then move forward 1 square 
-                turnRightDeg(&motorL, &motorR, rightTurnTime90, 90);
-                __delay_ms(100);
-                forward_unit(&motorL, &motorR, 1.5);
-                break;
-            case 6: // Had seen Orange: turn left 135
-                turnLeftDeg(&motorL, &motorR, leftTurnTime90, 135);
-                break;
-            case 7: // Had seen Yellow: turn left 90 then move forward 1 square 
-                turnLeftDeg(&motorL, &motorR, leftTurnTime90, 90);
-                __delay_ms(100);
-                forward_unit(&motorL, &motorR, 1.5);
-                break;
-            case 8: // Had seen Green
-                turnRightDeg(&motorL, &motorR, rightTurnTime90, 90);
-                break;
-            case 9: // Had seen Light Blue: turn right 135
-                turnRightDeg(&motorL, &motorR, rightTurnTime90, 135);
-                break;
-            case 10: // Had seen Blue: turn 180
-                turnRightDeg(&motorL, &motorR, rightTurnTime90, 180);
-                break;
-        }
+    // The maze run (mission.h)
+    mission_init(missionHandlers);
+    while (mission_step() != MISSION_DONE) {
+        telemetry_poll();
+        console_poll();
     }
     stop(&motorL, &motorR);
     return;
@@ -0,0 +1,126 @@
+/*
+ * File:   manoeuvre.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "manoeuvre.h"
+#include "dc_motor.h"
+
+/******************************************************************************
+ * Description:
+ * The manoeuvre for each card, indexed by move type - MANOEUVRE_FIRST.
+ *
+ *  RED         - turn right 90 degrees.
+ *  PINK        - reverse 1 unit and turn left 90 degrees.
+ *  ORANGE      - Turn right 135 degrees.
+ *  YELLOW      - reverse 1 unit and turn right 90 degrees.
+ *  GREEN       - turn left 90 degrees.
+ *  LIGHT BLUE  - Turn left 135 degrees.
+ *  BLUE        - turn 180 degrees (moving clockwise in this implementation)
+ *
+ * The buggy backs away from every card before it turns. The search turns made by
+ * lost() are here so that the return leg undoes them in the same way.
+ ******************************************************************************/
+const unsigned char MANOEUVRES[MANOEUVRE_COUNT][MANOEUVRE_LEN] = {
+    { MV_CLEAR(1), MV_PAUSE(5), MV_RIGHT(2), MV_END },  // MOVE_RED
+    { MV_BACK(3),  MV_PAUSE(5), MV_LEFT(2),  MV_END },  // MOVE_PINK
+    { MV_CLEAR(1), MV_PAUSE(5), MV_RIGHT(3), MV_END },  // MOVE_ORANGE
+    { MV_BACK(3),  MV_PAUSE(5), MV_RIGHT(2), MV_END },  // MOVE_YELLOW
+    { MV_CLEAR(1), MV_PAUSE(5), MV_LEFT(2),  MV_END },  // MOVE_GREEN
+    { MV_CLEAR(1), MV_PAUSE(5), MV_LEFT(3),  MV_END },  // MOVE_LIGHT_BLUE
+    { MV_CLEAR(1), MV_PAUSE(5), MV_RIGHT(4), MV_END },  // MOVE_BLUE
+    { MV_LEFT(2),  MV_END },                            // TURNED_LEFT_90
+    { MV_RIGHT(2), MV_END },                            // TURNED_RIGHT_90
+};
+
+/************************************
+ * Description:
+ * Inverts an instruction for the return leg
+ * Inputs:
+ * The instruction
+ * Outputs:
+ * The instruction that undoes it, or MV_END if it is left out of the return
+ ************************************/
+static unsigned char invert(unsigned char op) {
+    unsigned char n = op & MV_ARG;
+    switch (op & MV_OPCODE) {
+        case MV_BACK(0):
+            return MV_FWD(n);
+        case MV_FWD(0):
+            return MV_BACK(n);
+        case MV_PAUSE(0):
+            return op;
+        case MV_LEFT(0):
+            return n == MV_HALF_TURN ? op : MV_RIGHT(n);
+        case MV_RIGHT(0):
+            return n == MV_HALF_TURN ? op : MV_LEFT(n);
+        default:
+            return MV_END;  // MV_CLEAR
+    }
+}
+
+static void execute(DC_motor *mL, DC_motor *mR, unsigned char op,
+                    unsigned int leftTurnTime90, unsigned int rightTurnTime90) {
+    unsigned char n = op & MV_ARG;
+    switch (op & MV_OPCODE) {
+        case MV_CLEAR(0):
+        case MV_BACK(0):
+            reverse_unit(mL, mR, n);
+            break;
+        case MV_FWD(0):
+            forward_unit(mL, mR, n);
+            break;
+        case MV_PAUSE(0):
+            for (unsigned char i = 0; i < n; i++) {
+                __delay_ms(MV_PAUSE_MS);
+            }
+            break;
+        case MV_LEFT(0):
+            turnLeftDeg(mL, mR, leftTurnTime90, (unsigned int)n * MV_TURN_DEG);
+            break;
+        case MV_RIGHT(0):
+            turnRightDeg(mL, mR, rightTurnTime90, (unsigned int)n * MV_TURN_DEG);
+            break;
+    }
+}
+
+/************************************
+ * Description:
+ * Runs the manoeuvre recorded for a move. Undoing it runs the row from its end, inverting
+ * each instruction, and leaves out a pause with nothing after it
+ * Inputs:
+ * The motors, the move type, MANOEUVRE_DO or MANOEUVRE_UNDO, and the turn times
+ ************************************/
+void manoeuvre_run(DC_motor *mL, DC_motor *mR, unsigned char type, unsigned char direction,
+                   unsigned int leftTurnTime90, unsigned int rightTurnTime90) {
+    if (type < MANOEUVRE_FIRST || type >= MANOEUVRE_FIRST + MANOEUVRE_COUNT) {
+        return;
+    }
+    const unsigned char *row = MANOEUVRES[type - MANOEUVRE_FIRST];
+    unsigned char length = 0;
+    while (length < MANOEUVRE_LEN && row[length] != MV_END) {
+        length++;
+    }
+    if (direction == MANOEUVRE_DO) {
+        for (unsigned char i = 0; i < length; i++) {
+            execute(mL, mR, row[i], leftTurnTime90, rightTurnTime90);
+        }
+        return;
+    }
+    unsigned char pause = MV_END;
+    for (unsigned char i = length; i-- > 0;) {
+        unsigned char op = invert(row[i]);
+        if ((op & MV_OPCODE) == MV_PAUSE(0)) {
+            pause = op;  // Held back until something follows it
+        } else if (op != MV_END) {
+            if (pause != MV_END) {
+                execute(mL, mR, pause, leftTurnTime90, rightTurnTime90);
+                pause = MV_END;
+            }
+            execute(mL, mR, op, leftTurnTime90, rightTurnTime90);
+        }
+    }
+}
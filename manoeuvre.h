@@ -0,0 +1,66 @@
+/*
+ * File:   manoeuvre.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Card manoeuvres as bytecode. Each move type main.c records for a card, or for a turn made
+// by lost(), has a short row of one-byte instructions in MANOEUVRES (manoeuvre.c). The return
+// leg runs the same row backwards with each instruction inverted, so adding or retuning a card
+// is a change to its row alone.
+//
+// An instruction is an opcode in the top three bits and an argument in the bottom five:
+//   MV_CLEAR(n)   reverse n half units to clear the card. Left out of the return
+//   MV_BACK(n)    reverse n half units. Undone by MV_FWD(n)
+//   MV_FWD(n)     drive forward n half units. Undone by MV_BACK(n)
+//   MV_PAUSE(n)   wait n * 20 ms. Left out of the return if nothing follows it there
+//   MV_LEFT(n)    turn left n * 45 degrees. Undone by MV_RIGHT(n), except that a half turn
+//   MV_RIGHT(n)   is undone by turning the same way again, with the same turn time
+// A row ends at MV_END or after MANOEUVRE_LEN instructions.
+#ifndef _manoeuvre_H
+#define _manoeuvre_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+#include "dc_motor.h"
+
+// Move types recorded in main.c's move history. 0 to 2 are driven segments and 3 is white
+#define MOVE_RED            4
+#define MOVE_PINK           5
+#define MOVE_ORANGE         6
+#define MOVE_YELLOW         7
+#define MOVE_GREEN          8
+#define MOVE_LIGHT_BLUE     9
+#define MOVE_BLUE           10
+#define TURNED_LEFT_90      11    // Recorded by lost() when it turns to search
+#define TURNED_RIGHT_90     12
+
+#define MANOEUVRE_FIRST     MOVE_RED
+#define MANOEUVRE_COUNT     9
+#define MANOEUVRE_LEN       4
+
+#define MV_OPCODE           0xE0
+#define MV_ARG              0x1F
+#define MV_END              0x00
+#define MV_CLEAR(n)         (0x20 | (n))
+#define MV_BACK(n)          (0x40 | (n))
+#define MV_FWD(n)           (0x60 | (n))
+#define MV_PAUSE(n)         (0x80 | (n))
+#define MV_LEFT(n)          (0xA0 | (n))
+#define MV_RIGHT(n)         (0xC0 | (n))
+
+#define MV_PAUSE_MS         20
+#define MV_TURN_DEG         45
+#define MV_HALF_TURN        (180 / MV_TURN_DEG)
+
+// Which way manoeuvre_run() runs a row
+#define MANOEUVRE_DO        0     // As the card asks, on the way in
+#define MANOEUVRE_UNDO      1     // Backwards and inverted, on the return leg
+
+extern const unsigned char MANOEUVRES[MANOEUVRE_COUNT][MANOEUVRE_LEN];
+
+void manoeuvre_run(DC_motor *mL, DC_motor *mR, unsigned char type, unsigned char direction,
+                   unsigned int leftTurnTime90, unsigned int rightTurnTime90);
+
+#endif
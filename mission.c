@@ -0,0 +1,91 @@
+/*
+ * File:   mission.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "mission.h"
+#include "telemetry.h"
+
+extern volatile unsigned int tickCount;
+
+struct MissionTransition {
+    unsigned char state;
+    unsigned char event;
+    unsigned char next;
+};
+
+static const struct MissionTransition MISSION_TRANSITIONS[] = {
+    { MISSION_CALIBRATE, MISSION_EV_READY,   MISSION_EXPLORE  },
+    { MISSION_EXPLORE,   MISSION_EV_NEAR,    MISSION_APPROACH },
+    { MISSION_EXPLORE,   MISSION_EV_LOST,    MISSION_RECOVER  },
+    { MISSION_APPROACH,  MISSION_EV_FALSE,   MISSION_EXPLORE  },
+    { MISSION_APPROACH,  MISSION_EV_VOTED,   MISSION_CONFIRM  },
+    { MISSION_APPROACH,  MISSION_EV_LOST,    MISSION_RECOVER  },
+    { MISSION_CONFIRM,   MISSION_EV_CARD,    MISSION_ACT      },
+    { MISSION_CONFIRM,   MISSION_EV_WHITE,   MISSION_RETURN   },
+    { MISSION_ACT,       MISSION_EV_DONE,    MISSION_EXPLORE  },
+    { MISSION_RECOVER,   MISSION_EV_FOUND,   MISSION_APPROACH },
+    { MISSION_RECOVER,   MISSION_EV_GIVE_UP, MISSION_RETURN   },
+    { MISSION_RETURN,    MISSION_EV_HOME,    MISSION_DONE     },
+};
+
+static const MissionHandler* handler;
+static unsigned char state;
+static unsigned char entering;
+static unsigned int enteredTick;
+
+/************************************
+ * Description:
+ * Starts the mission in MISSION_CALIBRATE
+ * Inputs:
+ * The handler of each state, indexed by state. MISSION_DONE's may be NULL
+ ************************************/
+void mission_init(const MissionHandler* handlers) {
+    handler = handlers;
+    state = MISSION_CALIBRATE;
+    entering = 1;
+    enteredTick = tickCount;
+}
+
+/************************************
+ * Description:
+ * Moves to the state an event leads to, timing the state left. An event the current state
+ * has no transition for is ignored
+ ************************************/
+static void transition(unsigned char event) {
+    for (unsigned char i = 0; i < sizeof(MISSION_TRANSITIONS) / sizeof(MISSION_TRANSITIONS[0]); i++) {
+        if (MISSION_TRANSITIONS[i].state == state && MISSION_TRANSITIONS[i].event == event) {
+            unsigned int now = tickCount;
+            telemetry_mission(state, event, MISSION_TRANSITIONS[i].next, (unsigned int)(now - enteredTick));
+            state = MISSION_TRANSITIONS[i].next;
+            entering = 1;
+            enteredTick = now;
+            return;
+        }
+    }
+}
+
+/************************************
+ * Description:
+ * Runs the current state's handler once and follows the event it returns
+ * Outputs:
+ * The state the mission is now in
+ ************************************/
+unsigned char mission_step(void) {
+    if (handler[state]) {
+        unsigned char first = entering;
+        entering = 0;
+        unsigned char event = handler[state](first);
+        if (event != MISSION_EV_NONE) {
+            transition(event);
+        }
+    }
+    return state;
+}
+
+unsigned char mission_state(void) {
+    return state;
+}
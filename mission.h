@@ -0,0 +1,60 @@
+/*
+ * File:   mission.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// The mission as a state machine. Each state has a handler in main.c, run once per pass of the
+// main loop, which does that state's work and returns an event, or MISSION_EV_NONE to stay.
+// Where each event leads is the table MISSION_TRANSITIONS in mission.c, so the shape of the
+// mission can be read in one place. Every transition is timed by the TMR7 tick and sent as a
+// TELEMETRY_MISSION frame, which host/telemetry_decode prints with the time spent in each state.
+//
+// A handler is told when its state has just been entered, for the work done once per visit.
+// A state may start the next one's work before it ends: the card manoeuvre starts the
+// integration the next approach takes its baseline from (color_prime_approach()).
+#ifndef _mission_H
+#define _mission_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+
+// States
+#define MISSION_CALIBRATE   0     // Menus and calibration, until START
+#define MISSION_EXPLORE     1     // Full power down a segment, nothing in front
+#define MISSION_APPROACH    2     // Something in front: classifying while closing on it
+#define MISSION_CONFIRM     3     // The vote has settled on a card: record it
+#define MISSION_ACT         4     // The card's manoeuvre
+#define MISSION_RECOVER     5     // On black for too long: searching (lost() in main.c)
+#define MISSION_RETURN      6     // Undoing the route, one move per pass
+#define MISSION_DONE        7
+#define MISSION_STATES      8
+
+// Events
+#define MISSION_EV_NONE     0
+#define MISSION_EV_READY    1     // Calibrated, and START pressed
+#define MISSION_EV_NEAR     2     // The approach interrupt has seen a surface
+#define MISSION_EV_FALSE    3     // The surface went away again
+#define MISSION_EV_VOTED    4     // The vote has settled on a card or white
+#define MISSION_EV_CARD     5
+#define MISSION_EV_WHITE    6
+#define MISSION_EV_DONE     7     // A manoeuvre is finished
+#define MISSION_EV_LOST     8
+#define MISSION_EV_FOUND    9
+#define MISSION_EV_GIVE_UP  10
+#define MISSION_EV_HOME     11
+#define MISSION_EVENTS      12
+
+// For the host tools
+#define MISSION_STATE_NAMES { "calibrate", "explore", "approach", "confirm", "act", "recover", "return", "done" }
+#define MISSION_EVENT_NAMES { "none", "ready", "near", "false", "voted", "card", "white", "done", "lost", \
+                              "found", "give up", "home" }
+
+typedef unsigned char (*MissionHandler)(unsigned char entering);
+
+void mission_init(const MissionHandler* handlers);
+unsigned char mission_step(void);
+unsigned char mission_state(void);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * File:   profile.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include <stdio.h>
+#include "profile.h"
+#include "LCD.h"
+#include "telemetry.h"
+
+#if PROFILE_ENABLE
+
+static const char PROFILE_NAME[PROFILE_SECTIONS][PROFILE_NAME_LEN + 1] = {
+    "Approach", "I2C read", "RgbToHsv", "Segment", "sprintf", "LCD",
+    "INT1 isr", "TMR7 isr", "TMR1 isr", "TMR3 isr", "TMR5 isr", "TX4 isr",
+    "TMR7 lat", "TMR1 lat", "TMR3 lat", "TMR5 lat"
+};
+
+static unsigned int started[PROFILE_SECTIONS];   // TMR0 at PROFILE_BEGIN
+static unsigned long calls[PROFILE_SECTIONS];
+static unsigned long total[PROFILE_SECTIONS];    // us
+static unsigned int shortest[PROFILE_SECTIONS];
+static unsigned int longest[PROFILE_SECTIONS];
+
+/************************************
+ * Description:
+ * Reads TMR0. Reading TMR0L loads TMR0H with the high byte at the same moment
+ ************************************/
+static unsigned int profile_now(void) {
+    unsigned char low = HAL_TMR0L;
+    return ((unsigned int)TMR0H << 8) | low;
+}
+
+/************************************
+ * Description:
+ * Starts TMR0 free running in 16-bit mode at Fosc/4 / 16, 1 us per count, and clears
+ * the counters
+ ************************************/
+void profile_init(void) {
+    PMD1bits.TMR0MD = 0;
+    T0CON1bits.T0CS = 0b010;    // Fosc/4
+    T0CON1bits.T0ASYNC = 0;
+    T0CON1bits.T0CKPS = 0b0100; // 1:16
+    T0CON0bits.T016BIT = 1;
+    T0CON0bits.T0EN = 1;
+    profile_reset();
+}
+
+void profile_reset(void) {
+    for (unsigned char i = 0; i < PROFILE_SECTIONS; i++) {
+        calls[i] = 0;
+        total[i] = 0;
+        shortest[i] = 0xFFFF;
+        longest[i] = 0;
+    }
+}
+
+void profile_begin(unsigned char section) {
+    started[section] = profile_now();
+}
+
+/************************************
+ * Description:
+ * Adds the time since the section's PROFILE_BEGIN to its counters
+ ************************************/
+void profile_end(unsigned char section) {
+    profile_record(section, (profile_now() - started[section]) & 0xFFFF);  // int may be wider off the PIC
+}
+
+/************************************
+ * Description:
+ * Adds a time to a section's counters
+ * Inputs:
+ * The section and the time in us
+ ************************************/
+void profile_record(unsigned char section, unsigned int us) {
+    calls[section]++;
+    total[section] += us;
+    if (us < shortest[section]) {
+        shortest[section] = us;
+    }
+    if (us > longest[section]) {
+        longest[section] = us;
+    }
+}
+
+/************************************
+ * Description:
+ * Shows each section that has run on the LCD for a second: its name and calls, then the
+ * mean and longest time in us. Each is also sent as a TELEMETRY_PROFILE frame when there
+ * is a telemetry transport
+ ************************************/
+void profile_report(void) {
+    char buf[17];  // One LCD line and the terminator
+    for (unsigned char i = 0; i < PROFILE_SECTIONS; i++) {
+        if (!calls[i]) {
+            continue;
+        }
+        unsigned int mean = (unsigned int)(total[i] / calls[i]);
+#if TELEMETRY_TRANSPORT
+        telemetry_begin(TELEMETRY_PROFILE, TELEMETRY_PROFILE_LEN, TELEMETRY_WAIT);
+        telemetry_byte(i);
+        for (unsigned char c = 0; c < PROFILE_NAME_LEN; c++) {
+            telemetry_byte((unsigned char)PROFILE_NAME[i][c]);
+        }
+        telemetry_word(calls[i] > 0xFFFF ? 0xFFFF : (unsigned int)calls[i]);
+        telemetry_word(shortest[i]);
+        telemetry_word(mean);
+        telemetry_word(longest[i]);
+        telemetry_end();
+#endif
+        sprintf(buf, "%-8.8s%8lu", PROFILE_NAME[i], calls[i] % 100000000);
+        LCD_sendstring(buf, 0, 0);
+        sprintf(buf, "av%5u  mx%5u", mean, longest[i]);
+        LCD_sendstring(buf, 1, 0);
+        __delay_ms(1000);
+    }
+}
+
+#endif
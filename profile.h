@@ -0,0 +1,91 @@
+/*
+ * File:   profile.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Section profiler. With PROFILE_ENABLE set, TMR0 runs free at 1 us per count, and each
+// PROFILE_BEGIN/PROFILE_END pair adds the time between them to its section's call count,
+// minimum, maximum and total. Sections longer than 65 ms wrap, so profile the pieces of a
+// colour reading rather than the wait for the integration. Without PROFILE_ENABLE the
+// macros are empty and TMR0 is left alone.
+//
+// Reading TMR0L loads TMR0H's read buffer. An interrupt with sections in it starts with
+// PROFILE_ISR_ENTER() and ends with PROFILE_ISR_EXIT(), which put the buffer back for a read
+// the interrupt may have split. The interrupt sections also time each source's handler and,
+// for the timers, its entry latency, so the longest of each is the worst case seen.
+//
+// profile_report() shows each section on the LCD, and sends it as a telemetry frame when
+// there is a telemetry transport (see telemetry.h):
+//   TELEMETRY_PROFILE  section, name (8 characters), calls, min, mean, max (16-bit, us)
+#ifndef _profile_H
+#define _profile_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE      0
+#endif
+
+// Sections
+#define PROF_APPROACH       0     // Setting the power and brake threshold as the buggy drives
+#define PROF_I2C            1     // color_read_raw(): the RGBC read transaction
+#define PROF_HSV            2     // RgbToHsv()
+#define PROF_SEGMENT        3     // segmentFast() and its HSV_Distance() calls
+#define PROF_SPRINTF        4     // sprintf() of the HSV line in senseColour()
+#define PROF_LCD            5     // The two LCD rows written by senseColour()
+// Each interrupt source's handler, from its flag test to clearing the flag
+#define PROF_ISR_INT1       6     // High priority
+#define PROF_ISR_TMR7       7
+#define PROF_ISR_TMR1       8     // Low priority
+#define PROF_ISR_TMR3       9
+#define PROF_ISR_TMR5       10
+#define PROF_ISR_TX4        11
+// Entry latency of the timer interrupts: how far the timer has counted past its overflow by
+// the time its handler reads it. This includes the context save and any handler that ran
+// first or was running when the interrupt was raised
+#define PROF_LAT_TMR7       12
+#define PROF_LAT_TMR1       13
+#define PROF_LAT_TMR3       14
+#define PROF_LAT_TMR5       15
+#define PROFILE_SECTIONS    16
+
+#define PROFILE_NAME_LEN    8
+
+#define TELEMETRY_PROFILE       'P'
+#define TELEMETRY_PROFILE_LEN   (1 + PROFILE_NAME_LEN + 8)
+
+#if PROFILE_ENABLE
+
+#define PROFILE_BEGIN(section)      profile_begin(section)
+#define PROFILE_END(section)        profile_end(section)
+// Records a timer's count as a latency. timerL is its HAL_TMRxL, read before its TMRxH
+#define PROFILE_LATENCY(section, timerL, timerH, countsPerUs) \
+    do { unsigned char profileLow = (timerL); \
+         profile_record((section), (((unsigned int)(timerH) << 8) | profileLow) / (countsPerUs)); } while (0)
+#define PROFILE_ISR_ENTER()         unsigned char profileTMR0H = TMR0H
+#define PROFILE_ISR_EXIT()          (TMR0H = profileTMR0H)
+
+void profile_init(void);
+void profile_begin(unsigned char section);
+void profile_end(unsigned char section);
+void profile_record(unsigned char section, unsigned int us);
+void profile_reset(void);
+void profile_report(void);
+
+#else
+
+#define PROFILE_BEGIN(section)      ((void)0)
+#define PROFILE_END(section)        ((void)0)
+#define PROFILE_LATENCY(section, timerL, timerH, countsPerUs)   ((void)0)
+#define PROFILE_ISR_ENTER()         ((void)0)
+#define PROFILE_ISR_EXIT()          ((void)0)
+#define profile_init()              ((void)0)
+#define profile_reset()             ((void)0)
+#define profile_report()            ((void)0)
+
+#endif
+
+#endif
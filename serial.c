@@ -0,0 +1,52 @@
+/* 
+ * File:   serial.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "serial.h"
+
+/************************************
+ * Description:
+ * Sets up EUSART4 to transmit on RC0 and receive on RC1 at 115200 baud, 8N1
+ ************************************/
+void initUSART4(void) {
+    TRISCbits.TRISC0 = 0;     // TX pin as output
+    RC0PPS = 0x12;            // EUSART4 TX on RC0
+    TRISCbits.TRISC1 = 1;     // RX pin as input
+    ANSELCbits.ANSELC1 = 0;
+    RX4PPS = 0x11;            // EUSART4 RX from RC1
+    
+    BAUD4CONbits.BRG16 = 1;   // 16-bit baud rate generator
+    TX4STAbits.BRGH = 1;      // High speed: baud = Fosc / (4 * (SP4BRG + 1))
+    SP4BRGL = SERIAL_BRG & 0xFF;
+    SP4BRGH = SERIAL_BRG >> 8;
+    
+    RC4STAbits.SPEN = 1;      // Enable the serial port
+    TX4STAbits.TXEN = 1;      // Enable transmission
+    RC4STAbits.CREN = 1;      // Enable reception
+}
+
+/************************************
+ * Description:
+ * Sends a byte, waiting for space in the transmit buffer first
+ * Inputs:
+ * The byte to send
+ ************************************/
+void sendCharSerial4(unsigned char charToSend) {
+    HAL_UART_WRITE(charToSend);
+}
+
+/************************************
+ * Description:
+ * Sends a block of bytes
+ * Inputs:
+ * The bytes and how many to send
+ ************************************/
+void sendBytesSerial4(const unsigned char* bytes, unsigned char count) {
+    for (unsigned char i = 0; i < count; i++) {
+        HAL_UART_WRITE(bytes[i]);
+    }
+}
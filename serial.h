@@ -0,0 +1,20 @@
+/* 
+ * File:   serial.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef _serial_H
+#define _serial_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+
+#define SERIAL_BRG  138  // 115200 baud at 64 MHz with BRG16 and BRGH set (0.08% error)
+
+void initUSART4(void);
+void sendCharSerial4(unsigned char charToSend);
+void sendBytesSerial4(const unsigned char* bytes, unsigned char count);
+
+#endif
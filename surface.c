@@ -0,0 +1,74 @@
+/*
+ * File:   surface.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "surface.h"
+#include "LCD.h"
+#include "eeprom.h"
+
+// The colour centres are the ones main.c has always started from. Carpet's turn times are
+// those recorded for it before the buggy was moved onto a hard floor
+const struct Surface SURFACES[SURFACE_COUNT] = {
+    {
+        "Hard floor      ",
+        { {120,  60,  60}, {250, 150,  80}, {245,  40, 100}, {  0, 100, 100},
+          { 70, 100, 100}, { 20,  80, 110}, {130,  40, 100}, {155, 110,  60} },
+        { THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT,
+          THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_BLUE },
+        760, 802, 6
+    },
+    {
+        "Carpet          ",
+        { {120,  60,  60}, {250, 150,  80}, {245,  40, 100}, {  0, 100, 100},
+          { 70, 100, 100}, { 20,  80, 110}, {130,  40, 100}, {155, 110,  60} },
+        { THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT,
+          THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_DEFAULT, THRESHOLD_BLUE },
+        740, 740, 6
+    }
+};
+
+/************************************
+ * Description:
+ * Reads which profile was last chosen
+ * Outputs:
+ * Its index, or 0 if none has been chosen
+ ************************************/
+unsigned char surface_saved(void) {
+    unsigned char index = eeprom_read(SURFACE_ADDRESS);
+    return index < SURFACE_COUNT ? index : 0;
+}
+
+/************************************
+ * Description:
+ * Lets the user choose a profile on the LCD: RF2 shows the next and RF3 chooses the one
+ * shown, which is saved for the next power on. Call with RF2 held; it waits for its release
+ * Inputs:
+ * The profile to show first
+ * Outputs:
+ * The chosen profile
+ ************************************/
+unsigned char surface_choose(unsigned char current) {
+    LCD_sendstring("RF2 Next RF3 Use", 1, 0);
+    while (!HAL_PIN_RF2) {
+        __delay_ms(10);
+    }
+    while (HAL_PIN_RF3) {
+        LCD_sendstring(SURFACES[current].name, 0, 0);
+        if (!HAL_PIN_RF2) {
+            current = (unsigned char)((current + 1) % SURFACE_COUNT);
+            while (!HAL_PIN_RF2) {
+                __delay_ms(10);
+            }
+        }
+        __delay_ms(10);
+    }
+    while (!HAL_PIN_RF3) {
+        __delay_ms(10);
+    }
+    eeprom_write(SURFACE_ADDRESS, current);
+    return current;
+}
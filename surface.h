@@ -0,0 +1,40 @@
+/*
+ * File:   surface.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Surface profiles: the default colour centres and acceptance thresholds, turn times and
+// speed for a floor and its lighting, held in program flash. One is chosen at power on and
+// copied into the settings in RAM, which calibration and the console then adjust. Holding
+// RF2 at power on shows a menu to choose another, which is remembered in data EEPROM.
+//
+// The firmware uses no heap. Everything it needs is allocated at build time, and the host
+// build fails if a firmware object calls malloc() or its relatives (see host/Makefile).
+#ifndef _surface_H
+#define _surface_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+#include "color.h"
+
+#define SURFACE_COUNT       2
+#define SURFACE_NAME_LEN    16    // One LCD line
+#define SURFACE_ADDRESS     0x0F0 // Data EEPROM byte holding the chosen profile
+
+struct Surface {
+    char name[SURFACE_NAME_LEN + 1];
+    struct HSV centres[8];          // White, red, pink, orange, yellow, green, light blue, blue
+    unsigned int thresholds[8];     // Acceptance radius of each colour before calibration
+    unsigned int leftTurnTime90;    // ms to turn 90 degrees
+    unsigned int rightTurnTime90;
+    unsigned char speed;            // Unit of LOW_POWER, MED_POWER and HIGH_POWER
+};
+
+extern const struct Surface SURFACES[SURFACE_COUNT];
+
+unsigned char surface_saved(void);
+unsigned char surface_choose(unsigned char current);
+
+#endif
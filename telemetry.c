@@ -0,0 +1,271 @@
+/*
+ * File:   telemetry.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "telemetry.h"
+#include "serial.h"
+#include "trace.h"
+#include "ADC.h"
+
+extern volatile unsigned int tickCount;
+extern volatile unsigned char stallDetected;
+
+/************************************
+ * Description:
+ * Adds a byte to a CRC-16/CCITT-FALSE (polynomial 0x1021, starting from 0xFFFF) without
+ * a table or a bit loop
+ * Inputs:
+ * The CRC so far and the next byte
+ * Outputs:
+ * The updated CRC
+ ************************************/
+unsigned int telemetry_crc(unsigned int crc, unsigned char byte) {
+    unsigned char x = (unsigned char)(crc >> 8) ^ byte;
+    x ^= x >> 4;
+    return ((crc << 8) ^ ((unsigned int)x << 12) ^ ((unsigned int)x << 5) ^ x) & 0xFFFF;  // int may be wider off the PIC
+}
+
+#if TELEMETRY_TRANSPORT
+
+// The ring buffer. The main loop writes a frame after ringHead and publishes it by moving
+// ringHead on once it is complete; the TX4 interrupt sends from ringTail. The indexes are
+// bytes, so they wrap with the buffer and are read and written in one instruction
+static unsigned char ring[256];
+static volatile unsigned char ringHead = 0;
+static volatile unsigned char ringTail = 0;
+static unsigned char writePos = 0;      // Where the frame being written has got to
+static unsigned char frameOpen = 0;     // Whether telemetry_byte() has a frame to add to
+static unsigned int frameCrc;
+static unsigned char sequence = 0;
+static unsigned int dropped = 0;        // Frames dropped for want of room
+
+static void put(unsigned char byte) {
+    ring[writePos++] = byte;
+    frameCrc = telemetry_crc(frameCrc, byte);
+}
+
+/************************************
+ * Description:
+ * Sets up the serial port and empties the ring buffer
+ ************************************/
+void telemetry_init(void) {
+    initUSART4();
+    ringHead = 0;
+    ringTail = 0;
+    frameOpen = 0;
+    sequence = 0;
+    dropped = 0;
+}
+
+/************************************
+ * Description:
+ * Starts a frame. Until telemetry_end() publishes it the interrupt does not send any of it
+ * Inputs:
+ * The frame type, its payload length, and TELEMETRY_WAIT to wait for the interrupt to make
+ * room or TELEMETRY_DROP to drop the frame if there is none
+ * Outputs:
+ * 1 if the frame was started, 0 if it was dropped
+ ************************************/
+unsigned char telemetry_begin(unsigned char type, unsigned char length, unsigned char full) {
+    while ((unsigned char)(ringTail - ringHead - 1) < (unsigned char)(length + TELEMETRY_OVERHEAD)) {
+        if (full == TELEMETRY_DROP) {
+            sequence++;  // Leave a gap for the host to count
+            dropped++;
+            return 0;
+        }
+        __delay_us(TELEMETRY_WAIT_US);
+    }
+    writePos = ringHead;
+    ring[writePos++] = TELEMETRY_SYNC;
+    frameCrc = 0xFFFF;
+    put(type);
+    put(length);
+    put(sequence++);
+    frameOpen = 1;
+    return 1;
+}
+
+/************************************
+ * Description:
+ * Whether a frame would fit in the ring buffer now, for senders that would rather try again
+ * later than wait or drop it
+ * Inputs:
+ * The payload length
+ ************************************/
+unsigned char telemetry_room(unsigned char length) {
+    return (unsigned char)(ringTail - ringHead - 1) >= (unsigned char)(length + TELEMETRY_OVERHEAD);
+}
+
+/************************************
+ * Description:
+ * Adds to the payload of the frame started by telemetry_begin(). Does nothing if the
+ * frame was dropped
+ ************************************/
+void telemetry_byte(unsigned char byte) {
+    if (frameOpen) {
+        put(byte);
+    }
+}
+
+void telemetry_word(unsigned int word) {
+    telemetry_byte((unsigned char)(word & 0xFF));
+    telemetry_byte((unsigned char)(word >> 8));
+}
+
+/************************************
+ * Description:
+ * Adds the CRC, publishes the frame to the interrupt and makes sure it is sending
+ ************************************/
+void telemetry_end(void) {
+    if (!frameOpen) {
+        return;
+    }
+    unsigned int crc = frameCrc;
+    ring[writePos++] = (unsigned char)(crc & 0xFF);
+    ring[writePos++] = (unsigned char)(crc >> 8);
+    frameOpen = 0;
+    ringHead = writePos;
+    PIE4bits.TX4IE = 1;
+}
+
+/************************************
+ * Description:
+ * Called from the interrupt when the EUSART4 transmit buffer has room. Sends the next
+ * byte, or stops the interrupt once the ring buffer is empty
+ ************************************/
+void telemetry_tx_isr(void) {
+    if (ringTail != ringHead) {
+        HAL_UART_TX(ring[ringTail]);
+        ringTail++;
+    } else {
+        PIE4bits.TX4IE = 0;
+    }
+}
+
+unsigned int telemetry_dropped(void) {
+    return dropped;
+}
+
+#endif
+
+#if TELEMETRY_ENABLE
+
+static unsigned char lastMotion = 0xFF;
+static unsigned char lastPower = 0;
+static unsigned int batteryTick = 0;
+
+/************************************
+ * Description:
+ * Sends the result of classifying a reading
+ * Inputs:
+ * The colour index from segment, the result of the vote and the reading in HSV
+ ************************************/
+void telemetry_classify(unsigned char colour_index, unsigned char colour_out, unsigned char H, unsigned char S, unsigned char V) {
+    if (telemetry_begin(TELEMETRY_CLASSIFY, TELEMETRY_CLASSIFY_LEN, TELEMETRY_DROP)) {
+        telemetry_word(tickCount);
+        telemetry_byte(colour_index);
+        telemetry_byte(colour_out);
+        telemetry_byte(H);
+        telemetry_byte(S);
+        telemetry_byte(V);
+        telemetry_end();
+    }
+}
+
+/************************************
+ * Description:
+ * Sends a motion command, unless it repeats the last one. The main loop gives the same
+ * command every time round
+ * Inputs:
+ * TRACE_MOTION_* and the power
+ ************************************/
+void telemetry_motion(unsigned char motion, unsigned char power) {
+    if (motion == lastMotion && power == lastPower) {
+        return;
+    }
+    lastMotion = motion;
+    lastPower = power;
+    if (telemetry_begin(TELEMETRY_MOTION, TELEMETRY_MOTION_LEN, TELEMETRY_DROP)) {
+        telemetry_word(tickCount);
+        telemetry_byte(motion);
+        telemetry_byte(power);
+        telemetry_end();
+    }
+}
+
+/************************************
+ * Description:
+ * Sends the timing of a segment of the route, or of a step of the return, that has ended
+ * Inputs:
+ * The move index, the colour state of the segment, deltaTime at its end, and the time
+ * recorded for it in the move array
+ ************************************/
+void telemetry_segment(unsigned char move, unsigned char state, unsigned int delta, unsigned int recorded) {
+    if (telemetry_begin(TELEMETRY_SEGMENT, TELEMETRY_SEGMENT_LEN, TELEMETRY_DROP)) {
+        telemetry_word(tickCount);
+        telemetry_byte(move);
+        telemetry_byte(state);
+        telemetry_word(delta);
+        telemetry_word(recorded);
+        telemetry_end();
+    }
+}
+
+/************************************
+ * Description:
+ * Sends how long start-up took. It waits for room, as it is sent only once
+ * Inputs:
+ * ms from reset to each phase of start-up ending, and whether the calibration was loaded
+ ************************************/
+void telemetry_boot(unsigned int readyMs, unsigned int calibratedMs, unsigned int movingMs, unsigned char saved) {
+    telemetry_begin(TELEMETRY_BOOT, TELEMETRY_BOOT_LEN, TELEMETRY_WAIT);
+    telemetry_word(readyMs);
+    telemetry_word(calibratedMs);
+    telemetry_word(movingMs);
+    telemetry_byte(saved);
+    telemetry_end();
+}
+
+/************************************
+ * Description:
+ * Sends a transition of the mission state machine. It waits for room, as there are only a
+ * few per card
+ * Inputs:
+ * The state left, the event, the state entered and the ticks spent in the state left
+ ************************************/
+void telemetry_mission(unsigned char from, unsigned char event, unsigned char to, unsigned int ticks) {
+    telemetry_begin(TELEMETRY_MISSION, TELEMETRY_MISSION_LEN, TELEMETRY_WAIT);
+    telemetry_word(tickCount);
+    telemetry_byte(from);
+    telemetry_byte(event);
+    telemetry_byte(to);
+    telemetry_word(ticks);
+    telemetry_end();
+}
+
+/************************************
+ * Description:
+ * Sends the battery voltage every TELEMETRY_BATTERY_TICKS. Call from the main loops; the
+ * battery is sampled by the TMR7 interrupt, which must not queue frames itself
+ ************************************/
+void telemetry_poll(void) {
+    unsigned int fastMv, slowMv;
+    if ((unsigned int)(tickCount - batteryTick) < TELEMETRY_BATTERY_TICKS) {
+        return;
+    }
+    batteryTick = tickCount;
+    ADC_getBattery(&fastMv, &slowMv);
+    if (telemetry_begin(TELEMETRY_BATTERY, TELEMETRY_BATTERY_LEN, TELEMETRY_DROP)) {
+        telemetry_word(batteryTick);
+        telemetry_word(fastMv);
+        telemetry_word(slowMv);
+        telemetry_byte(stallDetected);
+        telemetry_end();
+    }
+}
+
+#endif
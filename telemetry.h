@@ -0,0 +1,113 @@
+/*
+ * File:   telemetry.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// Framed telemetry on EUSART4 (see serial.c). Frames are queued in a ring buffer and sent by
+// the TX4 interrupt, so the main loop only waits if the buffer is full, and only for frames
+// that must not be lost. host/telemetry_decode turns the stream into CSV.
+//
+// Each frame is
+//   TELEMETRY_SYNC, type, payload length, sequence number, payload, CRC (16-bit)
+// Multi-byte fields are little endian. The CRC is CRC-16/CCITT-FALSE over the type, length,
+// sequence number and payload. The sequence number counts every frame, including those
+// dropped for want of room, so a gap on the host shows how many were lost.
+//
+// The RGBC trace records (trace.h) are telemetry frames, and TELEMETRY_ENABLE turns them on
+// too. TRACE_ENABLE on its own sends only those, and CONSOLE_ENABLE only the console's
+// replies (console.h). The frames below need TELEMETRY_ENABLE:
+//   TELEMETRY_CLASSIFY  tick, colour index from segment, vote result, H, S, V
+//   TELEMETRY_MOTION    tick, TRACE_MOTION_*, power (sent when either changes)
+//   TELEMETRY_SEGMENT   tick, move index, colour state, deltaTime, recorded time (16-bit):
+//                       a segment of the route or a step of the return has ended
+//   TELEMETRY_BATTERY   tick, battery mV filtered over ~20 ms and ~0.6 s (16-bit), stall flag
+//   TELEMETRY_BOOT      ms from reset to the LCD and colour click being ready, to the
+//                       calibration being loaded or done, and to the motors running (16-bit),
+//                       and whether the calibration was the saved one
+//   TELEMETRY_MISSION   tick, state left, event, state entered (mission.h), ticks spent in the
+//                       state left (16-bit)
+#ifndef _telemetry_H
+#define _telemetry_H
+#define _XTAL_FREQ 64000000
+
+#include "hal.h"
+
+#ifndef TELEMETRY_ENABLE
+#define TELEMETRY_ENABLE    0
+#endif
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE        TELEMETRY_ENABLE  // The trace records are part of the telemetry
+#endif
+#ifndef CONSOLE_ENABLE
+#define CONSOLE_ENABLE      0     // The console (console.h) replies in frames
+#endif
+#define TELEMETRY_TRANSPORT (TELEMETRY_ENABLE || TRACE_ENABLE || CONSOLE_ENABLE)
+
+#define TELEMETRY_SYNC      0xA5
+#define TELEMETRY_OVERHEAD  6     // Sync, type, length, sequence and CRC bytes around a payload
+#define TELEMETRY_WAIT_US   100   // Poll period while waiting for room in the ring buffer
+
+// Frame types and their payload lengths
+#define TELEMETRY_CLASSIFY      'C'
+#define TELEMETRY_CLASSIFY_LEN  7
+#define TELEMETRY_MOTION        'M'
+#define TELEMETRY_MOTION_LEN    4
+#define TELEMETRY_SEGMENT       'T'
+#define TELEMETRY_SEGMENT_LEN   8
+#define TELEMETRY_BATTERY       'B'
+#define TELEMETRY_BATTERY_LEN   7
+#define TELEMETRY_BOOT          'U'
+#define TELEMETRY_BOOT_LEN      7
+#define TELEMETRY_MISSION       'N'
+#define TELEMETRY_MISSION_LEN   7
+
+#define TELEMETRY_BATTERY_TICKS 40  // Ticks (TICK_MS) between battery frames
+
+// What telemetry_begin() does when the ring buffer is full
+#define TELEMETRY_DROP      0
+#define TELEMETRY_WAIT      1
+
+unsigned int telemetry_crc(unsigned int crc, unsigned char byte);
+
+#if TELEMETRY_TRANSPORT
+
+// The transport, also used by the trace recorder
+void telemetry_init(void);
+unsigned char telemetry_begin(unsigned char type, unsigned char length, unsigned char full);
+unsigned char telemetry_room(unsigned char length);
+void telemetry_byte(unsigned char byte);
+void telemetry_word(unsigned int word);
+void telemetry_end(void);
+void telemetry_tx_isr(void);
+unsigned int telemetry_dropped(void);
+
+#else
+
+#define telemetry_init()                                    ((void)0)
+#define telemetry_tx_isr()                                  ((void)0)
+
+#endif
+
+#if TELEMETRY_ENABLE
+
+void telemetry_classify(unsigned char colour_index, unsigned char colour_out, unsigned char H, unsigned char S, unsigned char V);
+void telemetry_motion(unsigned char motion, unsigned char power);
+void telemetry_segment(unsigned char move, unsigned char state, unsigned int delta, unsigned int recorded);
+void telemetry_poll(void);
+void telemetry_boot(unsigned int readyMs, unsigned int calibratedMs, unsigned int movingMs, unsigned char saved);
+void telemetry_mission(unsigned char from, unsigned char event, unsigned char to, unsigned int ticks);
+
+#else
+
+#define telemetry_classify(index, out, H, S, V)             ((void)0)
+#define telemetry_motion(motion, power)                     ((void)0)
+#define telemetry_segment(move, state, delta, recorded)     ((void)0)
+#define telemetry_poll()                                    ((void)0)
+#define telemetry_boot(ready, calibrated, moving, saved)    ((void)0)
+#define telemetry_mission(from, event, to, ticks)           ((void)0)
+
+#endif
+
+#endif
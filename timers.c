@@ -5,7 +5,7 @@
  * Created on March 1, 2024
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "timers.h"
 
 /************************************
@@ -9,7 +9,9 @@
 #define _timers_H
 #define _XTAL_FREQ 64000000
 
-#include <xc.h>
+#include "hal.h"
+
+#define TICK_MS 5  // Period of the TMR7 tick that drives deltaTime and tickCount
 
 void Timer_init(void);
 
@@ -0,0 +1,95 @@
+/*
+ * File:   trace.c
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+#include "hal.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "timers.h"
+
+#if TRACE_ENABLE
+
+extern volatile unsigned int tickCount;
+
+static unsigned char motion = TRACE_MOTION_STOPPED;
+static unsigned char label = TRACE_LABEL_UNKNOWN;
+
+/************************************
+ * Description:
+ * Starts the trace. telemetry_init() must have been called, and interrupts enabled
+ ************************************/
+void trace_init(void) {
+    telemetry_begin(TRACE_START, TRACE_START_LEN, TELEMETRY_WAIT);
+    telemetry_byte(TRACE_VERSION);
+    telemetry_byte(TICK_MS);
+    telemetry_end();
+}
+
+/************************************
+ * Description:
+ * Records the calibration that the following samples are classified with
+ * Inputs:
+ * The 8 colour centres and spreads, the gain and the min saturation and value
+ ************************************/
+void trace_calibration(const struct HSV* colourCentres, const struct HSVSpread* colourSpread,
+                       unsigned char gain, unsigned char minS, unsigned char minV) {
+    telemetry_begin(TRACE_CALIBRATION, TRACE_CALIBRATION_LEN, TELEMETRY_WAIT);
+    telemetry_byte(gain);
+    telemetry_byte(minS);
+    telemetry_byte(minV);
+    for (unsigned char i = 0; i < 8; i++) {
+        telemetry_byte(colourCentres[i].H);
+        telemetry_byte(colourCentres[i].S);
+        telemetry_byte(colourCentres[i].V);
+        telemetry_word(colourSpread[i].varH);
+        telemetry_word(colourSpread[i].varS);
+        telemetry_word(colourSpread[i].varV);
+        telemetry_word(colourSpread[i].threshold);
+    }
+    telemetry_end();
+}
+
+/************************************
+ * Description:
+ * Records a reading with the current motion and label
+ * Inputs:
+ * The counts given to color_normalise(), the AGAIN index and ATIME cycles they were
+ * taken with, and TRACE_FLAG_* bits
+ ************************************/
+void trace_sample(const struct RGBRaw* raw, unsigned char again, unsigned char atime, unsigned char flags) {
+    telemetry_begin(TRACE_SAMPLE, TRACE_SAMPLE_LEN, TELEMETRY_WAIT);
+    telemetry_word(tickCount);
+    telemetry_word(raw->C);
+    telemetry_word(raw->R);
+    telemetry_word(raw->G);
+    telemetry_word(raw->B);
+    telemetry_byte(again);
+    telemetry_byte(atime);
+    telemetry_byte(motion);
+    telemetry_byte(label);
+    telemetry_byte(flags);
+    telemetry_end();
+}
+
+/************************************
+ * Description:
+ * Records that the colour vote has been reset
+ ************************************/
+void trace_reset(void) {
+    telemetry_begin(TRACE_RESET, TRACE_RESET_LEN, TELEMETRY_WAIT);
+    telemetry_word(tickCount);
+    telemetry_end();
+}
+
+void trace_set_motion(unsigned char m) {
+    motion = m;
+}
+
+void trace_set_label(unsigned char l) {
+    label = l;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * File:   trace.h
+ * Author: Luke Alderson
+ *
+ * Created on October 18, 2026
+ */
+
+// RGBC trace recorder. With TRACE_ENABLE set, every colour reading the firmware classifies
+// or calibrates with is sent as a telemetry frame (see telemetry.h), so that a run can be
+// replayed through the classification code on a PC (host/replay.c).
+//
+// The records' payloads are below. Multi-byte fields are little endian:
+//   TRACE_START        version, TICK_MS
+//   TRACE_CALIBRATION  gain, minS, minV, then for each of the 8 colour centres
+//                      H, S, V, varH, varS, varV, threshold (16-bit)
+//   TRACE_SAMPLE       tick, CDATA, RDATA, GDATA, BDATA (16-bit), AGAIN index, ATIME cycles,
+//                      motion, label, flags
+//   TRACE_RESET        tick (16-bit): the vote was reset by resetColourAveraging()
+// The counts are those color_normalise() is given: the raw data registers, or the LED on
+// minus LED off counts with TRACE_FLAG_DIFFERENTIAL. A replay needs every record, so they
+// wait for room in the ring buffer rather than being dropped
+#ifndef _trace_H
+#define _trace_H
+
+#include "hal.h"
+#include "color.h"
+#include "telemetry.h"
+
+#define TRACE_VERSION       2     // 1 had no length, sequence number or CRC
+
+// Record types and their payload lengths
+#define TRACE_START         'S'
+#define TRACE_START_LEN     2
+#define TRACE_CALIBRATION   'K'
+#define TRACE_CALIBRATION_LEN (3 + 8 * 11)
+#define TRACE_SAMPLE        'R'
+#define TRACE_SAMPLE_LEN    15
+#define TRACE_RESET         'Z'
+#define TRACE_RESET_LEN     2
+
+// What the motors were doing when a sample was taken
+#define TRACE_MOTION_STOPPED 0
+#define TRACE_MOTION_FORWARD 1
+#define TRACE_MOTION_REVERSE 2
+#define TRACE_MOTION_TURNING 3
+
+// Ground truth labels are colour indexes as returned by senseColour() (0 for no card, 3 White
+// to 10 Blue). The firmware only knows the truth while calibrating
+#define TRACE_LABEL_UNKNOWN 0xFF
+
+// Sample flags
+#define TRACE_FLAG_DIFFERENTIAL 0x01  // Ambient light was subtracted
+#define TRACE_FLAG_VOTE         0x02  // The sample went through the senseColour() vote
+
+#if TRACE_ENABLE
+
+void trace_init(void);
+void trace_calibration(const struct HSV* colourCentres, const struct HSVSpread* colourSpread,
+                       unsigned char gain, unsigned char minS, unsigned char minV);
+void trace_sample(const struct RGBRaw* raw, unsigned char again, unsigned char atime, unsigned char flags);
+void trace_reset(void);
+void trace_set_motion(unsigned char motion);
+void trace_set_label(unsigned char label);
+
+#else
+
+#define trace_init()                        ((void)0)
+#define trace_calibration(c, s, g, ms, mv)  ((void)0)
+#define trace_sample(raw, again, atime, f)  ((void)0)
+#define trace_reset()                       ((void)0)
+#define trace_set_motion(motion)            ((void)0)
+#define trace_set_label(label)              ((void)0)
+
+#endif
+
+#endif
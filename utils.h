@@ -10,7 +10,7 @@
 #ifndef _utils_H
 #define	_utils_H
 
-#include <xc.h> // include processor files - each processor file is guarded.  
+#include "hal.h" // include processor files - each processor file is guarded.  
 
 // Defines
 #define BRAKE_LIGHT_INIT        TRISDbits.TRISD4